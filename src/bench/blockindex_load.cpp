@@ -0,0 +1,174 @@
+// Copyright (c) 2009-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "arith_uint256.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "pow.h"
+#include "random.h"
+#include "txdb.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <boost/filesystem.hpp>
+
+// Number of synthetic headers written to the block tree database. Every
+// header is mined against the regtest target, so its scrypt PoW is valid.
+static const int NUM_BLOCK_INDEX_ENTRIES = 1000;
+
+// Number of post-fork entries, each with a miner signature (nVerify), in the
+// large block index. These are not mined, as that would take too long.
+static const int NUM_LARGE_BLOCK_INDEX_ENTRIES = 2000000;
+
+static boost::filesystem::path CreateBlockTreeDB()
+{
+    ClearDatadirCache();
+    boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / strprintf("bench_solidus_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+    boost::filesystem::create_directories(pathTemp);
+    ForceSetArg("-datadir", pathTemp.string());
+    pblocktree = new CBlockTreeDB(1 << 20, true);
+    return pathTemp;
+}
+
+static boost::filesystem::path SetupBlockTreeDB()
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    boost::filesystem::path pathTemp = CreateBlockTreeDB();
+
+    std::vector<uint256> vHash(NUM_BLOCK_INDEX_ENTRIES);
+    std::vector<CBlockIndex> vIndex(NUM_BLOCK_INDEX_ENTRIES);
+    std::vector<const CBlockIndex*> vBlocks;
+    CBlockHeader header;
+    header.nVersion = 1;
+    header.nTime = Params().GenesisBlock().nTime;
+    header.nBits = UintToArith256(consensusParams.powLimit).GetCompact();
+    for (int i = 0; i < NUM_BLOCK_INDEX_ENTRIES; i++) {
+        header.hashPrevBlock = i ? vHash[i - 1] : uint256();
+        header.hashMerkleRoot = ArithToUint256(arith_uint256(i));
+        header.nTime++;
+        header.nNonce = 0;
+        uint256 hashPoW;
+        while (!CheckProofOfWork(hashPoW = header.GetPoWHash(), header.nBits, consensusParams))
+            ++header.nNonce;
+
+        vHash[i] = header.GetHash();
+        vIndex[i] = CBlockIndex(header);
+        vIndex[i].phashBlock = &vHash[i];
+        vIndex[i].pprev = i ? &vIndex[i - 1] : NULL;
+        vIndex[i].nHeight = i;
+        vIndex[i].nStatus = BLOCK_VALID_TREE;
+        vIndex[i].SetBlockPoWHash(hashPoW);
+        vBlocks.push_back(&vIndex[i]);
+    }
+    assert(pblocktree->WriteBatchSync(std::vector<std::pair<int, const CBlockFileInfo*> >(), 0, vBlocks));
+    return pathTemp;
+}
+
+static boost::filesystem::path SetupLargeBlockTreeDB()
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    boost::filesystem::path pathTemp = CreateBlockTreeDB();
+
+    static const int BATCH_SIZE = 10000;
+    std::vector<unsigned char> vchSig(CBlockIndexVerify::COMPACT_SIGNATURE_SIZE);
+    CBlockHeader header;
+    header.nVersion = 1;
+    header.nTime = 1649496601;
+    header.nBits = UintToArith256(Params().GetConsensus().powLimit).GetCompact();
+    // Stand-in for the last entry of the previous batch, so pprev links the
+    // whole chain when written
+    uint256 hashPrev;
+    CBlockIndex indexPrev;
+    indexPrev.phashBlock = &hashPrev;
+    for (int nStart = 0; nStart < NUM_LARGE_BLOCK_INDEX_ENTRIES; nStart += BATCH_SIZE) {
+        int nCount = std::min(BATCH_SIZE, NUM_LARGE_BLOCK_INDEX_ENTRIES - nStart);
+        std::vector<uint256> vHash(nCount);
+        std::vector<CBlockIndex> vIndex(nCount);
+        std::vector<const CBlockIndex*> vBlocks;
+        for (int i = 0; i < nCount; i++) {
+            GetRandBytes(vchSig.data(), vchSig.size());
+            vchSig[0] = 31;
+            header.hashPrevBlock = i ? vHash[i - 1] : hashPrev;
+            header.hashMerkleRoot = ArithToUint256(arith_uint256(nStart + i));
+            header.nTime++;
+            header.nVerify = EncodeBase64(vchSig.data(), vchSig.size());
+
+            vHash[i] = header.GetHash();
+            vIndex[i] = CBlockIndex(header);
+            vIndex[i].phashBlock = &vHash[i];
+            vIndex[i].pprev = i ? &vIndex[i - 1] : (nStart ? &indexPrev : NULL);
+            vIndex[i].nHeight = nStart + i;
+            vIndex[i].nStatus = BLOCK_VALID_TREE;
+            vBlocks.push_back(&vIndex[i]);
+        }
+        assert(pblocktree->WriteBatchSync(std::vector<std::pair<int, const CBlockFileInfo*> >(), 0, vBlocks));
+        hashPrev = vHash[nCount - 1];
+    }
+    return pathTemp;
+}
+
+static void TeardownBlockTreeDB(const boost::filesystem::path& pathTemp)
+{
+    UnloadBlockIndex();
+    delete pblocktree;
+    pblocktree = NULL;
+    boost::filesystem::remove_all(pathTemp);
+}
+
+// Load the block index, checking only the cached PoW hashes.
+static void BlockIndexLoad(benchmark::State& state)
+{
+    boost::filesystem::path pathTemp = SetupBlockTreeDB();
+
+    while (state.KeepRunning()) {
+        UnloadBlockIndex();
+        assert(pblocktree->LoadBlockIndexGuts(InsertBlockIndex));
+    }
+
+    TeardownBlockTreeDB(pathTemp);
+}
+
+// Load the block index and recompute every scrypt PoW hash on all cores,
+// as done on startup with -checkblockpow.
+static void BlockIndexLoadCheckPoW(benchmark::State& state)
+{
+    boost::filesystem::path pathTemp = SetupBlockTreeDB();
+
+    while (state.KeepRunning()) {
+        UnloadBlockIndex();
+        assert(pblocktree->LoadBlockIndexGuts(InsertBlockIndex));
+
+        std::vector<CBlockIndex*> vIndex;
+        for (const auto& entry : mapBlockIndex) {
+            if (entry.second->pprev)
+                vIndex.push_back(entry.second);
+        }
+        assert(VerifyBlockIndexPoW(vIndex, Params().GetConsensus()));
+    }
+
+    TeardownBlockTreeDB(pathTemp);
+}
+
+// Load a 2M-entry post-fork block index; every entry carries a miner
+// signature, held in compact form in memory.
+static void BlockIndexLoadLarge(benchmark::State& state)
+{
+    boost::filesystem::path pathTemp = SetupLargeBlockTreeDB();
+
+    while (state.KeepRunning()) {
+        UnloadBlockIndex();
+        assert(pblocktree->LoadBlockIndexGuts(InsertBlockIndex));
+    }
+
+    TeardownBlockTreeDB(pathTemp);
+}
+
+BENCHMARK(BlockIndexLoad);
+BENCHMARK(BlockIndexLoadCheckPoW);
+BENCHMARK(BlockIndexLoadLarge);
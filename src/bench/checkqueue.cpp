@@ -20,18 +20,19 @@ static const size_t BATCHES = 101;
 static const size_t BATCH_SIZE = 30;
 static const int PREVECTOR_SIZE = 28;
 static const int QUEUE_BATCH_SIZE = 128;
-static void CCheckQueueSpeed(benchmark::State& state)
+struct FakeJobNoWork {
+    bool operator()()
+    {
+        return true;
+    }
+    void swap(FakeJobNoWork& x){};
+};
+
+static void CCheckQueueSpeedThreads(benchmark::State& state, int nThreads)
 {
-    struct FakeJobNoWork {
-        bool operator()()
-        {
-            return true;
-        }
-        void swap(FakeJobNoWork& x){};
-    };
     CCheckQueue<FakeJobNoWork> queue {QUEUE_BATCH_SIZE};
     boost::thread_group tg;
-    for (auto x = 0; x < std::max(MIN_CORES, GetNumCores()); ++x) {
+    for (auto x = 0; x < nThreads; ++x) {
        tg.create_thread([&]{queue.Thread();});
     }
     while (state.KeepRunning()) {
@@ -58,6 +59,49 @@ static void CCheckQueueSpeed(benchmark::State& state)
     tg.join_all();
 }
 
+static void CCheckQueueSpeed(benchmark::State& state)
+{
+    CCheckQueueSpeedThreads(state, std::max(MIN_CORES, GetNumCores()));
+}
+
+// The same, with a given number of worker threads, to show how the queue
+// scales. Counts beyond the number of cores only measure the overhead of
+// threads that cannot run at the same time.
+static void CCheckQueueSpeed1(benchmark::State& state)
+{
+    CCheckQueueSpeedThreads(state, 1);
+}
+
+static void CCheckQueueSpeed2(benchmark::State& state)
+{
+    CCheckQueueSpeedThreads(state, 2);
+}
+
+static void CCheckQueueSpeed4(benchmark::State& state)
+{
+    CCheckQueueSpeedThreads(state, 4);
+}
+
+static void CCheckQueueSpeed8(benchmark::State& state)
+{
+    CCheckQueueSpeedThreads(state, 8);
+}
+
+static void CCheckQueueSpeed16(benchmark::State& state)
+{
+    CCheckQueueSpeedThreads(state, 16);
+}
+
+static void CCheckQueueSpeed32(benchmark::State& state)
+{
+    CCheckQueueSpeedThreads(state, 32);
+}
+
+static void CCheckQueueSpeed64(benchmark::State& state)
+{
+    CCheckQueueSpeedThreads(state, 64);
+}
+
 // This Benchmark tests the CheckQueue with a slightly realistic workload,
 // where checks all contain a prevector that is indirect 50% of the time
 // and there is a little bit of work done between calls to Add.
@@ -100,4 +144,11 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.join_all();
 }
 BENCHMARK(CCheckQueueSpeed);
+BENCHMARK(CCheckQueueSpeed1);
+BENCHMARK(CCheckQueueSpeed2);
+BENCHMARK(CCheckQueueSpeed4);
+BENCHMARK(CCheckQueueSpeed8);
+BENCHMARK(CCheckQueueSpeed16);
+BENCHMARK(CCheckQueueSpeed32);
+BENCHMARK(CCheckQueueSpeed64);
 BENCHMARK(CCheckQueueSpeedPrevectorJob);
@@ -0,0 +1,61 @@
+// Copyright (c) 2009-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "blockencodings.h"
+#include "policy/policy.h"
+#include "random.h"
+#include "txmempool.h"
+
+#include <vector>
+
+// Transactions in the announced block, all of them in the mempool
+static const size_t RECONSTRUCT_BLOCK_TXS = 2000;
+
+// Measures how long it takes to match the short IDs of a compact block
+// against a mempool of nPoolSize transactions, which is what a node does
+// before it can relay a new block.
+static void CompactBlockReconstruct(benchmark::State& state, size_t nPoolSize)
+{
+    CTxMemPool pool(CFeeRate(0));
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx.vout[0].nValue = COIN;
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(tx));
+    LockPoints lp;
+    for (size_t i = 0; i < nPoolSize; i++) {
+        tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        CTransactionRef ptx = MakeTransactionRef(tx);
+        pool.addUnchecked(ptx->GetHash(), CTxMemPoolEntry(ptx, 1000, 0, 10.0, 1, COIN, false, 4, lp));
+        if (i % (nPoolSize / RECONSTRUCT_BLOCK_TXS) == 0 && block.vtx.size() <= RECONSTRUCT_BLOCK_TXS)
+            block.vtx.push_back(ptx);
+    }
+    block.nVersion = 1;
+    block.nBits = 0x1e0ffff0;
+    CBlockHeaderAndShortTxIDs cmpctblock(block, true);
+    std::vector<std::pair<uint256, CTransactionRef> > extra_txn;
+
+    while (state.KeepRunning()) {
+        PartiallyDownloadedBlock partialBlock(&pool);
+        if (partialBlock.InitData(cmpctblock, extra_txn) != READ_STATUS_OK || !partialBlock.IsTxAvailable(RECONSTRUCT_BLOCK_TXS))
+            return;
+    }
+}
+
+static void CompactBlockReconstruct5000(benchmark::State& state)
+{
+    CompactBlockReconstruct(state, 5000);
+}
+
+static void CompactBlockReconstruct50000(benchmark::State& state)
+{
+    CompactBlockReconstruct(state, 50000);
+}
+
+BENCHMARK(CompactBlockReconstruct5000);
+BENCHMARK(CompactBlockReconstruct50000);
@@ -10,6 +10,7 @@
 #include "uint256.h"
 #include "utiltime.h"
 #include "crypto/ripemd160.h"
+#include "crypto/scrypt.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
 #include "crypto/sha512.h"
@@ -41,6 +42,41 @@ static void SHA256(benchmark::State& state)
         CSHA256().Write(in.data(), in.size()).Finalize(hash);
 }
 
+static void SHA256Using(benchmark::State& state, const std::string& strImplementation)
+{
+    if (!SHA256SelectImplementation(strImplementation)) {
+        while (state.KeepRunning()) {}
+        return;
+    }
+    SHA256(state);
+    SHA256AutoDetect();
+}
+
+static void SHA256_Standard(benchmark::State& state) { SHA256Using(state, "standard"); }
+static void SHA256_SHANI(benchmark::State& state) { SHA256Using(state, "shani"); }
+
+/* Number of 64-byte inputs to double-SHA256 per iteration, as in a merkle tree level */
+static const size_t SHA256D64_INPUTS = 1024;
+
+static void SHA256D64Using(benchmark::State& state, const std::string& strImplementation)
+{
+    if (!strImplementation.empty() && !SHA256SelectImplementation(strImplementation)) {
+        while (state.KeepRunning()) {}
+        return;
+    }
+    std::vector<uint8_t> in(64 * SHA256D64_INPUTS, 0);
+    std::vector<uint8_t> out(32 * SHA256D64_INPUTS);
+    while (state.KeepRunning())
+        SHA256D64(out.data(), in.data(), SHA256D64_INPUTS);
+    SHA256AutoDetect();
+}
+
+static void SHA256D64_1024(benchmark::State& state) { SHA256D64Using(state, ""); }
+static void SHA256D64_1024_Standard(benchmark::State& state) { SHA256D64Using(state, "standard"); }
+static void SHA256D64_1024_SSE41(benchmark::State& state) { SHA256D64Using(state, "sse4.1"); }
+static void SHA256D64_1024_AVX2(benchmark::State& state) { SHA256D64Using(state, "avx2"); }
+static void SHA256D64_1024_SHANI(benchmark::State& state) { SHA256D64Using(state, "shani"); }
+
 static void SHA256_32b(benchmark::State& state)
 {
     std::vector<uint8_t> in(32,0);
@@ -69,10 +105,52 @@ static void SipHash_32b(benchmark::State& state)
     }
 }
 
+/* Number of 80-byte block headers to scrypt per iteration */
+static const int SCRYPT_HEADERS = 8;
+
+static void Scrypt_Header(benchmark::State& state)
+{
+#if defined(USE_SSE2)
+    scrypt_detect_sse2();
+#endif
+    std::vector<char> in(80 * SCRYPT_HEADERS, 0);
+    std::vector<char> out(32 * SCRYPT_HEADERS);
+    char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
+    while (state.KeepRunning()) {
+        for (int i = 0; i < SCRYPT_HEADERS; i++) {
+            scrypt_1024_1_1_256_sp(&in[80 * i], &out[32 * i], scratchpad);
+        }
+    }
+}
+
+static void Scrypt_Header_Batched(benchmark::State& state)
+{
+#if defined(USE_SSE2)
+    scrypt_detect_sse2();
+#endif
+    scrypt_detect_multi();
+    std::vector<char> in(80 * SCRYPT_HEADERS, 0);
+    std::vector<char> out(32 * SCRYPT_HEADERS);
+    std::vector<char> scratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+    while (state.KeepRunning()) {
+        scrypt_1024_1_1_256_sp_multi(&in[0], &out[0], &scratchpad[0], SCRYPT_HEADERS);
+    }
+}
+
 BENCHMARK(RIPEMD160);
 BENCHMARK(SHA1);
 BENCHMARK(SHA256);
+BENCHMARK(SHA256_Standard);
+BENCHMARK(SHA256_SHANI);
 BENCHMARK(SHA512);
 
 BENCHMARK(SHA256_32b);
+BENCHMARK(SHA256D64_1024);
+BENCHMARK(SHA256D64_1024_Standard);
+BENCHMARK(SHA256D64_1024_SSE41);
+BENCHMARK(SHA256D64_1024_AVX2);
+BENCHMARK(SHA256D64_1024_SHANI);
 BENCHMARK(SipHash_32b);
+
+BENCHMARK(Scrypt_Header);
+BENCHMARK(Scrypt_Header_Batched);
@@ -0,0 +1,85 @@
+// Copyright (c) 2009-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "arith_uint256.h"
+#include "policy/policy.h"
+#include "rpc/protocol.h"
+#include "txmempool.h"
+#include "validation.h"
+
+#include <atomic>
+#include <limits>
+#include <vector>
+
+#include <boost/thread/thread.hpp>
+
+#include <univalue.h>
+
+// Defined in rpc/blockchain.cpp
+extern UniValue mempoolToJSON(bool fVerbose = false, JSONStreamWriter* pstream = NULL);
+
+static const int READERS_POOL_SIZE = 2000;
+static const int READERS_CHAIN_LENGTH = 4;
+
+static CTxMemPoolEntry MakeEntry(const CMutableTransaction& tx)
+{
+    LockPoints lp;
+    return CTxMemPoolEntry(MakeTransactionRef(tx), 1000, 0, 10.0, 1, tx.vout[0].nValue, false, 4, lp);
+}
+
+// Same steps AcceptToMemoryPool takes under mempool.cs to add a transaction
+static void AddToMempool(const CMutableTransaction& tx)
+{
+    LOCK(mempool.cs);
+    CTxMemPoolEntry entry = MakeEntry(tx);
+    CTxMemPool::setEntries setAncestors;
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    mempool.CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+    mempool.addUnchecked(tx.GetHash(), entry, setAncestors, false);
+}
+
+// Transactions are added to and removed from a mempool of READERS_POOL_SIZE
+// transactions, while another thread keeps building verbose getrawmempool
+// replies. Measures how much the readers get in the way of transaction
+// acceptance.
+static void MempoolAddWithReaders(benchmark::State& state)
+{
+    mempool.clear();
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx.vout[0].nValue = COIN;
+    for (int i = 0; i < READERS_POOL_SIZE; i++) {
+        if (i % READERS_CHAIN_LENGTH == 0)
+            tx.vin[0].prevout = COutPoint(ArithToUint256(arith_uint256(i + 1)), 0);
+        else
+            tx.vin[0].prevout = COutPoint(tx.GetHash(), 0);
+        tx.vin[0].scriptSig = CScript() << i;
+        AddToMempool(tx);
+    }
+
+    std::atomic<bool> fStop(false);
+    boost::thread reader([&] {
+        while (!fStop)
+            mempoolToJSON(true);
+    });
+
+    // Child of the last transaction in the pool
+    tx.vin[0].prevout = COutPoint(tx.GetHash(), 0);
+    tx.vin[0].scriptSig = CScript() << OP_0;
+    while (state.KeepRunning()) {
+        AddToMempool(tx);
+        mempool.removeRecursive(tx);
+    }
+
+    fStop = true;
+    reader.join();
+    mempool.clear();
+}
+
+BENCHMARK(MempoolAddWithReaders);
@@ -0,0 +1,37 @@
+// Copyright (c) 2009-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "uint256.h"
+#include "random.h"
+#include "consensus/merkle.h"
+
+#include <vector>
+
+// Computes the merkle root of a block with nLeaves transactions, and checks
+// it for mutation, as block validation does.
+static void MerkleRoot(benchmark::State& state, size_t nLeaves)
+{
+    std::vector<uint256> leaves(nLeaves);
+    for (size_t i = 0; i < leaves.size(); i++)
+        leaves[i] = GetRandHash();
+    while (state.KeepRunning()) {
+        bool mutation = false;
+        uint256 hash = ComputeMerkleRoot(leaves, &mutation);
+        leaves[mutation] = hash;
+    }
+}
+
+static void MerkleRoot1000(benchmark::State& state) { MerkleRoot(state, 1000); }
+static void MerkleRoot2000(benchmark::State& state) { MerkleRoot(state, 2000); }
+static void MerkleRoot5000(benchmark::State& state) { MerkleRoot(state, 5000); }
+static void MerkleRoot10000(benchmark::State& state) { MerkleRoot(state, 10000); }
+static void MerkleRoot20000(benchmark::State& state) { MerkleRoot(state, 20000); }
+
+BENCHMARK(MerkleRoot1000);
+BENCHMARK(MerkleRoot2000);
+BENCHMARK(MerkleRoot5000);
+BENCHMARK(MerkleRoot10000);
+BENCHMARK(MerkleRoot20000);
@@ -0,0 +1,132 @@
+// Copyright (c) 2009-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "compat.h"
+#include "netbase.h"
+#include "netpoller.h"
+#include "util.h"
+
+#include <vector>
+
+// Number of connections that have data waiting, per wakeup
+static const size_t POLLER_ACTIVE_CONNECTIONS = 16;
+
+/** Both ends of a number of connections over the loopback interface */
+struct LoopbackConnections
+{
+    std::vector<SOCKET> vAccepted;
+    std::vector<SOCKET> vConnected;
+
+    ~LoopbackConnections()
+    {
+        for (size_t i = 0; i < vAccepted.size(); i++)
+            CloseSocket(vAccepted[i]);
+        for (size_t i = 0; i < vConnected.size(); i++)
+            CloseSocket(vConnected[i]);
+    }
+
+    bool Open(size_t nCount)
+    {
+        SOCKET hListenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (hListenSocket == INVALID_SOCKET)
+            return false;
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (bind(hListenSocket, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+            listen(hListenSocket, SOMAXCONN) == SOCKET_ERROR ||
+            getsockname(hListenSocket, (struct sockaddr*)&addr, &len) == SOCKET_ERROR) {
+            CloseSocket(hListenSocket);
+            return false;
+        }
+        while (vAccepted.size() < nCount) {
+            SOCKET hSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (hSocket == INVALID_SOCKET)
+                break;
+            if (connect(hSocket, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+                CloseSocket(hSocket);
+                break;
+            }
+            vConnected.push_back(hSocket);
+            SOCKET hAccepted = accept(hListenSocket, NULL, NULL);
+            if (hAccepted == INVALID_SOCKET)
+                break;
+            vAccepted.push_back(hAccepted);
+        }
+        CloseSocket(hListenSocket);
+        return vAccepted.size() == nCount;
+    }
+};
+
+// Opens nConnections loopback connections, and measures how quickly the
+// backend finds the few of them that have data to read, as a node with many
+// mostly idle peers would.
+static void SocketPollerLoopback(benchmark::State& state, const std::string& strBackend, size_t nConnections)
+{
+    std::unique_ptr<CSocketPoller> poller = CreateSocketPoller(strBackend);
+    if (!poller) {
+        while (state.KeepRunning()) {}
+        return;
+    }
+    int nFD = RaiseFileDescriptorLimit(nConnections * 2 + 64);
+    nConnections = std::min(nConnections, (size_t)std::max(nFD - 64, 0) / 2);
+
+    LoopbackConnections conns;
+    if (!conns.Open(nConnections)) {
+        fprintf(stderr, "Could not open %u loopback connections\n", (unsigned int)nConnections);
+        return;
+    }
+
+    std::vector<SocketWatch> vWatch;
+    std::vector<size_t> vWatchable;
+    for (size_t i = 0; i < conns.vAccepted.size(); i++) {
+        vWatch.push_back(SocketWatch(conns.vAccepted[i], i, SOCKET_RECV));
+        if (poller->IsWatchable(conns.vAccepted[i]))
+            vWatchable.push_back(i);
+    }
+    if (vWatchable.empty())
+        return;
+
+    CSocketPoller::ReadySockets vReady;
+    size_t nNext = 0;
+    char ch = 0;
+    while (state.KeepRunning()) {
+        size_t nActive = std::min(POLLER_ACTIVE_CONNECTIONS, vWatchable.size());
+        for (size_t i = 0; i < nActive; i++)
+            send(conns.vConnected[vWatchable[(nNext + i) % vWatchable.size()]], &ch, 1, MSG_NOSIGNAL);
+        nNext += nActive;
+
+        size_t nReceived = 0;
+        while (nReceived < nActive) {
+            if (!poller->Wait(vWatch, 1000, vReady) || vReady.empty())
+                return;
+            for (size_t i = 0; i < vReady.size(); i++) {
+                if (recv(vReady[i].first, &ch, 1, MSG_DONTWAIT) == 1)
+                    nReceived++;
+            }
+        }
+    }
+}
+
+static void SocketPollerSelect500(benchmark::State& state)
+{
+    SocketPollerLoopback(state, "select", 500);
+}
+
+static void SocketPollerEpoll500(benchmark::State& state)
+{
+    SocketPollerLoopback(state, "epoll", 500);
+}
+
+static void SocketPollerEpoll5000(benchmark::State& state)
+{
+    SocketPollerLoopback(state, "epoll", 5000);
+}
+
+BENCHMARK(SocketPollerSelect500);
+BENCHMARK(SocketPollerEpoll500);
+BENCHMARK(SocketPollerEpoll5000);
@@ -4,6 +4,7 @@
 
 #include "bench.h"
 #include "key.h"
+#include "random.h"
 #if defined(HAVE_CONSENSUS_LIB)
 #include "script/bitcoinconsensus.h"
 #endif
@@ -99,4 +100,56 @@ static void VerifyScriptBench(benchmark::State& state)
     }
 }
 
+// Number of signatures verified per iteration by the signature benchmarks
+static const size_t VERIFY_SIGNATURES = 64;
+
+/** Signatures by different keys, as the inputs of a block would have */
+struct SignatureSet
+{
+    std::vector<CPubKey> vPubKeys;
+    std::vector<uint256> vHashes;
+    std::vector<std::vector<unsigned char> > vSigs;
+
+    SignatureSet()
+    {
+        for (size_t i = 0; i < VERIFY_SIGNATURES; i++) {
+            CKey key;
+            key.MakeNewKey(true);
+            vPubKeys.push_back(key.GetPubKey());
+            vHashes.push_back(GetRandHash());
+            vSigs.emplace_back();
+            key.Sign(vHashes.back(), vSigs.back());
+        }
+    }
+};
+
+// Verifies VERIFY_SIGNATURES signatures one at a time, as script checks did
+// before signatures were verified in batches.
+static void VerifySignatures64_Single(benchmark::State& state)
+{
+    SignatureSet set;
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < VERIFY_SIGNATURES; i++) {
+            bool success = set.vPubKeys[i].Verify(set.vHashes[i], set.vSigs[i]);
+            assert(success);
+        }
+    }
+}
+
+// Verifies the same signatures as one batch.
+static void VerifySignatures64_Batch(benchmark::State& state)
+{
+    SignatureSet set;
+    std::vector<bool> vResult;
+    while (state.KeepRunning()) {
+        CSignatureBatch batch;
+        for (size_t i = 0; i < VERIFY_SIGNATURES; i++)
+            batch.Add(set.vPubKeys[i], set.vHashes[i], set.vSigs[i]);
+        bool success = batch.Verify(vResult);
+        assert(success);
+    }
+}
+
 BENCHMARK(VerifyScriptBench);
+BENCHMARK(VerifySignatures64_Single);
+BENCHMARK(VerifySignatures64_Batch);
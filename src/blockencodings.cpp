@@ -13,10 +13,23 @@
 #include "validation.h"
 #include "util.h"
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <system_error>
+#include <thread>
 #include <unordered_map>
 
 #define MIN_TRANSACTION_BASE_SIZE (::GetSerializeSize(CTransaction(), SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS))
 
+/** Fewest mempool entries worth matching against short IDs on another thread */
+static const size_t MIN_SHORTID_MATCH_BATCH = 8192;
+/** Most threads matching mempool entries against short IDs */
+static const int MAX_SHORTID_MATCH_THREADS = 8;
+/** Size in bits of the filter that rules out most non-matching short IDs */
+static const unsigned int SHORTID_FILTER_BITS = 18;
+
 CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID) :
         nonce(GetRand(std::numeric_limits<uint64_t>::max())),
         shorttxids(block.vtx.size() - 1), prefilledtxn(1), header(block) {
@@ -46,6 +59,140 @@ uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const {
 }
 
 
+namespace {
+
+/**
+ * A bitmap over the low bits of the announced short IDs. It fits in the
+ * CPU cache, so most mempool entries are ruled out without a hash table
+ * lookup.
+ */
+class ShortIDFilter
+{
+private:
+    std::vector<uint64_t> vBits;
+
+public:
+    ShortIDFilter() : vBits((1 << SHORTID_FILTER_BITS) / 64) {}
+
+    void Insert(uint64_t shortid)
+    {
+        uint32_t nBit = shortid & ((1 << SHORTID_FILTER_BITS) - 1);
+        vBits[nBit / 64] |= uint64_t(1) << (nBit % 64);
+    }
+
+    bool MayContain(uint64_t shortid) const
+    {
+        uint32_t nBit = shortid & ((1 << SHORTID_FILTER_BITS) - 1);
+        return (vBits[nBit / 64] >> (nBit % 64)) & 1;
+    }
+};
+
+typedef std::vector<std::pair<uint256, CTxMemPool::txiter> > TxHashes;
+
+/**
+ * Collect (index in vTxHashes, position in block) of the entries in
+ * [nBegin, nEnd) whose short ID was announced. All matches are kept, so that
+ * applying the ranges in order sees every short ID collision a single pass
+ * over the mempool would.
+ */
+void MatchShortIDs(const CBlockHeaderAndShortTxIDs& cmpctblock, const ShortIDFilter& filter, const std::unordered_map<uint64_t, uint16_t>& shorttxids,
+                   const TxHashes& vTxHashes, size_t nBegin, size_t nEnd, std::vector<std::pair<size_t, uint16_t> >& vMatches)
+{
+    for (size_t i = nBegin; i < nEnd; i++) {
+        uint64_t shortid = cmpctblock.GetShortID(vTxHashes[i].first);
+        if (!filter.MayContain(shortid))
+            continue;
+        std::unordered_map<uint64_t, uint16_t>::const_iterator idit = shorttxids.find(shortid);
+        if (idit == shorttxids.end())
+            continue;
+        vMatches.push_back(std::make_pair(i, idit->second));
+    }
+}
+
+/**
+ * Threads that help InitData match large mempools. They are started on
+ * first use and kept, so a compact block does not pay for starting threads.
+ */
+class ShortIDMatchPool
+{
+private:
+    std::mutex mutex;
+    std::condition_variable condWork;
+    std::condition_variable condDone;
+    std::deque<std::function<void()> > jobs;
+    std::vector<std::thread> vThreads;
+    bool fStop;
+
+    void Loop()
+    {
+        RenameThread("bitcoin-cmpctmatch");
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            while (!fStop && jobs.empty())
+                condWork.wait(lock);
+            if (jobs.empty())
+                return;
+            std::function<void()> job = std::move(jobs.front());
+            jobs.pop_front();
+            lock.unlock();
+            job();
+            lock.lock();
+        }
+    }
+
+public:
+    explicit ShortIDMatchPool(int nThreads) : fStop(false)
+    {
+        try {
+            for (int i = 0; i < nThreads; i++)
+                vThreads.emplace_back(&ShortIDMatchPool::Loop, this);
+        } catch (const std::system_error& e) {
+            // Run with the threads that did start; the caller works as well
+            LogPrint("cmpctblock", "%s: could not start matching thread: %s\n", __func__, e.what());
+        }
+    }
+
+    ~ShortIDMatchPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            fStop = true;
+        }
+        condWork.notify_all();
+        for (std::thread& t : vThreads)
+            t.join();
+    }
+
+    //! Run all jobs, on the pool and on the calling thread, and return once
+    //! they are done. The jobs must not throw.
+    void Run(const std::vector<std::function<void()> >& vJobs)
+    {
+        size_t nLeft = vJobs.size();
+        std::unique_lock<std::mutex> lock(mutex);
+        for (const std::function<void()>& job : vJobs) {
+            jobs.emplace_back([this, &job, &nLeft]() {
+                job();
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--nLeft == 0)
+                    condDone.notify_all();
+            });
+        }
+        condWork.notify_all();
+        while (nLeft > 0) {
+            if (jobs.empty()) {
+                condDone.wait(lock);
+                continue;
+            }
+            std::function<void()> job = std::move(jobs.front());
+            jobs.pop_front();
+            lock.unlock();
+            job();
+            lock.lock();
+        }
+    }
+};
+
+} // anon namespace
 
 ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const std::vector<std::pair<uint256, CTransactionRef>>& extra_txn) {
     if (cmpctblock.header.IsNull() || (cmpctblock.shorttxids.empty() && cmpctblock.prefilledtxn.empty()))
@@ -103,33 +250,72 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
     if (shorttxids.size() != cmpctblock.shorttxids.size())
         return READ_STATUS_FAILED; // Short ID collision
 
+    ShortIDFilter filter;
+    for (size_t i = 0; i < cmpctblock.shorttxids.size(); i++)
+        filter.Insert(cmpctblock.shorttxids[i]);
+
     std::vector<bool> have_txn(txn_available.size());
     {
     LOCK(pool->cs);
-    const std::vector<std::pair<uint256, CTxMemPool::txiter> >& vTxHashes = pool->vTxHashes;
-    for (size_t i = 0; i < vTxHashes.size(); i++) {
-        uint64_t shortid = cmpctblock.GetShortID(vTxHashes[i].first);
-        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
-        if (idit != shorttxids.end()) {
-            if (!have_txn[idit->second]) {
-                txn_available[idit->second] = vTxHashes[i].second->GetSharedTx();
-                have_txn[idit->second]  = true;
+    const TxHashes& vTxHashes = pool->vTxHashes;
+
+    // Hashing every mempool entry is the bulk of the work, so large
+    // mempools are split into ranges that are matched in parallel. The
+    // matches are then applied in mempool order, exactly as a single pass
+    // would.
+    // GetNumCores reads /proc, which takes longer than matching a small mempool
+    static const size_t nMaxThreads = std::max(1, std::min(GetNumCores(), MAX_SHORTID_MATCH_THREADS));
+    size_t nThreads = std::max(size_t(1), std::min(nMaxThreads, vTxHashes.size() / MIN_SHORTID_MATCH_BATCH));
+    std::vector<std::vector<std::pair<size_t, uint16_t> > > vMatches(nThreads);
+    if (nThreads > 1) {
+        static ShortIDMatchPool matchPool(nMaxThreads - 1);
+        // A range that failed on the pool is matched again here
+        std::vector<char> vFailed(nThreads, false);
+        std::vector<std::function<void()> > vJobs;
+        for (size_t n = 0; n < nThreads; n++) {
+            vJobs.emplace_back([&, n]() {
+                try {
+                    MatchShortIDs(cmpctblock, filter, shorttxids, vTxHashes,
+                                  vTxHashes.size() * n / nThreads, vTxHashes.size() * (n + 1) / nThreads, vMatches[n]);
+                } catch (const std::exception&) {
+                    vFailed[n] = true;
+                }
+            });
+        }
+        matchPool.Run(vJobs);
+        for (size_t n = 0; n < nThreads; n++) {
+            if (vFailed[n]) {
+                vMatches[n].clear();
+                MatchShortIDs(cmpctblock, filter, shorttxids, vTxHashes, vTxHashes.size() * n / nThreads, vTxHashes.size() * (n + 1) / nThreads, vMatches[n]);
+            }
+        }
+    } else {
+        MatchShortIDs(cmpctblock, filter, shorttxids, vTxHashes, 0, vTxHashes.size(), vMatches[0]);
+    }
+
+    for (size_t n = 0; n < nThreads && mempool_count != shorttxids.size(); n++) {
+        for (size_t m = 0; m < vMatches[n].size(); m++) {
+            const size_t i = vMatches[n][m].first;
+            const uint16_t pos = vMatches[n][m].second;
+            if (!have_txn[pos]) {
+                txn_available[pos] = vTxHashes[i].second->GetSharedTx();
+                have_txn[pos]  = true;
                 mempool_count++;
             } else {
                 // If we find two mempool txn that match the short id, just request it.
                 // This should be rare enough that the extra bandwidth doesn't matter,
                 // but eating a round-trip due to FillBlock failure would be annoying
-                if (txn_available[idit->second]) {
-                    txn_available[idit->second].reset();
+                if (txn_available[pos]) {
+                    txn_available[pos].reset();
                     mempool_count--;
                 }
             }
+            // Though ideally we'd continue scanning for the two-txn-match-shortid case,
+            // the performance win of an early exit here is too good to pass up and worth
+            // the extra risk.
+            if (mempool_count == shorttxids.size())
+                break;
         }
-        // Though ideally we'd continue scanning for the two-txn-match-shortid case,
-        // the performance win of an early exit here is too good to pass up and worth
-        // the extra risk.
-        if (mempool_count == shorttxids.size())
-            break;
     }
     }
 
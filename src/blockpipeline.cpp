@@ -0,0 +1,103 @@
+// Copyright (c) 2009-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockpipeline.h"
+
+#include "primitives/block.h"
+
+CBlockPipeline::CBlockPipeline(const AcceptFunction& acceptIn, const ConnectFunction& connectIn) :
+    accept(acceptIn), connect(connectIn), nChecking(0), fConnectPending(false), fConnecting(false)
+{
+}
+
+void CBlockPipeline::CheckThread()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        while (queue.empty())
+            condCheck.wait(lock);
+        Item item = std::move(queue.front());
+        queue.pop_front();
+        nChecking++;
+
+        bool fAccepted = false;
+        lock.unlock();
+        try {
+            bool fNewBlock = false;
+            fAccepted = accept(item.pblock, item.fForceProcessing, &fNewBlock);
+            if (item.done)
+                item.done(fAccepted && fNewBlock);
+        } catch (...) {
+            lock.lock();
+            nChecking--;
+            condIdle.notify_all();
+            throw;
+        }
+        lock.lock();
+
+        nChecking--;
+        if (fAccepted) {
+            pblockLast = item.pblock;
+            fConnectPending = true;
+            condConnect.notify_one();
+        }
+        if (IsIdle())
+            condIdle.notify_all();
+    }
+}
+
+void CBlockPipeline::ConnectThread()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        while (!fConnectPending)
+            condConnect.wait(lock);
+        std::shared_ptr<const CBlock> pblock;
+        pblock.swap(pblockLast);
+        fConnectPending = false;
+        fConnecting = true;
+
+        lock.unlock();
+        try {
+            connect(pblock);
+        } catch (...) {
+            lock.lock();
+            fConnecting = false;
+            condIdle.notify_all();
+            throw;
+        }
+        lock.lock();
+
+        fConnecting = false;
+        if (IsIdle())
+            condIdle.notify_all();
+    }
+}
+
+bool CBlockPipeline::Submit(const std::shared_ptr<const CBlock>& pblock, bool fForceProcessing, const DoneFunction& done)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (queue.size() >= MAX_PIPELINE_QUEUED_BLOCKS)
+        return false;
+    Item item;
+    item.pblock = pblock;
+    item.fForceProcessing = fForceProcessing;
+    item.done = done;
+    queue.push_back(std::move(item));
+    condCheck.notify_one();
+    return true;
+}
+
+void CBlockPipeline::WaitIdle()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (!IsIdle())
+        condIdle.wait(lock);
+}
+
+size_t CBlockPipeline::GetQueuedBlocks()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return queue.size();
+}
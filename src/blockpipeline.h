@@ -0,0 +1,103 @@
+// Copyright (c) 2009-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKPIPELINE_H
+#define BITCOIN_BLOCKPIPELINE_H
+
+#include <deque>
+#include <functional>
+#include <memory>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CBlock;
+
+/** Maximum number of received blocks waiting to be checked. */
+static const unsigned int MAX_PIPELINE_QUEUED_BLOCKS = 64;
+
+/**
+ * Moves blocks received during initial sync through validation in stages
+ * that run on their own threads, instead of checking, storing and
+ * connecting each one on the thread that received it.
+ *
+ * - Check: a pool of workers runs the context-free checks on queued blocks
+ *   and stores them, which also starts prefetching their inputs.
+ * - Connect: a single thread makes the best stored chain active. Blocks
+ *   stored while it is busy are connected by its next round, together.
+ *
+ * The queue of blocks to check is bounded; Submit() refuses blocks once it
+ * is full, and the caller is expected to process them itself, which slows
+ * down the peers feeding the pipeline.
+ */
+class CBlockPipeline
+{
+public:
+    //! Check and store a block, and set whether it was new. Returns whether it may extend the best chain.
+    typedef std::function<bool(const std::shared_ptr<const CBlock>&, bool, bool*)> AcceptFunction;
+    //! Connect the best stored chain. The block is the most recently stored one.
+    typedef std::function<void(const std::shared_ptr<const CBlock>&)> ConnectFunction;
+    //! Called on a check worker once a submitted block was stored or rejected, with whether it was new
+    typedef std::function<void(bool)> DoneFunction;
+
+private:
+    struct Item {
+        std::shared_ptr<const CBlock> pblock;
+        bool fForceProcessing;
+        DoneFunction done;
+    };
+
+    const AcceptFunction accept;
+    const ConnectFunction connect;
+
+    //! Mutex to protect the inner state
+    boost::mutex mutex;
+
+    //! Check workers block on this when out of work
+    boost::condition_variable condCheck;
+
+    //! The connect thread blocks on this until a block is stored
+    boost::condition_variable condConnect;
+
+    //! WaitIdle() blocks on this while any stage is busy
+    boost::condition_variable condIdle;
+
+    //! Blocks not yet picked up by a check worker
+    std::deque<Item> queue;
+
+    //! Number of blocks being checked
+    int nChecking;
+
+    //! Whether blocks were stored since the connect thread last started a round
+    bool fConnectPending;
+
+    //! Whether the connect thread is in a round
+    bool fConnecting;
+
+    //! Most recently stored block, handed to the next connect round
+    std::shared_ptr<const CBlock> pblockLast;
+
+    //! Whether all stages are out of work. Requires mutex to be held.
+    bool IsIdle() const { return queue.empty() && nChecking == 0 && !fConnectPending && !fConnecting; }
+
+public:
+    CBlockPipeline(const AcceptFunction& acceptIn, const ConnectFunction& connectIn);
+
+    //! Check worker thread
+    void CheckThread();
+
+    //! Connect thread
+    void ConnectThread();
+
+    //! Queue a block to be checked, stored and connected. Returns false if the queue is full.
+    bool Submit(const std::shared_ptr<const CBlock>& pblock, bool fForceProcessing, const DoneFunction& done = DoneFunction());
+
+    //! Wait until every queued block went through all stages
+    void WaitIdle();
+
+    //! Number of blocks waiting to be checked
+    size_t GetQueuedBlocks();
+};
+
+#endif // BITCOIN_BLOCKPIPELINE_H
@@ -5,6 +5,73 @@
 
 #include "chain.h"
 
+#include "memusage.h"
+#include "utilstrencodings.h"
+
+/**
+ * CBlockIndexVerify implementation
+ */
+size_t CBlockIndexVerify::AllocatedSize() const
+{
+    if (!data)
+        return 0;
+    if (data[0] == VERIFY_COMPACT)
+        return 1 + COMPACT_SIGNATURE_SIZE;
+    uint32_t nLen;
+    memcpy(&nLen, &data[1], 4);
+    return 5 + nLen;
+}
+
+CBlockIndexVerify& CBlockIndexVerify::operator=(const CBlockIndexVerify& other)
+{
+    if (this == &other)
+        return *this;
+    data.reset();
+    size_t nSize = other.AllocatedSize();
+    if (nSize) {
+        data.reset(new unsigned char[nSize]);
+        memcpy(data.get(), other.data.get(), nSize);
+    }
+    return *this;
+}
+
+void CBlockIndexVerify::SetBase64(const std::string& strVerify)
+{
+    data.reset();
+    if (strVerify.empty())
+        return;
+    bool fInvalid = false;
+    std::vector<unsigned char> vchSig = DecodeBase64(strVerify.c_str(), &fInvalid);
+    // Only take the binary form if it encodes back to the exact same text
+    if (!fInvalid && vchSig.size() == COMPACT_SIGNATURE_SIZE && EncodeBase64(vchSig.data(), vchSig.size()) == strVerify) {
+        data.reset(new unsigned char[1 + COMPACT_SIGNATURE_SIZE]);
+        data[0] = VERIFY_COMPACT;
+        memcpy(&data[1], vchSig.data(), COMPACT_SIGNATURE_SIZE);
+    } else {
+        uint32_t nLen = strVerify.size();
+        data.reset(new unsigned char[5 + nLen]);
+        data[0] = VERIFY_TEXT;
+        memcpy(&data[1], &nLen, 4);
+        memcpy(&data[5], strVerify.data(), nLen);
+    }
+}
+
+std::string CBlockIndexVerify::ToBase64() const
+{
+    if (!data)
+        return std::string();
+    if (data[0] == VERIFY_COMPACT)
+        return EncodeBase64(&data[1], COMPACT_SIGNATURE_SIZE);
+    uint32_t nLen;
+    memcpy(&nLen, &data[1], 4);
+    return std::string((const char*)&data[5], nLen);
+}
+
+size_t CBlockIndexVerify::DynamicMemoryUsage() const
+{
+    return data ? memusage::MallocUsage(AllocatedSize()) : 0;
+}
+
 /**
  * CChain implementation
  */
@@ -12,6 +12,7 @@
 #include "tinyformat.h"
 #include "uint256.h"
 
+#include <memory>
 #include <vector>
 
 class CBlockFileInfo
@@ -146,6 +147,49 @@ enum BlockStatus: uint32_t {
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 
     BLOCK_OPT_WITNESS       =   128, //!< block data in blk*.data was received with a witness-enforcing client
+    BLOCK_HAVE_POWHASH      =   256, //!< scrypt PoW hash of the header is cached in hashPoW (memory only, see CDiskBlockIndex)
+};
+
+/**
+ * Miner signature of a post-fork header (nVerify) as kept in the block index.
+ * The canonical nVerify, base64 of a 65-byte compact signature, is held as the
+ * raw signature; any other text is kept verbatim so the header and its hash
+ * can always be rebuilt. Pre-fork entries only pay for a null pointer.
+ */
+class CBlockIndexVerify
+{
+public:
+    static const unsigned int COMPACT_SIGNATURE_SIZE = 65;
+    //! Length of the base64 text of a compact signature, as in nVerify
+    static const unsigned int COMPACT_SIGNATURE_BASE64_SIZE = ((COMPACT_SIGNATURE_SIZE + 2) / 3) * 4;
+
+private:
+    //! Null if nVerify is empty. Otherwise byte 0 is the kind: VERIFY_COMPACT
+    //! followed by the signature, or VERIFY_TEXT followed by a 4-byte length
+    //! and the nVerify text.
+    std::unique_ptr<unsigned char[]> data;
+
+    enum { VERIFY_COMPACT = 0, VERIFY_TEXT = 1 };
+
+    size_t AllocatedSize() const;
+
+public:
+    CBlockIndexVerify() {}
+    CBlockIndexVerify(const CBlockIndexVerify& other) { *this = other; }
+    CBlockIndexVerify& operator=(const CBlockIndexVerify& other);
+    CBlockIndexVerify(CBlockIndexVerify&& other) = default;
+    CBlockIndexVerify& operator=(CBlockIndexVerify&& other) = default;
+
+    void SetNull() { data.reset(); }
+    bool IsNull() const { return !data; }
+    //! Whether the signature is stored in the compact binary form
+    bool IsCompact() const { return data && data[0] == VERIFY_COMPACT; }
+
+    void SetBase64(const std::string& strVerify);
+    //! The nVerify text, as found in the block header
+    std::string ToBase64() const;
+
+    size_t DynamicMemoryUsage() const;
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -198,7 +242,10 @@ public:
     unsigned int nTime;
     unsigned int nBits;
     unsigned int nNonce;
-    std::string nVerify;
+    CBlockIndexVerify verify;
+
+    //! Cached scrypt PoW hash of the block header, valid only if BLOCK_HAVE_POWHASH is set
+    uint256 hashPoW;
 
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     int32_t nSequenceId;
@@ -227,7 +274,8 @@ public:
         nTime          = 0;
         nBits          = 0;
         nNonce         = 0;
-        nVerify = "";
+        verify.SetNull();
+        hashPoW        = uint256();
     }
 
     CBlockIndex()
@@ -245,7 +293,7 @@ public:
         nBits          = block.nBits;
         nNonce         = block.nNonce;
         if (block.nTime > 1649496600)
-            nVerify = block.nVerify;
+            verify.SetBase64(block.nVerify);
     }
 
     CDiskBlockPos GetBlockPos() const {
@@ -277,7 +325,7 @@ public:
         block.nBits          = nBits;
         block.nNonce         = nNonce;
         if (nTime > 1649496600)
-            block.nVerify = nVerify;
+            block.nVerify = verify.ToBase64();
         return block;
     }
 
@@ -288,9 +336,18 @@ public:
 
     uint256 GetBlockPoWHash() const
     {
+        if (nStatus & BLOCK_HAVE_POWHASH)
+            return hashPoW;
         return GetBlockHeader().GetPoWHash();
     }
 
+    //! Remember the scrypt PoW hash of this header so it need not be recomputed.
+    void SetBlockPoWHash(const uint256& hash)
+    {
+        hashPoW = hash;
+        nStatus |= BLOCK_HAVE_POWHASH;
+    }
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
@@ -384,7 +441,12 @@ public:
             READWRITE(VARINT(nVersion));
 
         READWRITE(VARINT(nHeight));
-        READWRITE(VARINT(nStatus));
+        // The cached PoW hash is kept under its own key in the block tree
+        // database, so that the record stays readable by older versions.
+        unsigned int nStatusDisk = nStatus & ~BLOCK_HAVE_POWHASH;
+        READWRITE(VARINT(nStatusDisk));
+        if (ser_action.ForRead())
+            nStatus = nStatusDisk;
         READWRITE(VARINT(nTx));
         if (nStatus & (BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO))
             READWRITE(VARINT(nFile));
@@ -401,9 +463,15 @@ public:
         READWRITE(nTime);
         READWRITE(nBits);
         READWRITE(nNonce);
-        if (nTime > 1649496600)
-            READWRITE(nVerify);
-       
+        if (nTime > 1649496600) {
+            // Kept as base64 text on disk, as in the block header
+            std::string strVerify;
+            if (!ser_action.ForRead())
+                strVerify = verify.ToBase64();
+            READWRITE(strVerify);
+            if (ser_action.ForRead())
+                verify.SetBase64(strVerify);
+        }
     }
 
     uint256 GetBlockHash() const
@@ -416,7 +484,7 @@ public:
         block.nBits           = nBits;
         block.nNonce          = nNonce;
         if (nTime > 1649496600)
-            block.nVerify = nVerify;
+            block.nVerify = verify.ToBase64();
         return block.GetHash();
     }
 
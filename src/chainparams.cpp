@@ -5,6 +5,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "chainparams.h"
+#include "base58.h"
 #include "consensus/merkle.h"
 
 #include "tinyformat.h"
@@ -56,6 +57,21 @@ static CBlock CreateGenesisBlock(uint32_t nTime, uint32_t nNonce, uint32_t nBits
     return CreateGenesisBlock(pszTimestamp, genesisOutputScript, nTime, nNonce, nBits, nVersion, genesisReward);
 }
 
+/**
+ * Decode the key ID of a P2PKH address for the given version prefix, once at
+ * startup, instead of base58-decoding the address for every checked block.
+ */
+static uint160 DecodeMinerKeyID(const std::string& strAddress, const std::vector<unsigned char>& vchVersion)
+{
+    std::vector<unsigned char> vchData;
+    if (!DecodeBase58Check(strAddress, vchData) || vchData.size() != vchVersion.size() + 20 ||
+        !std::equal(vchVersion.begin(), vchVersion.end(), vchData.begin()))
+        return uint160();
+    uint160 keyID;
+    memcpy(keyID.begin(), &vchData[vchVersion.size()], 20);
+    return keyID;
+}
+
 /**
  * Main network
  */
@@ -165,6 +181,9 @@ public:
         base58Prefixes[EXT_PUBLIC_KEY] = boost::assign::list_of(0x04)(0x88)(0xB2)(0x1E).convert_to_container<std::vector<unsigned char> >();
         base58Prefixes[EXT_SECRET_KEY] = boost::assign::list_of(0x04)(0x88)(0xAD)(0xE4).convert_to_container<std::vector<unsigned char> >();
 
+        consensus.minerKeyID = DecodeMinerKeyID("SWScdsR85bFkKeyYEtamhMjKVg1aN6LLTy", base58Prefixes[PUBKEY_ADDRESS]);
+        assert(!consensus.minerKeyID.IsNull());
+
         vFixedSeeds = std::vector<SeedSpec6>(pnSeed6_main, pnSeed6_main + ARRAYLEN(pnSeed6_main));
 
         fMiningRequiresPeers = true;
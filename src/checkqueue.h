@@ -6,155 +6,359 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdint.h>
 #include <vector>
 
 #include <boost/foreach.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+//! Maximum number of threads that get a deque of their own in a CCheckQueue
+static const int MAX_CHECKQUEUE_DEQUES = 64;
 
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/**
+ * Run a batch of verifications taken off a CCheckQueue, stopping at the first
+ * failure. Check types that can verify a batch faster than one at a time
+ * provide an overload of this, which is found through their namespace.
+ */
+template <typename T>
+bool RunChecks(std::vector<T>& vChecks)
+{
+    BOOST_FOREACH (T& check, vChecks)
+        if (!check())
+            return false;
+    return true;
+}
+
+/**
+ * Work-stealing deque of pointers (Chase and Lev, "Dynamic Circular
+ * Work-Stealing Deque").
+ *
+ * Only the thread that owns the deque pushes and pops at the bottom; any
+ * thread may steal from the top. No operation takes a lock.
+ */
+template <typename P>
+class CWorkStealingDeque
+{
+private:
+    struct Buffer
+    {
+        const int64_t nMask;
+        std::unique_ptr<std::atomic<P*>[]> slots;
+
+        explicit Buffer(int64_t nSize) : nMask(nSize - 1), slots(new std::atomic<P*>[nSize]) {}
+        int64_t Size() const { return nMask + 1; }
+        P* Get(int64_t i) const { return slots[i & nMask].load(std::memory_order_relaxed); }
+        void Put(int64_t i, P* p) { slots[i & nMask].store(p, std::memory_order_relaxed); }
+    };
+
+    std::atomic<int64_t> top;
+    std::atomic<int64_t> bottom;
+    std::atomic<Buffer*> buffer;
+
+    //! Buffers that were replaced by bigger ones. Thieves may still be
+    //! reading them, so they are only freed with the deque.
+    std::vector<std::unique_ptr<Buffer> > vRetired;
+
+public:
+    CWorkStealingDeque() : top(0), bottom(0), buffer(new Buffer(64)) {}
+    ~CWorkStealingDeque() { delete buffer.load(); }
+
+    //! Add an element at the bottom. Owner only.
+    void Push(P* p)
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Buffer* buf = buffer.load(std::memory_order_relaxed);
+        if (b - t > buf->Size() - 1) {
+            Buffer* bufNew = new Buffer(buf->Size() * 2);
+            for (int64_t i = t; i < b; i++)
+                bufNew->Put(i, buf->Get(i));
+            vRetired.emplace_back(buf);
+            buffer.store(bufNew, std::memory_order_release);
+            buf = bufNew;
+        }
+        buf->Put(b, p);
+        bottom.store(b + 1);
+    }
+
+    //! Remove the element at the bottom, or return NULL if there is none. Owner only.
+    P* Pop()
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Buffer* buf = buffer.load(std::memory_order_relaxed);
+        bottom.store(b);
+        int64_t t = top.load();
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return NULL;
+        }
+        P* p = buf->Get(b);
+        if (t == b) {
+            // The last element; thieves may be after it as well
+            if (!top.compare_exchange_strong(t, t + 1))
+                p = NULL;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return p;
+    }
+
+    /**
+     * Remove the element at the top into p, or set p to NULL if there is
+     * none. Returns false if another thread took the element first, in
+     * which case trying again may succeed.
+     */
+    bool Steal(P*& p)
+    {
+        p = NULL;
+        int64_t t = top.load();
+        int64_t b = bottom.load();
+        if (t >= b)
+            return true;
+        Buffer* buf = buffer.load(std::memory_order_acquire);
+        P* q = buf->Get(t);
+        if (!top.compare_exchange_strong(t, t + 1))
+            return false;
+        p = q;
+        return true;
+    }
+};
+
+/**
  * Queue for verifications that have to be performed.
-  * The verifications are represented by a type T, which must provide an
-  * operator(), returning a bool.
-  *
-  * One thread (the master) is assumed to push batches of verifications
-  * onto the queue, where they are processed by N-1 worker threads. When
-  * the master is done adding work, it temporarily joins the worker pool
-  * as an N'th worker, until all jobs are done.
-  */
+ * The verifications are represented by a type T, which must provide an
+ * operator(), returning a bool.
+ *
+ * One thread (the master) is assumed to push batches of verifications
+ * onto the queue, where they are processed by N-1 worker threads. When
+ * the master is done adding work, it temporarily joins the worker pool
+ * as an N'th worker, until all jobs are done.
+ *
+ * Every thread has a deque of its own, and no lock is taken while there is
+ * work. The master pushes each added batch onto its deque; workers steal
+ * from the other deques when theirs is empty, take what they need of the
+ * stolen batch and push the rest onto their own deque, where others can
+ * steal it in turn. The mutex is only used to put threads out of work to
+ * sleep and to wake them up.
+ */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
-    boost::mutex mutex;
-
-    //! Worker threads block on this when out of work
-    boost::condition_variable condWorker;
+    /**
+     * The checks given to one call to Add. A thread that takes some of them
+     * off pushes the task back onto its own deque if any are left, so only
+     * one thread holds it at a time.
+     */
+    struct Task
+    {
+        std::vector<T> vChecks;
+        //! The first check not yet taken off
+        size_t nBegin;
+    };
 
-    //! Master thread blocks on this when out of work
-    boost::condition_variable condMaster;
+    typedef CWorkStealingDeque<Task> Deque;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! The master's deque (the first) and those of the workers
+    Deque vDeques[MAX_CHECKQUEUE_DEQUES + 1];
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! Number of deques handed out, including the master's
+    std::atomic<int> nDeques;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The number of worker threads, including those without a deque
+    std::atomic<int> nWorkers;
 
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! Number of checks on the deques. May be briefly off while a check is
+    //! moved from one thread to another.
+    std::atomic<int> nQueued;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
+
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
+
+    //! Number of workers that are going to sleep or sleeping
+    std::atomic<int> nSleeping;
+
+    //! Mutex for threads to sleep on
+    boost::mutex mutex;
+
+    //! Worker threads block on this when out of work
+    boost::condition_variable condWorker;
 
-    //! Whether we're shutting down.
-    bool fQuit;
+    //! Master thread blocks on this when out of work
+    boost::condition_variable condMaster;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    //! Wake up a sleeping worker, if there is one, to help with new work
+    void WakeWorker()
+    {
+        // Whoever adds work checks nSleeping after updating nQueued, and
+        // workers check nQueued after increasing nSleeping, so one of the
+        // two sees the other.
+        if (nSleeping.load() > 0) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            condWorker.notify_one();
+        }
+    }
+
+    //! Steal a task from any deque but the given one
+    Task* Steal(int nOwn)
+    {
+        int nCount = std::min(nDeques.load(std::memory_order_relaxed), MAX_CHECKQUEUE_DEQUES + 1);
+        bool fContended = true;
+        while (fContended) {
+            fContended = false;
+            for (int i = 1; i <= nCount; i++) {
+                // Start after the own deque, so that thieves spread out
+                int nVictim = (nOwn + i) % nCount;
+                if (nVictim == nOwn)
+                    continue;
+                Task* task;
+                if (!vDeques[nVictim].Steal(task))
+                    fContended = true;
+                else if (task)
+                    return task;
+            }
+        }
+        return NULL;
+    }
+
+    /**
+     * Take checks off the deques into vChecks, popping the own deque (if
+     * any) first and stealing if it is empty. Returns whether any were found.
+     */
+    bool Take(int nOwn, std::vector<T>& vChecks)
+    {
+        // Aim for increasingly smaller batches so all threads finish
+        // approximately simultaneously, but no larger than nBatchSize.
+        int nThreads = nWorkers.load(std::memory_order_relaxed) + 1;
+        size_t nTarget = std::max(1, std::min((int)nBatchSize, nQueued.load(std::memory_order_relaxed) / (nThreads + 1)));
+        Deque* pdeque = nOwn <= MAX_CHECKQUEUE_DEQUES ? &vDeques[nOwn] : NULL;
+        while (vChecks.size() < nTarget) {
+            Task* task = pdeque ? pdeque->Pop() : NULL;
+            if (task == NULL && vChecks.empty())
+                task = Steal(nOwn);
+            if (task == NULL)
+                break;
+            // Without a deque to put the rest on, the whole task is ours
+            size_t nTake = task->vChecks.size() - task->nBegin;
+            if (pdeque)
+                nTake = std::min(nTake, nTarget - vChecks.size());
+            size_t nOld = vChecks.size();
+            vChecks.resize(nOld + nTake);
+            for (size_t i = 0; i < nTake; i++)
+                vChecks[nOld + i].swap(task->vChecks[task->nBegin + i]);
+            nQueued -= nTake;
+            task->nBegin += nTake;
+            if (task->nBegin < task->vChecks.size()) {
+                // Let another worker steal the rest
+                pdeque->Push(task);
+                WakeWorker();
+            } else {
+                delete task;
+            }
+        }
+        return !vChecks.empty();
+    }
+
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    bool Loop(int nOwn, bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
+        while (true) {
+            if (!Take(nOwn, vChecks)) {
                 boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
+                if (fMaster) {
+                    while (nQueued.load() <= 0 && nTodo.load() != 0)
+                        condMaster.wait(lock);
+                    if (nTodo.load() == 0) {
                         // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
+                        return fAllOk.exchange(true);
                     }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+                } else if (nQueued.load() <= 0) {
+                    nSleeping++;
+                    try {
+                        while (nQueued.load() <= 0)
+                            condWorker.wait(lock);
+                    } catch (...) {
+                        nSleeping--;
+                        throw;
+                    }
+                    nSleeping--;
+                    continue;
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                // The work may be on its way from one thread to another;
+                // nobody is notified when it lands, so check back shortly
+                (fMaster ? condMaster : condWorker).timed_wait(lock, boost::posix_time::microseconds(100));
+                continue;
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
+            // Check whether we need to do work at all
+            if (fAllOk.load(std::memory_order_relaxed) && !RunChecks(vChecks))
+                fAllOk.store(false);
+            unsigned int nDone = vChecks.size();
             vChecks.clear();
-        } while (true);
+            if (nTodo.fetch_sub(nDone) == nDone && !fMaster) {
+                // We processed the last element; inform the master it can exit and return the result
+                boost::unique_lock<boost::mutex> lock(mutex);
+                condMaster.notify_one();
+            }
+        }
     }
 
 public:
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) : nDeques(1), nWorkers(0), nQueued(0), nTodo(0), fAllOk(true), nSleeping(0), nBatchSize(nBatchSizeIn) {}
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        // Threads beyond the last deque only steal, and keep all they take
+        int nOwn = nDeques.fetch_add(1);
+        nWorkers++;
+        try {
+            Loop(nOwn);
+        } catch (...) {
+            nWorkers--;
+            throw;
+        }
+        nWorkers--;
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        return Loop(0, true);
     }
 
-    //! Add a batch of checks to the queue
+    //! Add a batch of checks to the queue. This takes the checks out of vChecks.
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
-        nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+        if (vChecks.empty())
+            return;
+        Task* task = new Task;
+        task->vChecks.swap(vChecks);
+        task->nBegin = 0;
+        size_t nChecks = task->vChecks.size();
+        nTodo += nChecks;
+        vDeques[0].Push(task);
+        nQueued += nChecks;
+        WakeWorker();
     }
 
     ~CCheckQueue()
@@ -163,8 +367,7 @@ public:
 
     bool IsIdle()
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return nTodo.load() == 0 && nQueued.load() == 0 && fAllOk.load();
     }
 
 };
@@ -0,0 +1,156 @@
+// Copyright (c) 2009-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinsprefetch.h"
+
+#include "primitives/block.h"
+#include "reverselock.h"
+
+#include <algorithm>
+#include <set>
+
+#include <boost/foreach.hpp>
+#include <boost/thread/thread.hpp>
+
+void CCoinsPrefetcher::Process(boost::unique_lock<boost::mutex>& lock, Job& job)
+{
+    const uint64_t nJobGeneration = nGeneration;
+    std::vector<std::pair<COutPoint, Coin> > vCoins;
+    {
+        reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
+        vCoins.reserve(job.vOutPoints.size());
+        try {
+            BOOST_FOREACH(const COutPoint& outpoint, job.vOutPoints) {
+                Coin coin;
+                if (base->GetCoin(outpoint, coin))
+                    vCoins.push_back(std::make_pair(outpoint, std::move(coin)));
+            }
+        } catch (const std::exception&) {
+            // Read errors are left to the lookup made when the block is
+            // connected, which knows how to report them.
+        }
+    }
+
+    std::map<uint256, Batch>::iterator it = mapBatches.find(job.hashBlock);
+    assert(it != mapBatches.end());
+    Batch& batch = it->second;
+    if (nJobGeneration == nGeneration) {
+        std::move(vCoins.begin(), vCoins.end(), std::back_inserter(batch.vCoins));
+    }
+    if (--batch.nPending == 0)
+        condDone.notify_all();
+}
+
+void CCoinsPrefetcher::Enqueue(const CBlock& block, int nHeight, const CCoinsViewCache& cache)
+{
+    const uint256 hashBlock = block.GetHash();
+    Batch& batch = mapBatches[hashBlock];
+    batch.nHeight = nHeight;
+
+    // Outputs created within the block cannot be in the database yet
+    std::set<uint256> setTxids;
+    BOOST_FOREACH(const CTransactionRef& tx, block.vtx)
+        setTxids.insert(tx->GetHash());
+
+    Job job;
+    job.hashBlock = hashBlock;
+    BOOST_FOREACH(const CTransactionRef& tx, block.vtx) {
+        if (tx->IsCoinBase())
+            continue;
+        BOOST_FOREACH(const CTxIn& txin, tx->vin) {
+            if (setTxids.count(txin.prevout.hash) || cache.HaveCoinInCache(txin.prevout))
+                continue;
+            job.vOutPoints.push_back(txin.prevout);
+            if (job.vOutPoints.size() == PREFETCH_BATCH_SIZE) {
+                queue.push_back(job);
+                batch.nPending++;
+                job.vOutPoints.clear();
+            }
+        }
+    }
+    if (!job.vOutPoints.empty()) {
+        queue.push_back(job);
+        batch.nPending++;
+    }
+    condWorker.notify_all();
+}
+
+void CCoinsPrefetcher::Thread()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        while (queue.empty())
+            condWorker.wait(lock);
+        Job job = std::move(queue.front());
+        queue.pop_front();
+        Process(lock, job);
+    }
+}
+
+void CCoinsPrefetcher::Prefetch(const CBlock& block, int nHeight, const CCoinsViewCache& cache)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (mapBatches.size() >= MAX_PREFETCH_BLOCKS || mapBatches.count(block.GetHash()))
+        return;
+    Enqueue(block, nHeight, cache);
+}
+
+void CCoinsPrefetcher::Apply(const CBlock& block, int nHeight, CCoinsViewCache& cache)
+{
+    // Shutting down while waiting for the workers must not throw out of block connection
+    boost::this_thread::disable_interruption di;
+
+    const uint256 hashBlock = block.GetHash();
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (!mapBatches.count(hashBlock))
+        Enqueue(block, nHeight, cache);
+
+    // Move this block's remaining jobs to the front of the queue, and work
+    // on them alongside the workers instead of just waiting.
+    std::stable_partition(queue.begin(), queue.end(), [&hashBlock](const Job& job) { return job.hashBlock == hashBlock; });
+    while (!queue.empty() && queue.front().hashBlock == hashBlock) {
+        Job job = std::move(queue.front());
+        queue.pop_front();
+        Process(lock, job);
+    }
+
+    std::map<uint256, Batch>::iterator it = mapBatches.find(hashBlock);
+    while (it->second.nPending > 0)
+        condDone.wait(lock);
+    for (std::vector<std::pair<COutPoint, Coin> >::iterator itCoin = it->second.vCoins.begin(); itCoin != it->second.vCoins.end(); ++itCoin)
+        cache.CacheCoin(itCoin->first, std::move(itCoin->second));
+    mapBatches.erase(it);
+
+    // Drop the work for blocks that are not going to be connected next.
+    // Batches with lookups in flight are kept until those complete.
+    for (std::deque<Job>::iterator itJob = queue.begin(); itJob != queue.end(); ) {
+        Batch& batch = mapBatches[itJob->hashBlock];
+        if (batch.nHeight <= nHeight) {
+            batch.nPending--;
+            itJob = queue.erase(itJob);
+        } else {
+            ++itJob;
+        }
+    }
+    for (it = mapBatches.begin(); it != mapBatches.end(); ) {
+        if (it->second.nHeight <= nHeight && it->second.nPending == 0)
+            mapBatches.erase(it++);
+        else
+            ++it;
+    }
+}
+
+void CCoinsPrefetcher::Invalidate()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    nGeneration++;
+    for (std::map<uint256, Batch>::iterator it = mapBatches.begin(); it != mapBatches.end(); ++it)
+        it->second.vCoins.clear();
+}
+
+size_t CCoinsPrefetcher::GetPendingBlocks()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return mapBatches.size();
+}
@@ -0,0 +1,115 @@
+// Copyright (c) 2009-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSPREFETCH_H
+#define BITCOIN_COINSPREFETCH_H
+
+#include "coins.h"
+#include "uint256.h"
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CBlock;
+
+/** Maximum number of blocks whose inputs are prefetched ahead of being connected. */
+static const unsigned int MAX_PREFETCH_BLOCKS = 64;
+/** Number of outpoints looked up by a worker in one go. */
+static const unsigned int PREFETCH_BATCH_SIZE = 32;
+
+/**
+ * Warms a coins cache with the inputs of blocks that are about to be
+ * connected.
+ *
+ * As soon as a block is accepted, the prevouts it spends that are not in the
+ * cache yet are looked up in the coins database by a pool of worker threads,
+ * so that by the time the block is connected its inputs are already in
+ * memory instead of being read from disk one at a time.
+ *
+ * Lookups go straight to the database view, bypassing the cache, so they are
+ * only valid as long as the database is not written to. Invalidate() must be
+ * called before every write to it; lookups that are in flight or not yet
+ * applied at that point are discarded.
+ */
+class CCoinsPrefetcher
+{
+private:
+    struct Job {
+        uint256 hashBlock;
+        std::vector<COutPoint> vOutPoints;
+    };
+
+    struct Batch {
+        //! Height of the block, used to expire batches of stale blocks
+        int nHeight;
+        //! Number of jobs for this block that are queued or being looked up
+        int nPending;
+        //! Coins found so far
+        std::vector<std::pair<COutPoint, Coin> > vCoins;
+
+        Batch() : nHeight(0), nPending(0) {}
+    };
+
+    //! View the lookups are done in. Must be safe to read from multiple threads.
+    CCoinsView* base;
+
+    //! Mutex to protect the inner state
+    boost::mutex mutex;
+
+    //! Worker threads block on this when out of work
+    boost::condition_variable condWorker;
+
+    //! Apply() blocks on this while lookups for its block are in flight
+    boost::condition_variable condDone;
+
+    //! Jobs not yet picked up by a worker
+    std::deque<Job> queue;
+
+    //! Blocks with outstanding or completed lookups
+    std::map<uint256, Batch> mapBatches;
+
+    //! Incremented whenever the database is about to change
+    uint64_t nGeneration;
+
+    //! Look up a job's outpoints in base and, if still valid, store the results. Requires mutex to be held.
+    void Process(boost::unique_lock<boost::mutex>& lock, Job& job);
+
+    //! Queue lookups for the inputs of block missing from cache. Requires mutex to be held.
+    void Enqueue(const CBlock& block, int nHeight, const CCoinsViewCache& cache);
+
+public:
+    explicit CCoinsPrefetcher(CCoinsView* baseIn) : base(baseIn), nGeneration(0) {}
+
+    //! Worker thread
+    void Thread();
+
+    //! Start looking up the inputs of a block at height nHeight that are not in cache.
+    void Prefetch(const CBlock& block, int nHeight, const CCoinsViewCache& cache);
+
+    /**
+     * Move the prefetched inputs of a block into cache, without marking
+     * them as modified. Inputs that have not been looked up yet are looked
+     * up concurrently before returning, also for blocks that were never
+     * passed to Prefetch(). Batches of other blocks at the same or a lower
+     * height are dropped, as those blocks are not going to be connected
+     * next.
+     */
+    void Apply(const CBlock& block, int nHeight, CCoinsViewCache& cache);
+
+    /**
+     * Discard all lookups made so far, including those in flight. Call both
+     * before and after writing to the database, as a lookup racing with the
+     * write may see either state.
+     */
+    void Invalidate();
+
+    //! Number of blocks with outstanding or completed lookups
+    size_t GetPendingBlocks();
+};
+
+#endif // BITCOIN_COINSPREFETCH_H
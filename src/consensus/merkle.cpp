@@ -4,8 +4,20 @@
 
 #include "merkle.h"
 #include "hash.h"
+#include "crypto/sha256.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
+#if !defined(BUILD_BITCOIN_INTERNAL)
+#include <system_error>
+#include <thread>
+#endif
+
+/** Most threads to hash a level of a merkle tree with */
+static const unsigned int MAX_MERKLE_THREADS = 8;
+/** Fewest pairs of hashes worth handing to another thread */
+static const size_t MIN_MERKLE_PAIRS_PER_THREAD = 1024;
+
 /*     WARNING! If you're reading this because you're learning about crypto
        and/or designing a new system that will use merkle trees, keep in mind
        that the following merkle tree algorithm has a serious flaw related to
@@ -42,7 +54,7 @@
        root.
 */
 
-/* This implements a constant-space merkle root/path calculator, limited to 2^32 leaves. */
+/* This implements a constant-space merkle path calculator, limited to 2^32 leaves. */
 static void MerkleComputation(const std::vector<uint256>& leaves, uint256* proot, bool* pmutated, uint32_t branchpos, std::vector<uint256>* pbranch) {
     if (pbranch) pbranch->clear();
     if (leaves.size() == 0) {
@@ -130,10 +142,68 @@ static void MerkleComputation(const std::vector<uint256>& leaves, uint256* proot
     if (proot) *proot = h;
 }
 
-uint256 ComputeMerkleRoot(const std::vector<uint256>& leaves, bool* mutated) {
-    uint256 hash;
-    MerkleComputation(leaves, &hash, mutated, -1, NULL);
-    return hash;
+/**
+ * Hash the pairs of a level, which must have an even number of entries, into
+ * the next one. Each hash of a pair is a double-SHA256 of a 64-byte input, so
+ * a whole level goes through SHA256D64() at once, which hashes several pairs
+ * in parallel where the CPU allows. Levels of at least
+ * MIN_MERKLE_PAIRS_PER_THREAD pairs per thread are also split over threads,
+ * and a range whose thread cannot be started is hashed on the calling thread.
+ */
+static void MerkleHashLevel(std::vector<uint256>& hashes)
+{
+    size_t nPairs = hashes.size() / 2;
+#if !defined(BUILD_BITCOIN_INTERNAL)
+    static const size_t nMaxThreads = std::max(1u, std::min(std::thread::hardware_concurrency(), MAX_MERKLE_THREADS));
+    size_t nThreads = std::min(nMaxThreads, nPairs / MIN_MERKLE_PAIRS_PER_THREAD);
+    if (nThreads > 1) {
+        // The threads cannot hash in place, as each would overwrite the
+        // inputs of the one before it.
+        std::vector<uint256> next(nPairs);
+        std::vector<std::thread> vThreads;
+        // Reserved up front, so that only starting a thread can throw below
+        vThreads.reserve(nThreads - 1);
+        try {
+            for (size_t n = 1; n < nThreads; n++) {
+                size_t nBegin = nPairs * n / nThreads, nEnd = nPairs * (n + 1) / nThreads;
+                vThreads.emplace_back(SHA256D64, next[nBegin].begin(), hashes[2 * nBegin].begin(), nEnd - nBegin);
+            }
+        } catch (const std::system_error&) {
+            // Out of threads; the ranges that did not get one are hashed here.
+        }
+        SHA256D64(next[0].begin(), hashes[0].begin(), nPairs / nThreads);
+        for (size_t n = vThreads.size() + 1; n < nThreads; n++) {
+            size_t nBegin = nPairs * n / nThreads, nEnd = nPairs * (n + 1) / nThreads;
+            SHA256D64(next[nBegin].begin(), hashes[2 * nBegin].begin(), nEnd - nBegin);
+        }
+        for (size_t n = 0; n < vThreads.size(); n++)
+            vThreads[n].join();
+        hashes.swap(next);
+        return;
+    }
+#endif
+    // The hash of pair i only overwrites inputs that were already read.
+    SHA256D64(hashes[0].begin(), hashes[0].begin(), nPairs);
+    hashes.resize(nPairs);
+}
+
+uint256 ComputeMerkleRoot(std::vector<uint256> hashes, bool* mutated) {
+    bool mutation = false;
+    while (hashes.size() > 1) {
+        if (mutated) {
+            // Two identical hashes side by side (see the warning above)
+            for (size_t pos = 0; pos + 1 < hashes.size(); pos += 2) {
+                if (hashes[pos] == hashes[pos + 1]) mutation = true;
+            }
+        }
+        if (hashes.size() & 1) {
+            hashes.push_back(hashes.back());
+        }
+        MerkleHashLevel(hashes);
+    }
+    if (mutated) *mutated = mutation;
+    if (hashes.size() == 0) return uint256();
+    return hashes[0];
 }
 
 std::vector<uint256> ComputeMerkleBranch(const std::vector<uint256>& leaves, uint32_t position) {
@@ -162,7 +232,7 @@ uint256 BlockMerkleRoot(const CBlock& block, bool* mutated)
     for (size_t s = 0; s < block.vtx.size(); s++) {
         leaves[s] = block.vtx[s]->GetHash();
     }
-    return ComputeMerkleRoot(leaves, mutated);
+    return ComputeMerkleRoot(std::move(leaves), mutated);
 }
 
 uint256 BlockWitnessMerkleRoot(const CBlock& block, bool* mutated)
@@ -173,7 +243,7 @@ uint256 BlockWitnessMerkleRoot(const CBlock& block, bool* mutated)
     for (size_t s = 1; s < block.vtx.size(); s++) {
         leaves[s] = block.vtx[s]->GetWitnessHash();
     }
-    return ComputeMerkleRoot(leaves, mutated);
+    return ComputeMerkleRoot(std::move(leaves), mutated);
 }
 
 std::vector<uint256> BlockMerkleBranch(const CBlock& block, uint32_t position)
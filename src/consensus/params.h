@@ -63,6 +63,8 @@ struct Params {
     int64_t DifficultyAdjustmentInterval() const { return nPowTargetTimespan / nPowTargetSpacing; }
     uint256 nMinimumChainWork;
     uint256 defaultAssumeValid;
+    /** Key ID of the miner key that must sign post-fork headers (nVerify); null if the network has none */
+    uint160 minerKeyID;
 };
 } // namespace Consensus
 
@@ -0,0 +1,144 @@
+/*
+ * Copyright 2009 Colin Percival, 2011 ArtForz, 2012-2013 pooler
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file was originally written by Colin Percival as part of the Tarsnap
+ * online backup system.
+ */
+
+#include "crypto/scrypt.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <immintrin.h>
+
+/*
+ * 8-way kernel, the AVX2 counterpart of scrypt_1024_1_1_256_sp_avx2_8way():
+ * word k of lane l is held in element l of vector k. Built with -mavx2 and
+ * only called after scrypt_detect_multi() has checked for CPU support.
+ */
+#define ROTL_8WAY(a, b) _mm256_or_si256(_mm256_slli_epi32((a), (b)), _mm256_srli_epi32((a), 32 - (b)))
+
+static inline void xor_salsa8_avx2_8way(__m256i B[16], const __m256i Bx[16])
+{
+	__m256i x[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		x[i] = B[i] = _mm256_xor_si256(B[i], Bx[i]);
+
+	for (i = 0; i < 8; i += 2) {
+		/* Operate on columns. */
+		x[ 4] = _mm256_xor_si256(x[ 4], ROTL_8WAY(_mm256_add_epi32(x[ 0], x[12]),  7));
+		x[ 9] = _mm256_xor_si256(x[ 9], ROTL_8WAY(_mm256_add_epi32(x[ 5], x[ 1]),  7));
+		x[14] = _mm256_xor_si256(x[14], ROTL_8WAY(_mm256_add_epi32(x[10], x[ 6]),  7));
+		x[ 3] = _mm256_xor_si256(x[ 3], ROTL_8WAY(_mm256_add_epi32(x[15], x[11]),  7));
+
+		x[ 8] = _mm256_xor_si256(x[ 8], ROTL_8WAY(_mm256_add_epi32(x[ 4], x[ 0]),  9));
+		x[13] = _mm256_xor_si256(x[13], ROTL_8WAY(_mm256_add_epi32(x[ 9], x[ 5]),  9));
+		x[ 2] = _mm256_xor_si256(x[ 2], ROTL_8WAY(_mm256_add_epi32(x[14], x[10]),  9));
+		x[ 7] = _mm256_xor_si256(x[ 7], ROTL_8WAY(_mm256_add_epi32(x[ 3], x[15]),  9));
+
+		x[12] = _mm256_xor_si256(x[12], ROTL_8WAY(_mm256_add_epi32(x[ 8], x[ 4]), 13));
+		x[ 1] = _mm256_xor_si256(x[ 1], ROTL_8WAY(_mm256_add_epi32(x[13], x[ 9]), 13));
+		x[ 6] = _mm256_xor_si256(x[ 6], ROTL_8WAY(_mm256_add_epi32(x[ 2], x[14]), 13));
+		x[11] = _mm256_xor_si256(x[11], ROTL_8WAY(_mm256_add_epi32(x[ 7], x[ 3]), 13));
+
+		x[ 0] = _mm256_xor_si256(x[ 0], ROTL_8WAY(_mm256_add_epi32(x[12], x[ 8]), 18));
+		x[ 5] = _mm256_xor_si256(x[ 5], ROTL_8WAY(_mm256_add_epi32(x[ 1], x[13]), 18));
+		x[10] = _mm256_xor_si256(x[10], ROTL_8WAY(_mm256_add_epi32(x[ 6], x[ 2]), 18));
+		x[15] = _mm256_xor_si256(x[15], ROTL_8WAY(_mm256_add_epi32(x[11], x[ 7]), 18));
+
+		/* Operate on rows. */
+		x[ 1] = _mm256_xor_si256(x[ 1], ROTL_8WAY(_mm256_add_epi32(x[ 0], x[ 3]),  7));
+		x[ 6] = _mm256_xor_si256(x[ 6], ROTL_8WAY(_mm256_add_epi32(x[ 5], x[ 4]),  7));
+		x[11] = _mm256_xor_si256(x[11], ROTL_8WAY(_mm256_add_epi32(x[10], x[ 9]),  7));
+		x[12] = _mm256_xor_si256(x[12], ROTL_8WAY(_mm256_add_epi32(x[15], x[14]),  7));
+
+		x[ 2] = _mm256_xor_si256(x[ 2], ROTL_8WAY(_mm256_add_epi32(x[ 1], x[ 0]),  9));
+		x[ 7] = _mm256_xor_si256(x[ 7], ROTL_8WAY(_mm256_add_epi32(x[ 6], x[ 5]),  9));
+		x[ 8] = _mm256_xor_si256(x[ 8], ROTL_8WAY(_mm256_add_epi32(x[11], x[10]),  9));
+		x[13] = _mm256_xor_si256(x[13], ROTL_8WAY(_mm256_add_epi32(x[12], x[15]),  9));
+
+		x[ 3] = _mm256_xor_si256(x[ 3], ROTL_8WAY(_mm256_add_epi32(x[ 2], x[ 1]), 13));
+		x[ 4] = _mm256_xor_si256(x[ 4], ROTL_8WAY(_mm256_add_epi32(x[ 7], x[ 6]), 13));
+		x[ 9] = _mm256_xor_si256(x[ 9], ROTL_8WAY(_mm256_add_epi32(x[ 8], x[11]), 13));
+		x[14] = _mm256_xor_si256(x[14], ROTL_8WAY(_mm256_add_epi32(x[13], x[12]), 13));
+
+		x[ 0] = _mm256_xor_si256(x[ 0], ROTL_8WAY(_mm256_add_epi32(x[ 3], x[ 2]), 18));
+		x[ 5] = _mm256_xor_si256(x[ 5], ROTL_8WAY(_mm256_add_epi32(x[ 4], x[ 7]), 18));
+		x[10] = _mm256_xor_si256(x[10], ROTL_8WAY(_mm256_add_epi32(x[ 9], x[ 8]), 18));
+		x[15] = _mm256_xor_si256(x[15], ROTL_8WAY(_mm256_add_epi32(x[14], x[13]), 18));
+	}
+
+	for (i = 0; i < 16; i++)
+		B[i] = _mm256_add_epi32(B[i], x[i]);
+}
+
+void scrypt_1024_1_1_256_sp_avx2_8way(const char *input, char *output, char *scratchpad)
+{
+	uint8_t B[8][128];
+	union {
+		__m256i i256[32];
+		uint32_t u32[32 * 8];
+	} X;
+	__m256i *V;
+	uint32_t *V32;
+	uint32_t i, j, k, l;
+
+	V = (__m256i *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+	V32 = (uint32_t *)V;
+
+	for (l = 0; l < 8; l++)
+		PBKDF2_SHA256((const uint8_t *)&input[80 * l], 80, (const uint8_t *)&input[80 * l], 80, 1, B[l], 128);
+
+	for (k = 0; k < 32; k++)
+		for (l = 0; l < 8; l++)
+			X.u32[k * 8 + l] = le32dec(&B[l][4 * k]);
+
+	for (i = 0; i < 1024; i++) {
+		for (k = 0; k < 32; k++)
+			V[i * 32 + k] = X.i256[k];
+		xor_salsa8_avx2_8way(&X.i256[0], &X.i256[16]);
+		xor_salsa8_avx2_8way(&X.i256[16], &X.i256[0]);
+	}
+	for (i = 0; i < 1024; i++) {
+		/* Each lane reads its own row of V. */
+		for (l = 0; l < 8; l++) {
+			j = 32 * 8 * (X.u32[16 * 8 + l] & 1023);
+			for (k = 0; k < 32; k++)
+				X.u32[k * 8 + l] ^= V32[j + k * 8 + l];
+		}
+		xor_salsa8_avx2_8way(&X.i256[0], &X.i256[16]);
+		xor_salsa8_avx2_8way(&X.i256[16], &X.i256[0]);
+	}
+
+	for (k = 0; k < 32; k++)
+		for (l = 0; l < 8; l++)
+			le32enc(&B[l][4 * k], X.u32[k * 8 + l]);
+
+	for (l = 0; l < 8; l++)
+		PBKDF2_SHA256((const uint8_t *)&input[80 * l], 80, B[l], 128, 1, (uint8_t *)&output[32 * l], 32);
+}
@@ -134,3 +134,111 @@ void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchp
 
 	PBKDF2_SHA256((const uint8_t *)input, 80, B, 128, 1, (uint8_t *)output, 32);
 }
+
+/*
+ * 4-way kernel: four independent inputs are hashed side by side, with word k
+ * of lane l held in element l of vector k, so Salsa20/8 needs no shuffles.
+ */
+#define ROTL_4WAY(a, b) _mm_or_si128(_mm_slli_epi32((a), (b)), _mm_srli_epi32((a), 32 - (b)))
+
+static inline void xor_salsa8_sse2_4way(__m128i B[16], const __m128i Bx[16])
+{
+	__m128i x[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		x[i] = B[i] = _mm_xor_si128(B[i], Bx[i]);
+
+	for (i = 0; i < 8; i += 2) {
+		/* Operate on columns. */
+		x[ 4] = _mm_xor_si128(x[ 4], ROTL_4WAY(_mm_add_epi32(x[ 0], x[12]),  7));
+		x[ 9] = _mm_xor_si128(x[ 9], ROTL_4WAY(_mm_add_epi32(x[ 5], x[ 1]),  7));
+		x[14] = _mm_xor_si128(x[14], ROTL_4WAY(_mm_add_epi32(x[10], x[ 6]),  7));
+		x[ 3] = _mm_xor_si128(x[ 3], ROTL_4WAY(_mm_add_epi32(x[15], x[11]),  7));
+
+		x[ 8] = _mm_xor_si128(x[ 8], ROTL_4WAY(_mm_add_epi32(x[ 4], x[ 0]),  9));
+		x[13] = _mm_xor_si128(x[13], ROTL_4WAY(_mm_add_epi32(x[ 9], x[ 5]),  9));
+		x[ 2] = _mm_xor_si128(x[ 2], ROTL_4WAY(_mm_add_epi32(x[14], x[10]),  9));
+		x[ 7] = _mm_xor_si128(x[ 7], ROTL_4WAY(_mm_add_epi32(x[ 3], x[15]),  9));
+
+		x[12] = _mm_xor_si128(x[12], ROTL_4WAY(_mm_add_epi32(x[ 8], x[ 4]), 13));
+		x[ 1] = _mm_xor_si128(x[ 1], ROTL_4WAY(_mm_add_epi32(x[13], x[ 9]), 13));
+		x[ 6] = _mm_xor_si128(x[ 6], ROTL_4WAY(_mm_add_epi32(x[ 2], x[14]), 13));
+		x[11] = _mm_xor_si128(x[11], ROTL_4WAY(_mm_add_epi32(x[ 7], x[ 3]), 13));
+
+		x[ 0] = _mm_xor_si128(x[ 0], ROTL_4WAY(_mm_add_epi32(x[12], x[ 8]), 18));
+		x[ 5] = _mm_xor_si128(x[ 5], ROTL_4WAY(_mm_add_epi32(x[ 1], x[13]), 18));
+		x[10] = _mm_xor_si128(x[10], ROTL_4WAY(_mm_add_epi32(x[ 6], x[ 2]), 18));
+		x[15] = _mm_xor_si128(x[15], ROTL_4WAY(_mm_add_epi32(x[11], x[ 7]), 18));
+
+		/* Operate on rows. */
+		x[ 1] = _mm_xor_si128(x[ 1], ROTL_4WAY(_mm_add_epi32(x[ 0], x[ 3]),  7));
+		x[ 6] = _mm_xor_si128(x[ 6], ROTL_4WAY(_mm_add_epi32(x[ 5], x[ 4]),  7));
+		x[11] = _mm_xor_si128(x[11], ROTL_4WAY(_mm_add_epi32(x[10], x[ 9]),  7));
+		x[12] = _mm_xor_si128(x[12], ROTL_4WAY(_mm_add_epi32(x[15], x[14]),  7));
+
+		x[ 2] = _mm_xor_si128(x[ 2], ROTL_4WAY(_mm_add_epi32(x[ 1], x[ 0]),  9));
+		x[ 7] = _mm_xor_si128(x[ 7], ROTL_4WAY(_mm_add_epi32(x[ 6], x[ 5]),  9));
+		x[ 8] = _mm_xor_si128(x[ 8], ROTL_4WAY(_mm_add_epi32(x[11], x[10]),  9));
+		x[13] = _mm_xor_si128(x[13], ROTL_4WAY(_mm_add_epi32(x[12], x[15]),  9));
+
+		x[ 3] = _mm_xor_si128(x[ 3], ROTL_4WAY(_mm_add_epi32(x[ 2], x[ 1]), 13));
+		x[ 4] = _mm_xor_si128(x[ 4], ROTL_4WAY(_mm_add_epi32(x[ 7], x[ 6]), 13));
+		x[ 9] = _mm_xor_si128(x[ 9], ROTL_4WAY(_mm_add_epi32(x[ 8], x[11]), 13));
+		x[14] = _mm_xor_si128(x[14], ROTL_4WAY(_mm_add_epi32(x[13], x[12]), 13));
+
+		x[ 0] = _mm_xor_si128(x[ 0], ROTL_4WAY(_mm_add_epi32(x[ 3], x[ 2]), 18));
+		x[ 5] = _mm_xor_si128(x[ 5], ROTL_4WAY(_mm_add_epi32(x[ 4], x[ 7]), 18));
+		x[10] = _mm_xor_si128(x[10], ROTL_4WAY(_mm_add_epi32(x[ 9], x[ 8]), 18));
+		x[15] = _mm_xor_si128(x[15], ROTL_4WAY(_mm_add_epi32(x[14], x[13]), 18));
+	}
+
+	for (i = 0; i < 16; i++)
+		B[i] = _mm_add_epi32(B[i], x[i]);
+}
+
+void scrypt_1024_1_1_256_sp_sse2_4way(const char *input, char *output, char *scratchpad)
+{
+	uint8_t B[4][128];
+	union {
+		__m128i i128[32];
+		uint32_t u32[32 * 4];
+	} X;
+	__m128i *V;
+	uint32_t *V32;
+	uint32_t i, j, k, l;
+
+	V = (__m128i *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+	V32 = (uint32_t *)V;
+
+	for (l = 0; l < 4; l++)
+		PBKDF2_SHA256((const uint8_t *)&input[80 * l], 80, (const uint8_t *)&input[80 * l], 80, 1, B[l], 128);
+
+	for (k = 0; k < 32; k++)
+		for (l = 0; l < 4; l++)
+			X.u32[k * 4 + l] = le32dec(&B[l][4 * k]);
+
+	for (i = 0; i < 1024; i++) {
+		for (k = 0; k < 32; k++)
+			V[i * 32 + k] = X.i128[k];
+		xor_salsa8_sse2_4way(&X.i128[0], &X.i128[16]);
+		xor_salsa8_sse2_4way(&X.i128[16], &X.i128[0]);
+	}
+	for (i = 0; i < 1024; i++) {
+		/* Each lane reads its own row of V. */
+		for (l = 0; l < 4; l++) {
+			j = 32 * 4 * (X.u32[16 * 4 + l] & 1023);
+			for (k = 0; k < 32; k++)
+				X.u32[k * 4 + l] ^= V32[j + k * 4 + l];
+		}
+		xor_salsa8_sse2_4way(&X.i128[0], &X.i128[16]);
+		xor_salsa8_sse2_4way(&X.i128[16], &X.i128[0]);
+	}
+
+	for (k = 0; k < 32; k++)
+		for (l = 0; l < 4; l++)
+			le32enc(&B[l][4 * k], X.u32[k * 4 + l]);
+
+	for (l = 0; l < 4; l++)
+		PBKDF2_SHA256((const uint8_t *)&input[80 * l], 80, B[l], 128, 1, (uint8_t *)&output[32 * l], 32);
+}
@@ -34,7 +34,9 @@
 #include <string.h>
 #include <openssl/sha.h>
 
-#if defined(USE_SSE2) && !defined(USE_SSE2_ALWAYS)
+#include <memory>
+
+#if (defined(USE_SSE2) && !defined(USE_SSE2_ALWAYS)) || (defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL))
 #ifdef _MSC_VER
 // MSVC 64bit is unable to use inline asm
 #include <intrin.h>
@@ -290,10 +292,10 @@ void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scrat
 // By default, set to generic scrypt function. This will prevent crash in case when scrypt_detect_sse2() wasn't called
 void (*scrypt_1024_1_1_256_sp_detected)(const char *input, char *output, char *scratchpad) = &scrypt_1024_1_1_256_sp_generic;
 
-void scrypt_detect_sse2()
+std::string scrypt_detect_sse2()
 {
 #if defined(USE_SSE2_ALWAYS)
-    printf("scrypt: using scrypt-sse2 as built.\n");
+    return "scrypt-sse2 (as built)";
 #else // USE_SSE2_ALWAYS
     // 32bit x86 Linux or Windows, detect cpuid features
     unsigned int cpuid_edx=0;
@@ -301,7 +303,7 @@ void scrypt_detect_sse2()
     // MSVC
     int x86cpuid[4];
     __cpuid(x86cpuid, 1);
-    cpuid_edx = (unsigned int)buffer[3];
+    cpuid_edx = (unsigned int)x86cpuid[3];
 #else // _MSC_VER
     // Linux or i686-w64-mingw32 (gcc-4.6.3)
     unsigned int eax, ebx, ecx;
@@ -311,12 +313,12 @@ void scrypt_detect_sse2()
     if (cpuid_edx & 1<<26)
     {
         scrypt_1024_1_1_256_sp_detected = &scrypt_1024_1_1_256_sp_sse2;
-        printf("scrypt: using scrypt-sse2 as detected.\n");
+        return "scrypt-sse2 (detected)";
     }
     else
     {
         scrypt_1024_1_1_256_sp_detected = &scrypt_1024_1_1_256_sp_generic;
-        printf("scrypt: using scrypt-generic, SSE2 unavailable.\n");
+        return "scrypt-generic (SSE2 unavailable)";
     }
 #endif // USE_SSE2_ALWAYS
 }
@@ -327,3 +329,88 @@ void scrypt_1024_1_1_256(const char *input, char *output)
 	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
     scrypt_1024_1_1_256_sp(input, output, scratchpad);
 }
+
+/* Multi-lane kernel picked by scrypt_detect_multi() and the number of inputs it hashes per call */
+static void (*scrypt_1024_1_1_256_sp_multi_detected)(const char *input, char *output, char *scratchpad) = NULL;
+static int scrypt_multi_detected_ways = 1;
+
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+static bool scrypt_avx2_supported()
+{
+	unsigned int eax, ebx, ecx, edx;
+	uint32_t xcr0_lo, xcr0_hi;
+
+	/* AVX and OSXSAVE, and the OS must save the YMM registers. */
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & (1 << 27)) || !(ecx & (1 << 28)))
+		return false;
+	__asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+	if ((xcr0_lo & 6) != 6)
+		return false;
+	if (__get_cpuid_max(0, NULL) < 7)
+		return false;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	return (ebx & (1 << 5)) != 0;
+}
+#endif
+
+int scrypt_detect_multi()
+{
+	scrypt_1024_1_1_256_sp_multi_detected = NULL;
+	scrypt_multi_detected_ways = 1;
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+	if (scrypt_avx2_supported()) {
+		scrypt_1024_1_1_256_sp_multi_detected = &scrypt_1024_1_1_256_sp_avx2_8way;
+		scrypt_multi_detected_ways = 8;
+		return scrypt_multi_detected_ways;
+	}
+#endif
+#if defined(USE_SSE2)
+#if !defined(USE_SSE2_ALWAYS)
+	/* Relies on scrypt_detect_sse2() having been called first. */
+	if (scrypt_1024_1_1_256_sp_detected != &scrypt_1024_1_1_256_sp_sse2)
+		return scrypt_multi_detected_ways;
+#endif
+	scrypt_1024_1_1_256_sp_multi_detected = &scrypt_1024_1_1_256_sp_sse2_4way;
+	scrypt_multi_detected_ways = 4;
+#endif
+	return scrypt_multi_detected_ways;
+}
+
+int scrypt_multi_ways()
+{
+	return scrypt_multi_detected_ways;
+}
+
+void scrypt_1024_1_1_256_sp_multi(const char *input, char *output, char *scratchpad, size_t n)
+{
+	const size_t ways = scrypt_multi_detected_ways;
+
+	if (scrypt_1024_1_1_256_sp_multi_detected == NULL) {
+		for (size_t i = 0; i < n; i++)
+			scrypt_1024_1_1_256_sp(input + 80 * i, output + 32 * i, scratchpad);
+		return;
+	}
+	for (; n >= ways; n -= ways, input += 80 * ways, output += 32 * ways)
+		scrypt_1024_1_1_256_sp_multi_detected(input, output, scratchpad);
+	if (n == 1) {
+		scrypt_1024_1_1_256_sp(input, output, scratchpad);
+	} else if (n > 1) {
+		/* Pad a partial group by repeating its last input. */
+		char inbuf[80 * SCRYPT_MULTI_MAX_WAYS];
+		char outbuf[32 * SCRYPT_MULTI_MAX_WAYS];
+		memcpy(inbuf, input, 80 * n);
+		for (size_t i = n; i < ways; i++)
+			memcpy(&inbuf[80 * i], &input[80 * (n - 1)], 80);
+		scrypt_1024_1_1_256_sp_multi_detected(inbuf, outbuf, scratchpad);
+		memcpy(output, outbuf, 32 * n);
+	}
+}
+
+void scrypt_1024_1_1_256_multi(const char *input, char *output, size_t n)
+{
+	/* Allocated on first use and kept for the lifetime of the calling thread. */
+	static thread_local std::unique_ptr<char[]> scratchpad;
+	if (!scratchpad)
+		scratchpad.reset(new char[SCRYPT_MULTI_SCRATCHPAD_SIZE]);
+	scrypt_1024_1_1_256_sp_multi(input, output, scratchpad.get(), n);
+}
@@ -1,10 +1,19 @@
 #ifndef SCRYPT_H
 #define SCRYPT_H
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
 #include <stdlib.h>
 #include <stdint.h>
 
+#include <string>
+
 static const int SCRYPT_SCRATCHPAD_SIZE = 131072 + 63;
 
+/* Widest batch hashed by one call of a multi-lane kernel, and the scratchpad it needs */
+static const int SCRYPT_MULTI_MAX_WAYS = 8;
+static const int SCRYPT_MULTI_SCRATCHPAD_SIZE = SCRYPT_MULTI_MAX_WAYS * 131072 + 63;
+
 void scrypt_1024_1_1_256(const char *input, char *output);
 void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad);
 
@@ -16,13 +25,32 @@ void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scrat
 #define scrypt_1024_1_1_256_sp(input, output, scratchpad) scrypt_1024_1_1_256_sp_detected((input), (output), (scratchpad))
 #endif
 
-void scrypt_detect_sse2();
+/** Select the single-lane scrypt implementation for this CPU and return its name */
+std::string scrypt_detect_sse2();
 void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchpad);
 extern void (*scrypt_1024_1_1_256_sp_detected)(const char *input, char *output, char *scratchpad);
 #else
 #define scrypt_1024_1_1_256_sp(input, output, scratchpad) scrypt_1024_1_1_256_sp_generic((input), (output), (scratchpad))
 #endif
 
+/*
+ * Batched scrypt: hash n independent 80-byte inputs, stored back to back in
+ * input, into n 32-byte outputs. Inputs are processed in groups as wide as the
+ * kernel picked by scrypt_detect_multi() (4 lanes with SSE2, 8 with AVX2);
+ * before detection, or on other CPUs, this falls back to one hash at a time.
+ */
+void scrypt_1024_1_1_256_multi(const char *input, char *output, size_t n);
+void scrypt_1024_1_1_256_sp_multi(const char *input, char *output, char *scratchpad, size_t n);
+int scrypt_detect_multi();
+int scrypt_multi_ways();
+
+#if defined(USE_SSE2)
+void scrypt_1024_1_1_256_sp_sse2_4way(const char *input, char *output, char *scratchpad);
+#endif
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+void scrypt_1024_1_1_256_sp_avx2_8way(const char *input, char *output, char *scratchpad);
+#endif
+
 void
 PBKDF2_SHA256(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt,
     size_t saltlen, uint64_t c, uint8_t *buf, size_t dkLen);
@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -25,4 +26,20 @@ public:
     CSHA256& Reset();
 };
 
+/** Autodetect the best available SHA256 implementation, and use it from
+ *  now on. Returns the name of the implementation. */
+std::string SHA256AutoDetect();
+
+/** Use only the named SHA256 implementation ("standard", "sse4.1", "avx2"
+ *  or "shani"). Fails if it was not built in or the CPU lacks support for
+ *  it. Meant for tests and benchmarks; use SHA256AutoDetect() otherwise. */
+bool SHA256SelectImplementation(const std::string& name);
+
+/** Compute the double-SHA256 of each of a number of 64-byte inputs.
+ *  output: pointer to a blocks*32 byte output buffer
+ *  input:  pointer to a blocks*64 byte input buffer
+ *  blocks: the number of hashes to compute
+ */
+void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
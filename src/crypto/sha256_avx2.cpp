@@ -0,0 +1,51 @@
+// Copyright (c) 2009-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// 8-way double-SHA256 of 64-byte inputs, using AVX2.
+
+#include "crypto/common.h"
+#include "crypto/sha256_multiway.h"
+
+#include <immintrin.h>
+
+namespace sha256d64_avx2
+{
+namespace
+{
+struct Ops
+{
+    typedef __m256i V;
+
+    static inline V Add(V x, V y) { return _mm256_add_epi32(x, y); }
+    static inline V Xor(V x, V y) { return _mm256_xor_si256(x, y); }
+    static inline V Or(V x, V y) { return _mm256_or_si256(x, y); }
+    static inline V And(V x, V y) { return _mm256_and_si256(x, y); }
+    template <int n>
+    static inline V Shr(V x) { return _mm256_srli_epi32(x, n); }
+    template <int n>
+    static inline V Shl(V x) { return _mm256_slli_epi32(x, n); }
+    static inline V Set(uint32_t x) { return _mm256_set1_epi32(x); }
+
+    static inline V Load(const unsigned char* in, int j)
+    {
+        return _mm256_set_epi32(ReadBE32(in + 448 + 4 * j), ReadBE32(in + 384 + 4 * j), ReadBE32(in + 320 + 4 * j), ReadBE32(in + 256 + 4 * j),
+                                ReadBE32(in + 192 + 4 * j), ReadBE32(in + 128 + 4 * j), ReadBE32(in + 64 + 4 * j), ReadBE32(in + 4 * j));
+    }
+
+    static inline void Store(unsigned char* out, int j, V v)
+    {
+        uint32_t lanes[8];
+        _mm256_storeu_si256((__m256i*)lanes, v);
+        for (int i = 0; i < 8; i++)
+            WriteBE32(out + 32 * i + 4 * j, lanes[i]);
+    }
+};
+} // namespace
+
+void Transform_8way(unsigned char* out, const unsigned char* in)
+{
+    sha256_multiway::DoubleSHA256<Ops>::Transform(out, in);
+}
+
+} // namespace sha256d64_avx2
@@ -0,0 +1,141 @@
+// Copyright (c) 2009-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_SHA256_MULTIWAY_H
+#define BITCOIN_CRYPTO_SHA256_MULTIWAY_H
+
+#include <stdint.h>
+
+/**
+ * Double-SHA256 of several 64-byte inputs at once, one input per lane of a
+ * vector register. Only included by the translation units that are built
+ * with the matching instruction set flags; Ops supplies the vector type V
+ * and its operations:
+ *
+ *  - Add, Xor, Or, And: lane-wise 32-bit operations
+ *  - Shr<n>, Shl<n>: lane-wise shifts
+ *  - Set(x): x in every lane
+ *  - Load(in, j): word j of each lane's input, read big-endian
+ *  - Store(out, j, v): write lane i of v as word j of output i, big-endian
+ */
+namespace
+{
+namespace sha256_multiway
+{
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/** K plus the message schedule of the padding block that follows a 64-byte input. */
+const uint32_t PADDING_KW[64] = {
+    0xc28a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf374,
+    0x649b69c1, 0xf0fe4786, 0x0fe1edc6, 0x240cf254, 0x4fe9346f, 0x6cc984be, 0x61b9411e, 0x16f988fa,
+    0xf2c65152, 0xa88e5a6d, 0xb019fc65, 0xb9d99ec7, 0x9a1231c3, 0xe70eeaa0, 0xfdb1232b, 0xc7353eb0,
+    0x3069bad5, 0xcb976d5f, 0x5a0f118f, 0xdc1eeefd, 0x0a35b689, 0xde0b7a04, 0x58f4ca9d, 0xe15d5b16,
+    0x007f3e86, 0x37088980, 0xa507ea32, 0x6fab9537, 0x17406110, 0x0d8cd6f1, 0xcdaa3b6d, 0xc0bbbe37,
+    0x83613bda, 0xdb48a363, 0x0b02e931, 0x6fd15ca7, 0x521afaca, 0x31338431, 0x6ed41a95, 0x6d437890,
+    0xc39c91f2, 0x9eccabbd, 0xb5c9a0e6, 0x532fb63c, 0xd2c741c6, 0x07237ea3, 0xa4954b68, 0x4c191d76,
+};
+
+const uint32_t INIT[8] = {0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
+
+template <typename Ops>
+struct DoubleSHA256
+{
+    typedef typename Ops::V V;
+
+    template <int n>
+    static inline V Rotr(V x) { return Ops::Or(Ops::template Shr<n>(x), Ops::template Shl<32 - n>(x)); }
+    static inline V Ch(V x, V y, V z) { return Ops::Xor(z, Ops::And(x, Ops::Xor(y, z))); }
+    static inline V Maj(V x, V y, V z) { return Ops::Or(Ops::And(x, y), Ops::And(z, Ops::Or(x, y))); }
+    static inline V Sigma0(V x) { return Ops::Xor(Ops::Xor(Rotr<2>(x), Rotr<13>(x)), Rotr<22>(x)); }
+    static inline V Sigma1(V x) { return Ops::Xor(Ops::Xor(Rotr<6>(x), Rotr<11>(x)), Rotr<25>(x)); }
+    static inline V sigma0(V x) { return Ops::Xor(Ops::Xor(Rotr<7>(x), Rotr<18>(x)), Ops::template Shr<3>(x)); }
+    static inline V sigma1(V x) { return Ops::Xor(Ops::Xor(Rotr<17>(x), Rotr<19>(x)), Ops::template Shr<10>(x)); }
+
+    /** One round of SHA-256; kw is the round constant plus the message word. */
+    static inline void Round(V a, V b, V c, V& d, V e, V f, V g, V& h, V kw)
+    {
+        V t1 = Ops::Add(Ops::Add(h, Sigma1(e)), Ops::Add(Ch(e, f, g), kw));
+        V t2 = Ops::Add(Sigma0(a), Maj(a, b, c));
+        d = Ops::Add(d, t1);
+        h = Ops::Add(t1, t2);
+    }
+
+    /** Run the 64 rounds over state s. The message schedule is either
+     *  expanded from w, or taken precomputed (with K added) from kw. */
+    static inline void Rounds(V* s, V* w, const uint32_t* kw)
+    {
+        V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+        for (int i = 0; i < 64; i += 8) {
+            V k[8];
+            for (int j = 0; j < 8; j++) {
+                if (kw) {
+                    k[j] = Ops::Set(kw[i + j]);
+                    continue;
+                }
+                int n = (i + j) & 15;
+                if (i + j >= 16)
+                    w[n] = Ops::Add(Ops::Add(w[n], sigma1(w[(n + 14) & 15])), Ops::Add(w[(n + 9) & 15], sigma0(w[(n + 1) & 15])));
+                k[j] = Ops::Add(w[n], Ops::Set(K[i + j]));
+            }
+            Round(a, b, c, d, e, f, g, h, k[0]);
+            Round(h, a, b, c, d, e, f, g, k[1]);
+            Round(g, h, a, b, c, d, e, f, k[2]);
+            Round(f, g, h, a, b, c, d, e, k[3]);
+            Round(e, f, g, h, a, b, c, d, k[4]);
+            Round(d, e, f, g, h, a, b, c, k[5]);
+            Round(c, d, e, f, g, h, a, b, k[6]);
+            Round(b, c, d, e, f, g, h, a, k[7]);
+        }
+        s[0] = Ops::Add(s[0], a);
+        s[1] = Ops::Add(s[1], b);
+        s[2] = Ops::Add(s[2], c);
+        s[3] = Ops::Add(s[3], d);
+        s[4] = Ops::Add(s[4], e);
+        s[5] = Ops::Add(s[5], f);
+        s[6] = Ops::Add(s[6], g);
+        s[7] = Ops::Add(s[7], h);
+    }
+
+    static void Transform(unsigned char* out, const unsigned char* in)
+    {
+        V s[8], w[16];
+
+        // First hash: the input, then its padding block.
+        for (int i = 0; i < 8; i++)
+            s[i] = Ops::Set(INIT[i]);
+        for (int j = 0; j < 16; j++)
+            w[j] = Ops::Load(in, j);
+        Rounds(s, w, NULL);
+        Rounds(s, NULL, PADDING_KW);
+
+        // Second hash: the 32-byte digest and its padding, in one block.
+        for (int i = 0; i < 8; i++) {
+            w[i] = s[i];
+            s[i] = Ops::Set(INIT[i]);
+        }
+        w[8] = Ops::Set(0x80000000ul);
+        for (int j = 9; j < 15; j++)
+            w[j] = Ops::Set(0);
+        w[15] = Ops::Set(0x100);
+        Rounds(s, w, NULL);
+
+        for (int i = 0; i < 8; i++)
+            Ops::Store(out, i, s[i]);
+    }
+};
+
+} // namespace sha256_multiway
+} // namespace
+
+#endif // BITCOIN_CRYPTO_SHA256_MULTIWAY_H
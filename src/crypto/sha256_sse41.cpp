@@ -0,0 +1,50 @@
+// Copyright (c) 2009-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// 4-way double-SHA256 of 64-byte inputs, using SSE4.1.
+
+#include "crypto/common.h"
+#include "crypto/sha256_multiway.h"
+
+#include <immintrin.h>
+
+namespace sha256d64_sse41
+{
+namespace
+{
+struct Ops
+{
+    typedef __m128i V;
+
+    static inline V Add(V x, V y) { return _mm_add_epi32(x, y); }
+    static inline V Xor(V x, V y) { return _mm_xor_si128(x, y); }
+    static inline V Or(V x, V y) { return _mm_or_si128(x, y); }
+    static inline V And(V x, V y) { return _mm_and_si128(x, y); }
+    template <int n>
+    static inline V Shr(V x) { return _mm_srli_epi32(x, n); }
+    template <int n>
+    static inline V Shl(V x) { return _mm_slli_epi32(x, n); }
+    static inline V Set(uint32_t x) { return _mm_set1_epi32(x); }
+
+    static inline V Load(const unsigned char* in, int j)
+    {
+        return _mm_set_epi32(ReadBE32(in + 192 + 4 * j), ReadBE32(in + 128 + 4 * j), ReadBE32(in + 64 + 4 * j), ReadBE32(in + 4 * j));
+    }
+
+    static inline void Store(unsigned char* out, int j, V v)
+    {
+        WriteBE32(out + 4 * j, _mm_extract_epi32(v, 0));
+        WriteBE32(out + 32 + 4 * j, _mm_extract_epi32(v, 1));
+        WriteBE32(out + 64 + 4 * j, _mm_extract_epi32(v, 2));
+        WriteBE32(out + 96 + 4 * j, _mm_extract_epi32(v, 3));
+    }
+};
+} // namespace
+
+void Transform_4way(unsigned char* out, const unsigned char* in)
+{
+    sha256_multiway::DoubleSHA256<Ops>::Transform(out, in);
+}
+
+} // namespace sha256d64_sse41
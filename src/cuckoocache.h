@@ -415,6 +415,21 @@ public:
         }
     }
 
+    /** for_each_live calls f on every element that has not been garbage
+     * collected, the ones of the older epoch first. Inserting them in this
+     * order into another cache keeps the newer ones if not all of them fit.
+     *
+     * @param f the function to call with each element
+     */
+    template <typename F>
+    void for_each_live(F f) const
+    {
+        for (int epoch = 0; epoch < 2; ++epoch)
+            for (uint32_t i = 0; i < size; ++i)
+                if (!collection_flags.bit_is_set(i) && epoch_flags[i] == (epoch == 1))
+                    f(table[i]);
+    }
+
     /* contains iterates through the hash locations for a given element
      * and checks to see if it is present.
      *
@@ -206,5 +206,12 @@ public:
  *      .Finalize()
  */
 uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val);
+/** Optimized SipHash-2-4 implementation for uint256 followed by a 32-bit integer
+ *  (such as a transaction output index), as used for COutPoint keys.
+ *
+ *  It is identical to SipHashUint256 with four extra bytes (little endian)
+ *  written before finalization.
+ */
+uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint32_t extra);
 
 #endif // BITCOIN_HASH_H
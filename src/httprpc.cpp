@@ -147,6 +147,29 @@ static bool RPCAuthorized(const std::string& strAuth, std::string& strAuthUserna
     return multiUserAuthorized(strUserPass);
 }
 
+void HTTPJSONStreamWriter::WriteChunk(const std::string& strChunk)
+{
+    if (!fStarted) {
+        req->WriteHeader("Content-Type", "application/json");
+        req->StartReplyChunked(HTTP_OK);
+        fStarted = true;
+        if (!req->WriteReplyChunk(strPrefix))
+            throw std::runtime_error("Client stopped reading the reply");
+    }
+    if (!req->WriteReplyChunk(strChunk))
+        throw std::runtime_error("Client stopped reading the reply");
+}
+
+void HTTPJSONStreamWriter::Finish(const std::string& strSuffix)
+{
+    Flush();
+    if (!fStarted)
+        WriteChunk("");
+    if (!req->WriteReplyChunk(strSuffix))
+        throw std::runtime_error("Client stopped reading the reply");
+    req->EndReplyChunked();
+}
+
 static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
 {
     // JSONRPC handles only POST
@@ -176,6 +199,8 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         return false;
     }
 
+    // Large results are streamed into the reply behind this prefix
+    HTTPJSONStreamWriter stream(req, "{\"result\":");
     try {
         // Parse request
         UniValue valRequest;
@@ -189,8 +214,13 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         // singleton request
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
+            jreq.pstream = &stream;
 
             UniValue result = tableRPC.execute(jreq);
+            if (stream.IsUsed()) {
+                stream.Finish(",\"error\":null,\"id\":" + jreq.id.write() + "}\n");
+                return true;
+            }
 
             // Send reply
             strReply = JSONRPCReply(result, NullUniValue, jreq.id);
@@ -204,9 +234,18 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         req->WriteHeader("Content-Type", "application/json");
         req->WriteReply(HTTP_OK, strReply);
     } catch (const UniValue& objError) {
+        if (stream.IsStarted()) {
+            // Too late for an error reply; the request cuts the reply short
+            LogPrintf("%s: error while streaming reply: %s\n", __func__, objError.write());
+            return false;
+        }
         JSONErrorReply(req, objError, jreq.id);
         return false;
     } catch (const std::exception& e) {
+        if (stream.IsStarted()) {
+            LogPrintf("%s: error while streaming reply: %s\n", __func__, e.what());
+            return false;
+        }
         JSONErrorReply(req, JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
         return false;
     }
@@ -8,8 +8,37 @@
 #include <string>
 #include <map>
 
+#include "rpc/protocol.h"
+
 class HTTPRequest;
 
+/**
+ * Writes a JSON document as the body of a chunked HTTP reply. The reply is
+ * only started once the first chunk is ready, so that an error raised before
+ * anything was handed out can still get an ordinary error reply.
+ */
+class HTTPJSONStreamWriter : public JSONStreamWriter
+{
+private:
+    HTTPRequest* req;
+    //! Sent in front of the document, e.g. to wrap it into a larger one
+    std::string strPrefix;
+    bool fStarted;
+
+protected:
+    //! Throws std::runtime_error if the client stopped reading the reply
+    void WriteChunk(const std::string& strChunk);
+
+public:
+    HTTPJSONStreamWriter(HTTPRequest* reqIn, const std::string& strPrefixIn = "") : req(reqIn), strPrefix(strPrefixIn), fStarted(false) {}
+
+    //! Whether the reply was started, after which no other reply can be sent
+    bool IsStarted() const { return fStarted; }
+
+    //! Send what is left of the document followed by strSuffix, and end the reply
+    void Finish(const std::string& strSuffix);
+};
+
 /** Start HTTP RPC subsystem.
  * Precondition; HTTP and RPC has been started.
  */
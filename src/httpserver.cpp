@@ -9,6 +9,7 @@
 #include "util.h"
 #include "netbase.h"
 #include "rpc/protocol.h" // For HTTP status codes
+#include "sharedbytes.h"
 #include "sync.h"
 #include "ui_interface.h"
 
@@ -19,7 +20,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <signal.h>
+#include <condition_variable>
 #include <future>
+#include <mutex>
 
 #include <event2/event.h>
 #include <event2/http.h>
@@ -540,11 +543,17 @@ void HTTPEvent::trigger(struct timeval* tv)
         evtimer_add(ev, tv); // trigger after timeval passed
 }
 HTTPRequest::HTTPRequest(struct evhttp_request* _req) : req(_req),
-                                                       replySent(false)
+                                                       replySent(false),
+                                                       chunkedReply(false)
 {
 }
 HTTPRequest::~HTTPRequest()
 {
+    if (chunkedReply && req) {
+        // A chunked reply that was not finished, e.g. because of an error
+        LogPrintf("%s: Unfinished chunked reply\n", __func__);
+        AbortReplyChunked();
+    }
     if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
@@ -599,10 +608,36 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
     assert(!replySent && req);
-    // Send event to main http thread to send reply message
     struct evbuffer* evb = evhttp_request_get_output_buffer(req);
     assert(evb);
     evbuffer_add(evb, strReply.data(), strReply.size());
+    SendReply(nStatus);
+}
+
+/** Release the reference to the body of a reply once libevent is done with it */
+static void http_reply_cleanup_cb(const void* data, size_t datalen, void* extra)
+{
+    delete static_cast<CSharedBytes*>(extra);
+}
+
+void HTTPRequest::WriteReply(int nStatus, const CSharedBytes& reply)
+{
+    assert(!replySent && req);
+    struct evbuffer* evb = evhttp_request_get_output_buffer(req);
+    assert(evb);
+    if (!reply.empty()) {
+        CSharedBytes* pref = new CSharedBytes(reply);
+        if (evbuffer_add_reference(evb, pref->data(), pref->size(), http_reply_cleanup_cb, pref) != 0) {
+            delete pref;
+            evbuffer_add(evb, reply.data(), reply.size());
+        }
+    }
+    SendReply(nStatus);
+}
+
+void HTTPRequest::SendReply(int nStatus)
+{
+    // Send event to main http thread to send reply message
     HTTPEvent* ev = new HTTPEvent(eventBase, true,
         std::bind(evhttp_send_reply, req, nStatus, (const char*)NULL, (struct evbuffer *)NULL));
     ev->trigger(0);
@@ -610,6 +645,143 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     req = 0; // transferred back to main thread
 }
 
+/** Maximum number of bytes of a chunked reply that may be waiting to be written to the connection */
+static const uint64_t MAX_CHUNKED_REPLY_PENDING = 1024 * 1024;
+
+/**
+ * Progress of a chunked reply. The worker thread producing the reply waits
+ * on it while the client falls too far behind.
+ */
+struct HTTPChunkedReplyState
+{
+    std::mutex cs;
+    std::condition_variable cond;
+    //! Bytes queued by the worker thread
+    uint64_t nQueued;
+    //! Bytes handed to libevent by the main http thread
+    uint64_t nHanded;
+    //! Bytes known to have been written to the connection
+    uint64_t nWritten;
+    //! Set once the connection is gone, so the worker thread stops waiting
+    bool fClosed;
+
+    HTTPChunkedReplyState() : nQueued(0), nHanded(0), nWritten(0), fClosed(false) {}
+};
+
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+/** Called in the main http thread once the connection's output buffer has been drained */
+static void http_reply_chunk_written_cb(struct evhttp_connection* evcon, void* arg)
+{
+    HTTPChunkedReplyState* state = static_cast<HTTPChunkedReplyState*>(arg);
+    std::lock_guard<std::mutex> lock(state->cs);
+    state->nWritten = state->nHanded;
+    state->cond.notify_all();
+}
+#endif
+
+void HTTPRequest::StartReplyChunked(int nStatus)
+{
+    assert(!replySent && req);
+    HTTPEvent* ev = new HTTPEvent(eventBase, true,
+        std::bind(evhttp_send_reply_start, req, nStatus, (const char*)NULL));
+    ev->trigger(0);
+    replySent = true;
+    chunkedReply = true;
+    chunkState = std::make_shared<HTTPChunkedReplyState>();
+}
+
+bool HTTPRequest::WriteReplyChunk(const std::string& strChunk)
+{
+    assert(chunkedReply && req);
+    // An empty chunk would end the reply
+    if (strChunk.empty())
+        return true;
+    std::shared_ptr<HTTPChunkedReplyState> state = chunkState;
+    {
+        std::unique_lock<std::mutex> lock(state->cs);
+        const std::chrono::seconds timeout(GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
+        uint64_t nWrittenBefore = state->nWritten;
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+        while (!state->fClosed && state->nQueued - state->nWritten > MAX_CHUNKED_REPLY_PENDING) {
+            if (state->cond.wait_until(lock, deadline) == std::cv_status::timeout) {
+                if (state->nWritten == nWrittenBefore)
+                    return false;
+                // The client is slow but still reading
+                nWrittenBefore = state->nWritten;
+                deadline = std::chrono::steady_clock::now() + timeout;
+            }
+        }
+        if (state->fClosed)
+            return false;
+        state->nQueued += strChunk.size();
+    }
+    // Fill the buffer here, to keep the copy off the main http thread. Events
+    // are handled in the order they were triggered, so chunks stay in order.
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, strChunk.data(), strChunk.size());
+    struct evhttp_request* _req = req;
+    const uint64_t nSize = strChunk.size();
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [_req, evb, state, nSize]() {
+        {
+            std::lock_guard<std::mutex> lock(state->cs);
+            state->nHanded += nSize;
+            if (!evhttp_request_get_connection(_req)) {
+                // The client went away; nothing will be written any more
+                state->fClosed = true;
+                state->cond.notify_all();
+            }
+        }
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+        evhttp_send_reply_chunk_with_cb(_req, evb, http_reply_chunk_written_cb, state.get());
+#else
+        // Without a completion callback only the queue of events is bounded
+        evhttp_send_reply_chunk(_req, evb);
+        {
+            std::lock_guard<std::mutex> lock(state->cs);
+            state->nWritten = state->nHanded;
+            state->cond.notify_all();
+        }
+#endif
+        evbuffer_free(evb);
+    });
+    ev->trigger(0);
+    return true;
+}
+
+void HTTPRequest::EndReplyChunked()
+{
+    assert(chunkedReply && req);
+    // This replaces the connection's write callback, after which the state
+    // can no longer be referenced from the main thread
+    std::shared_ptr<HTTPChunkedReplyState> state = chunkState;
+    struct evhttp_request* _req = req;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [_req, state]() {
+        evhttp_send_reply_end(_req);
+    });
+    ev->trigger(0);
+    req = 0; // transferred back to main thread
+}
+
+void HTTPRequest::AbortReplyChunked()
+{
+    assert(chunkedReply && req);
+    std::shared_ptr<HTTPChunkedReplyState> state = chunkState;
+    struct evhttp_request* _req = req;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [_req, state]() {
+        struct evhttp_connection* evcon = evhttp_request_get_connection(_req);
+        if (evcon) {
+            // Also frees the request
+            evhttp_connection_free(evcon);
+        } else {
+            // The connection is already gone; this only frees the request
+            evhttp_send_reply_end(_req);
+        }
+    });
+    ev->trigger(0);
+    req = 0; // transferred back to main thread
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
@@ -8,6 +8,7 @@
 #include <string>
 #include <stdint.h>
 #include <functional>
+#include <memory>
 
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
@@ -16,7 +17,9 @@ static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
 struct evhttp_request;
 struct event_base;
 class CService;
+class CSharedBytes;
 class HTTPRequest;
+struct HTTPChunkedReplyState;
 
 /** Initialize HTTP server.
  * Call this before RegisterHTTPHandler or EventBase().
@@ -55,6 +58,12 @@ class HTTPRequest
 private:
     struct evhttp_request* req;
     bool replySent;
+    bool chunkedReply;
+    //! Flow control between this thread and the connection while a chunked reply is sent
+    std::shared_ptr<HTTPChunkedReplyState> chunkState;
+
+    /** Hand the request with the reply in its output buffer back to the main thread */
+    void SendReply(int nStatus);
 
 public:
     HTTPRequest(struct evhttp_request* req);
@@ -110,6 +119,42 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Write HTTP reply with a body that is passed to the connection without
+     * being copied. It is kept alive until it has been sent.
+     */
+    void WriteReply(int nStatus, const CSharedBytes& reply);
+
+    /**
+     * Start a chunked HTTP reply, of which the body is sent piece by piece
+     * with WriteReplyChunk while it is still being produced.
+     *
+     * @note Write headers before calling this. After this only
+     * WriteReplyChunk and EndReplyChunked may be called.
+     */
+    void StartReplyChunked(int nStatus);
+
+    /**
+     * Send the next piece of a chunked reply body. This blocks while too much
+     * of the reply is still waiting to be written to the connection.
+     * Returns false if the connection was closed, or the client did not read
+     * anything for -rpcservertimeout seconds; the reply can then only be aborted.
+     */
+    bool WriteReplyChunk(const std::string& strChunk);
+
+    /**
+     * Finish a chunked reply. This gives the request back to the main thread,
+     * so do not call any other HTTPRequest methods after calling this.
+     */
+    void EndReplyChunked();
+
+    /**
+     * Give up on a chunked reply by closing the connection without sending
+     * the final chunk, so that the client cannot mistake the part it got for
+     * a complete reply. Also done when the request is destroyed unfinished.
+     */
+    void AbortReplyChunked();
 };
 
 /** Event handler closure.
@@ -216,6 +216,150 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     return std::move(pblocktemplate);
 }
 
+LiveBlockAssembler::LiveBlockAssembler(const CChainParams& _chainparams)
+    : BlockAssembler(_chainparams), pindexPrev(NULL), fMineWitnessTx(true), nTimeAssembled(0), fImprovable(false)
+{
+    mempool.NotifyEntryAdded.connect(boost::bind(&LiveBlockAssembler::TransactionAddedToMempool, this, _1));
+}
+
+LiveBlockAssembler::~LiveBlockAssembler()
+{
+    mempool.NotifyEntryAdded.disconnect(boost::bind(&LiveBlockAssembler::TransactionAddedToMempool, this, _1));
+}
+
+void LiveBlockAssembler::TransactionAddedToMempool(CTransactionRef tx)
+{
+    LOCK(cs);
+    if (!pindexPrev)
+        return;
+    if (vAdded.size() >= MAX_LIVE_TEMPLATE_PENDING) {
+        // Nobody asked for the template in a long while; start over next time
+        pindexPrev = NULL;
+        vAdded.clear();
+        return;
+    }
+    vAdded.push_back(tx->GetHash());
+}
+
+std::unique_ptr<CBlockTemplate> LiveBlockAssembler::GetBlockTemplate(const CScript& scriptPubKeyIn, bool fMineWitnessTxIn)
+{
+    LOCK2(cs_main, mempool.cs);
+    LOCK(cs);
+
+    if (pindexPrev != chainActive.Tip() || scriptPubKey != scriptPubKeyIn || fMineWitnessTx != fMineWitnessTxIn ||
+        (fImprovable && GetTime() - nTimeAssembled >= LIVE_TEMPLATE_REFRESH_INTERVAL)) {
+        // Clear pindexPrev so the next call starts over if this fails
+        pindexPrev = NULL;
+        vAdded.clear();
+        pblocktemplate = CreateNewBlock(scriptPubKeyIn, fMineWitnessTxIn);
+        if (!pblocktemplate)
+            return nullptr;
+        pindexPrev = chainActive.Tip();
+        scriptPubKey = scriptPubKeyIn;
+        fMineWitnessTx = fMineWitnessTxIn;
+        nTimeAssembled = GetTime();
+        fImprovable = false;
+    } else {
+        UpdateBlock();
+    }
+
+    // Iterators into the mempool do not stay valid until the next call
+    inBlock.clear();
+
+    return std::unique_ptr<CBlockTemplate>(new CBlockTemplate(*pblocktemplate));
+}
+
+void LiveBlockAssembler::UpdateBlock()
+{
+    int64_t nTimeStart = GetTimeMicros();
+
+    // Drop transactions that left the mempool, and anything spending them
+    std::set<uint256> setDropped;
+    size_t nKept = 1;
+    for (size_t i = 1; i < pblock->vtx.size(); i++) {
+        const CTransaction& tx = *pblock->vtx[i];
+        CTxMemPool::txiter it = mempool.mapTx.find(tx.GetHash());
+        bool fDrop = (it == mempool.mapTx.end());
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            if (fDrop)
+                break;
+            fDrop = setDropped.count(txin.prevout.hash);
+        }
+        if (fDrop) {
+            setDropped.insert(tx.GetHash());
+            if (fNeedSizeAccounting)
+                nBlockSize -= ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+            nBlockWeight -= GetTransactionWeight(tx);
+            --nBlockTx;
+            nBlockSigOpsCost -= pblocktemplate->vTxSigOpsCost[i];
+            nFees -= pblocktemplate->vTxFees[i];
+            continue;
+        }
+        inBlock.insert(it);
+        if (nKept != i) {
+            pblock->vtx[nKept] = std::move(pblock->vtx[i]);
+            pblocktemplate->vTxFees[nKept] = pblocktemplate->vTxFees[i];
+            pblocktemplate->vTxSigOpsCost[nKept] = pblocktemplate->vTxSigOpsCost[i];
+        }
+        nKept++;
+    }
+    pblock->vtx.resize(nKept);
+    pblocktemplate->vTxFees.resize(nKept);
+    pblocktemplate->vTxSigOpsCost.resize(nKept);
+
+    // Append new transactions, in the order they entered the mempool so that
+    // parents come first
+    int nAdded = 0;
+    lastFewTxs = 0;
+    blockFinished = false;
+    BOOST_FOREACH(const uint256& hash, vAdded) {
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        if (it == mempool.mapTx.end() || inBlock.count(it))
+            continue;
+        if (it->GetModifiedFee() < blockMinFeeRate.GetFee(it->GetTxSize()))
+            continue;
+        if (!fIncludeWitness && it->GetTx().HasWitness())
+            continue;
+        if (isStillDependent(it) || !TestForBlock(it)) {
+            // A new template may be able to include it
+            fImprovable = true;
+            continue;
+        }
+        AddToBlock(it);
+        nAdded++;
+    }
+    vAdded.clear();
+
+    if (!setDropped.empty()) {
+        // Transactions that did not fit before may fit in the space freed
+        int nPackagesSelected = 0;
+        int nDescendantsUpdated = 0;
+        uint64_t nBlockTxBefore = nBlockTx;
+        addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+        nAdded += nBlockTx - nBlockTxBefore;
+    }
+
+    if (!setDropped.empty() || nAdded > 0) {
+        UpdateCoinbase();
+        nLastBlockTx = nBlockTx;
+        nLastBlockSize = nBlockSize;
+        nLastBlockWeight = nBlockWeight;
+    }
+
+    LogPrint("bench", "UpdateBlock(): %d txs dropped, %d added: %.2fms\n", setDropped.size(), nAdded, 0.001 * (GetTimeMicros() - nTimeStart));
+}
+
+void LiveBlockAssembler::UpdateCoinbase()
+{
+    CMutableTransaction coinbaseTx(*pblock->vtx[0]);
+    // Drop the witness commitment, it is generated anew below
+    coinbaseTx.vout.resize(1);
+    coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
+    pblock->vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
+    pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
+    pblocktemplate->vTxFees[0] = -nFees;
+}
+
 bool BlockAssembler::isStillDependent(CTxMemPool::txiter iter)
 {
     BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter))
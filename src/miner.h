@@ -7,6 +7,8 @@
 #define BITCOIN_MINER_H
 
 #include "primitives/block.h"
+#include "script/script.h"
+#include "sync.h"
 #include "txmempool.h"
 
 #include <stdint.h>
@@ -17,12 +19,15 @@
 class CBlockIndex;
 class CChainParams;
 class CReserveKey;
-class CScript;
 class CWallet;
 
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Seconds after which a live block template is assembled anew if transactions were left out of it */
+static const int64_t LIVE_TEMPLATE_REFRESH_INTERVAL = 5;
+/** Maximum number of mempool additions queued for a live block template before it is discarded */
+static const size_t MAX_LIVE_TEMPLATE_PENDING = 50000;
 
 struct CBlockTemplate
 {
@@ -133,7 +138,7 @@ struct update_for_parent_inclusion
 /** Generate a new block, without valid proof-of-work */
 class BlockAssembler
 {
-private:
+protected:
     // The constructed block template
     std::unique_ptr<CBlockTemplate> pblocktemplate;
     // A convenience pointer that always refers to the CBlock in pblocktemplate
@@ -167,7 +172,7 @@ public:
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx=true);
 
-private:
+protected:
     // utility functions
     /** Clear the block's state and prepare for assembling a new block */
     void resetBlock();
@@ -209,6 +214,55 @@ private:
     int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
 };
 
+/**
+ * Block assembler that keeps its template up to date as the mempool changes,
+ * instead of assembling a new block for every request.
+ *
+ * Transactions that entered the mempool are appended to the template if all
+ * their unconfirmed parents are in it already and they fit, and transactions
+ * that left the mempool are dropped from it along with their descendants.
+ * Whenever something was dropped, the freed space is filled again from the
+ * mempool by package selection.
+ * The template is only assembled from scratch when the tip, the coinbase
+ * script or the witness setting changed, or when transactions had to be left
+ * out and the template is LIVE_TEMPLATE_REFRESH_INTERVAL seconds old.
+ *
+ * Transactions appended this way were validated against the current tip by
+ * AcceptToMemoryPool, so TestBlockValidity is not run again for them.
+ */
+class LiveBlockAssembler : public BlockAssembler
+{
+private:
+    CCriticalSection cs;
+
+    // Tip the template builds on; NULL if a new template is needed
+    const CBlockIndex* pindexPrev;
+    CScript scriptPubKey;
+    bool fMineWitnessTx;
+
+    // When the template was last assembled from scratch
+    int64_t nTimeAssembled;
+    // Whether transactions were left out of the template since then
+    bool fImprovable;
+
+    // Transactions that entered the mempool since the last update
+    std::vector<uint256> vAdded;
+
+    void TransactionAddedToMempool(CTransactionRef tx);
+
+    /** Bring the template up to date with the mempool. Requires cs_main, mempool.cs and cs. */
+    void UpdateBlock();
+    /** Set the coinbase value and witness commitment for the current transactions */
+    void UpdateCoinbase();
+
+public:
+    LiveBlockAssembler(const CChainParams& chainparams);
+    ~LiveBlockAssembler();
+
+    /** Get a copy of the up to date block template with coinbase to scriptPubKeyIn */
+    std::unique_ptr<CBlockTemplate> GetBlockTemplate(const CScript& scriptPubKeyIn, bool fMineWitnessTx=true);
+};
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
@@ -26,6 +26,7 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
 #endif
 
 #ifdef USE_UPNP
@@ -37,6 +38,7 @@
 
 
 #include <math.h>
+#include <mutex>
 
 // Dump addresses to peers.dat and banlist.dat every 15 minutes (900s)
 #define DUMP_ADDRESSES_INTERVAL 900
@@ -63,6 +65,17 @@ const static std::string NET_MESSAGE_COMMAND_OTHER = "*other*";
 
 static const uint64_t RANDOMIZER_ID_NETGROUP = 0x6c0edd8036ef4036ULL; // SHA256("netgroup")[0:8]
 static const uint64_t RANDOMIZER_ID_LOCALHOSTNONCE = 0xd93e69e2bbfa5735ULL; // SHA256("localhostnonce")[0:8]
+
+/** Payloads with at least this much left are received into their message directly */
+static const unsigned int MIN_DIRECT_RECV_SIZE = 16 * 1024;
+/** Most bytes to receive into a payload directly at once */
+static const unsigned int MAX_DIRECT_RECV_SIZE = 256 * 1024;
+/** Payloads of at least this size are received into a reused buffer */
+static const unsigned int MIN_POOLED_RECV_BUFFER = 64 * 1024;
+/** Number of payload buffers kept for reuse */
+static const size_t MAX_POOLED_RECV_BUFFERS = 4;
+/** Most queued buffers handed to a single send call */
+static const size_t MAX_SEND_BUFFERS_PER_CALL = 64;
 //
 // Global state variables
 //
@@ -649,6 +662,7 @@ void CNode::copyStats(CNodeStats &stats)
         LOCK(cs_vSend);
         X(mapSendBytesPerMsgCmd);
         X(nSendBytes);
+        X(nSendCalls);
     }
     {
         LOCK(cs_vRecv);
@@ -691,7 +705,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
             vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+            vRecvMsg.emplace_back(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -731,6 +745,18 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
     return true;
 }
 
+unsigned int CNode::GetRecvPayloadBuffer(char*& pch, unsigned int nMax)
+{
+    LOCK(cs_vRecv);
+    if (vRecvMsg.empty())
+        return 0;
+    CNetMessage& msg = vRecvMsg.back();
+    // A small rest is better read along with the messages after it
+    if (!msg.in_data || msg.hdr.nMessageSize > MAX_PROTOCOL_MESSAGE_LENGTH || msg.hdr.nMessageSize - msg.nDataPos < MIN_DIRECT_RECV_SIZE)
+        return 0;
+    return msg.PreparePayload(pch, nMax);
+}
+
 void CNode::SetSendVersion(int nVersionIn)
 {
     // Send version may only be changed in the version message, and
@@ -758,6 +784,70 @@ int CNode::GetSendVersion() const
 }
 
 
+namespace {
+
+/**
+ * Keeps the payload buffers of a few large processed messages, so the next
+ * large messages can be received without allocating and clearing new ones.
+ */
+class CRecvBufferPool
+{
+private:
+    std::mutex mutex;
+    std::vector<CSerializeData> vBuffers;
+
+public:
+    //! Give an empty stream the best fitting buffer for nSize bytes, if there is one
+    void Acquire(CDataStream& stream, unsigned int nSize)
+    {
+        CSerializeData vch;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (vBuffers.empty())
+                return;
+            // The smallest buffer that fits, or else the largest one
+            size_t nBest = 0;
+            for (size_t i = 1; i < vBuffers.size(); i++) {
+                bool fFits = vBuffers[i].capacity() >= nSize;
+                bool fBestFits = vBuffers[nBest].capacity() >= nSize;
+                if (fFits ? (!fBestFits || vBuffers[i].capacity() < vBuffers[nBest].capacity()) : (!fBestFits && vBuffers[i].capacity() > vBuffers[nBest].capacity()))
+                    nBest = i;
+            }
+            vch.swap(vBuffers[nBest]);
+            vBuffers.erase(vBuffers.begin() + nBest);
+        }
+        // Keep the bytes the buffer still holds, so growing it into them
+        // does not clear them first; they are overwritten as data arrives
+        vch.resize(std::min(vch.size(), (size_t)nSize));
+        stream.swap_buffer(vch);
+    }
+
+    //! Take the buffer of a stream that is no longer needed
+    void Release(CDataStream& stream)
+    {
+        CSerializeData vch;
+        stream.swap_buffer(vch);
+        if (vch.capacity() < MIN_POOLED_RECV_BUFFER)
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (vBuffers.size() < MAX_POOLED_RECV_BUFFERS)
+            vBuffers.push_back(std::move(vch));
+    }
+};
+
+CRecvBufferPool& GetRecvBufferPool()
+{
+    static CRecvBufferPool pool;
+    return pool;
+}
+
+} // anon namespace
+
+CNetMessage::~CNetMessage()
+{
+    GetRecvBufferPool().Release(vRecv);
+}
+
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
@@ -786,6 +876,9 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
     // switch state to reading message data
     in_data = true;
 
+    if (hdr.nMessageSize >= MIN_POOLED_RECV_BUFFER)
+        GetRecvBufferPool().Acquire(vRecv, hdr.nMessageSize);
+
     return nCopy;
 }
 
@@ -800,12 +893,25 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
     }
 
     hasher.Write((const unsigned char*)pch, nCopy);
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    // Bytes received in place, after PreparePayload, are there already
+    if (pch != &vRecv[nDataPos])
+        memcpy(&vRecv[nDataPos], pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
 }
 
+unsigned int CNetMessage::PreparePayload(char*& pch, unsigned int nMax)
+{
+    if (!in_data || complete())
+        return 0;
+    unsigned int nRoom = std::min(hdr.nMessageSize - nDataPos, nMax);
+    if (vRecv.size() < nDataPos + nRoom)
+        vRecv.resize(nDataPos + nRoom);
+    pch = &vRecv[nDataPos];
+    return nRoom;
+}
+
 const uint256& CNetMessage::GetMessageHash() const
 {
     assert(complete());
@@ -823,33 +929,63 @@ const uint256& CNetMessage::GetMessageHash() const
 
 
 // requires LOCK(cs_vSend)
-size_t CConnman::SocketSendData(CNode *pnode) const
+size_t CConnman::SocketSendData(CNode *pnode, size_t& nCalls) const
 {
     auto it = pnode->vSendMsg.begin();
     size_t nSentSize = 0;
+    nCalls = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
+        assert(it->size() > pnode->nSendOffset);
+        size_t nOffered = 0;
         int nBytes = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#ifdef WIN32
+            nOffered = it->size() - pnode->nSendOffset;
+            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(it->data()) + pnode->nSendOffset, nOffered, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+            // Hand the socket the headers and payloads of all queued
+            // messages at once, rather than making a call for each of them
+            struct iovec vec[MAX_SEND_BUFFERS_PER_CALL];
+            size_t nBuffers = 0;
+            size_t nOffset = pnode->nSendOffset;
+            for (auto itBuf = it; itBuf != pnode->vSendMsg.end() && nBuffers < MAX_SEND_BUFFERS_PER_CALL; ++itBuf) {
+                vec[nBuffers].iov_base = const_cast<unsigned char*>(itBuf->data()) + nOffset;
+                vec[nBuffers].iov_len = itBuf->size() - nOffset;
+                nOffered += vec[nBuffers].iov_len;
+                nOffset = 0;
+                nBuffers++;
+            }
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = vec;
+            msg.msg_iovlen = nBuffers;
+            nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         }
+        nCalls++;
+        pnode->nSendCalls++;
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
-                pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
-                it++;
-            } else {
-                // could not send full message; stop sending more
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                size_t nPart = std::min(nLeft, it->size() - pnode->nSendOffset);
+                pnode->nSendOffset += nPart;
+                nLeft -= nPart;
+                if (pnode->nSendOffset == it->size()) {
+                    pnode->nSendOffset = 0;
+                    pnode->nSendSize -= it->size();
+                    pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+                    it++;
+                }
+            }
+            if ((size_t)nBytes < nOffered) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -1055,9 +1191,9 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (!pSocketPoller->IsWatchable(hSocket))
     {
-        LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
+        LogPrintf("connection from %s dropped: socket cannot be watched by %s\n", addr.ToString(), pSocketPoller->GetName());
         CloseSocket(hSocket);
         return;
     }
@@ -1173,36 +1309,26 @@ void CConnman::ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
+        const int nTimeoutMs = 50; // frequency to poll pnode->vSend
 
+        // Listen sockets have no node, and owner -1
+        std::vector<SocketWatch> vWatch;
         BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
+            vWatch.push_back(SocketWatch(hListenSocket.socket, -1, SOCKET_RECV));
         }
 
         {
             LOCK(cs_vNodes);
+            vWatch.reserve(vWatch.size() + vNodes.size());
             BOOST_FOREACH(CNode* pnode, vNodes)
             {
                 // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
+                // * If there is data to send, wait for sending data. As this only
                 //   happens when optimistic write failed, we choose to first drain the
                 //   write buffer in this case before receiving more. This avoids
                 //   needlessly queueing received data, if the remote peer is not themselves
                 //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is space left in the receive buffer, select() for
+                // * Otherwise, if there is space left in the receive buffer, wait for
                 //   receiving data.
                 // * Hand off all complete messages to the processor, to be handled without
                 //   blocking here.
@@ -1218,46 +1344,41 @@ void CConnman::ThreadSocketHandler()
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
 
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
-                }
+                int nEvents = 0;
+                if (select_send)
+                    nEvents = SOCKET_SEND;
+                else if (select_recv)
+                    nEvents = SOCKET_RECV;
+                vWatch.push_back(SocketWatch(pnode->hSocket, pnode->id, nEvents));
             }
         }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        CSocketPoller::ReadySockets vReady;
+        bool fWaited = pSocketPoller->Wait(vWatch, nTimeoutMs, vReady);
         if (interruptNet)
             return;
 
-        if (nSelect == SOCKET_ERROR)
+        if (!fWaited)
         {
-            if (have_fds)
+            if (!vWatch.empty())
             {
                 int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
+                LogPrintf("socket %s error %s\n", pSocketPoller->GetName(), NetworkErrorString(nErr));
+                vReady.clear();
+                BOOST_FOREACH(const SocketWatch& watch, vWatch)
+                    vReady.push_back(std::make_pair(watch.hSocket, (int)SOCKET_RECV));
             }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
+            if (!interruptNet.sleep_for(std::chrono::milliseconds(nTimeoutMs)))
                 return;
         }
+        std::map<SOCKET, int> mapReady(vReady.begin(), vReady.end());
 
         //
         // Accept new connections
         //
         BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket != INVALID_SOCKET && mapReady.count(hListenSocket.socket))
             {
                 AcceptConnection(hListenSocket);
             }
@@ -1288,9 +1409,12 @@ void CConnman::ThreadSocketHandler()
                 LOCK(pnode->cs_hSocket);
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
+                std::map<SOCKET, int>::const_iterator it = mapReady.find(pnode->hSocket);
+                if (it != mapReady.end()) {
+                    recvSet = it->second & SOCKET_RECV;
+                    sendSet = it->second & SOCKET_SEND;
+                    errorSet = it->second & SOCKET_ERR;
+                }
             }
             if (recvSet || errorSet)
             {
@@ -1298,17 +1422,24 @@ void CConnman::ThreadSocketHandler()
                     {
                         // typical socket buffer is 8K-64K
                         char pchBuf[0x10000];
+                        // The rest of a large payload is received right into its message
+                        char* pchRecv = pchBuf;
+                        unsigned int nRecvMax = pnode->GetRecvPayloadBuffer(pchRecv, MAX_DIRECT_RECV_SIZE);
+                        if (nRecvMax == 0) {
+                            pchRecv = pchBuf;
+                            nRecvMax = sizeof(pchBuf);
+                        }
                         int nBytes = 0;
                         {
                             LOCK(pnode->cs_hSocket);
                             if (pnode->hSocket == INVALID_SOCKET)
                                 continue;
-                            nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+                            nBytes = recv(pnode->hSocket, pchRecv, nRecvMax, MSG_DONTWAIT);
                         }
                         if (nBytes > 0)
                         {
                             bool notify = false;
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
+                            if (!pnode->ReceiveMsgBytes(pchRecv, nBytes, notify))
                                 pnode->CloseSocketDisconnect();
                             RecordBytesRecv(nBytes);
                             if (notify) {
@@ -1356,9 +1487,10 @@ void CConnman::ThreadSocketHandler()
             if (sendSet)
             {
                 LOCK(pnode->cs_vSend);
-                size_t nBytes = SocketSendData(pnode);
-                if (nBytes) {
-                    RecordBytesSent(nBytes);
+                size_t nCalls;
+                size_t nBytes = SocketSendData(pnode, nCalls);
+                if (nCalls) {
+                    RecordBytesSent(nBytes, nCalls);
                 }
             }
 
@@ -1985,6 +2117,12 @@ void CConnman::ThreadMessageHandler()
             if (pnode->fDisconnect)
                 continue;
 
+            // Each node is worked on by one thread at a time, so its messages
+            // are handled in order. Leave nodes another thread is busy with.
+            TRY_LOCK(pnode->cs_msgProcessing, lockProcessing);
+            if (!lockProcessing)
+                continue;
+
             // Receive messages
             bool fMoreNodeWork = GetNodeSignals().ProcessMessages(pnode, *this, flagInterruptMsgProc);
             fMoreWork |= (fMoreNodeWork && !pnode->fPauseSend);
@@ -2202,6 +2340,7 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     nMaxConnections = 0;
     nMaxOutbound = 0;
     nMaxAddnode = 0;
+    nMessageHandlerThreads = 1;
     nBestHeight = 0;
     clientInterface = NULL;
     flagInterruptMsgProc = false;
@@ -2216,6 +2355,7 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
 {
     nTotalBytesRecv = 0;
     nTotalBytesSent = 0;
+    nTotalSendCalls = 0;
     nMaxOutboundTotalBytesSentInCycle = 0;
     nMaxOutboundCycleStartTime = 0;
 
@@ -2225,10 +2365,18 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
     nMaxOutbound = std::min((connOptions.nMaxOutbound), nMaxConnections);
     nMaxAddnode = connOptions.nMaxAddnode;
     nMaxFeeler = connOptions.nMaxFeeler;
+    nMessageHandlerThreads = std::max(1, std::min(connOptions.nMessageHandlerThreads, MAX_MSGHAND_THREADS));
 
     nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
     nReceiveFloodSize = connOptions.nReceiveFloodSize;
 
+    pSocketPoller = CreateSocketPoller(connOptions.strSocketBackend);
+    if (!pSocketPoller) {
+        strNodeError = strprintf(_("Socket backend %s is not available"), connOptions.strSocketBackend);
+        return false;
+    }
+    LogPrintf("Using %s to wait for socket activity\n", pSocketPoller->GetName());
+
     nMaxOutboundLimit = connOptions.nMaxOutboundLimit;
     nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
 
@@ -2309,7 +2457,8 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
         threadOpenConnections = std::thread(&TraceThread<std::function<void()> >, "opencon", std::function<void()>(std::bind(&CConnman::ThreadOpenConnections, this)));
 
     // Process messages
-    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        threadMessageHandlers.push_back(std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this))));
 
     // Dump network addresses
     scheduler.scheduleEvery(boost::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL);
@@ -2358,8 +2507,11 @@ void CConnman::Interrupt()
 
 void CConnman::Stop()
 {
-    if (threadMessageHandler.joinable())
-        threadMessageHandler.join();
+    BOOST_FOREACH(std::thread& thread, threadMessageHandlers) {
+        if (thread.joinable())
+            thread.join();
+    }
+    threadMessageHandlers.clear();
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
     if (threadOpenAddedConnections.joinable())
@@ -2522,10 +2674,11 @@ void CConnman::RecordBytesRecv(uint64_t bytes)
     nTotalBytesRecv += bytes;
 }
 
-void CConnman::RecordBytesSent(uint64_t bytes)
+void CConnman::RecordBytesSent(uint64_t bytes, uint64_t calls)
 {
     LOCK(cs_totalBytesSent);
     nTotalBytesSent += bytes;
+    nTotalSendCalls += calls;
 
     uint64_t now = GetTime();
     if (nMaxOutboundCycleStartTime + nMaxOutboundTimeframe < now)
@@ -2624,6 +2777,12 @@ uint64_t CConnman::GetTotalBytesSent()
     return nTotalBytesSent;
 }
 
+uint64_t CConnman::GetTotalSendCalls()
+{
+    LOCK(cs_totalBytesSent);
+    return nTotalSendCalls;
+}
+
 ServiceFlags CConnman::GetLocalServices() const
 {
     return nLocalServices;
@@ -2662,6 +2821,7 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nLastSend = 0;
     nLastRecv = 0;
     nSendBytes = 0;
+    nSendCalls = 0;
     nRecvBytes = 0;
     nTimeOffset = 0;
     addrName = addrNameIn == "" ? addr.ToStringIPPort() : addrNameIn;
@@ -2762,19 +2922,21 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
 
 void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 {
-    size_t nMessageSize = msg.data.size();
+    CSharedBytes payload = msg.rawData.empty() ? CSharedBytes(std::move(msg.data)) : std::move(msg.rawData);
+    size_t nMessageSize = payload.size();
     size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
     LogPrint("net", "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->id);
 
     std::vector<unsigned char> serializedHeader;
     serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
-    uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
+    uint256 hash = Hash(payload.begin(), payload.end());
     CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), nMessageSize);
     memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
 
     CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
 
     size_t nBytesSent = 0;
+    size_t nSendCalls = 0;
     {
         LOCK(pnode->cs_vSend);
         bool optimisticSend(pnode->vSendMsg.empty());
@@ -2785,16 +2947,16 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
+        pnode->vSendMsg.push_back(CSharedBytes(std::move(serializedHeader)));
         if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+            pnode->vSendMsg.push_back(std::move(payload));
 
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true)
-            nBytesSent = SocketSendData(pnode);
+            nBytesSent = SocketSendData(pnode, nSendCalls);
     }
-    if (nBytesSent)
-        RecordBytesSent(nBytesSent);
+    if (nSendCalls)
+        RecordBytesSent(nBytesSent, nSendCalls);
 }
 
 bool CConnman::ForNode(NodeId id, std::function<bool(CNode* pnode)> func)
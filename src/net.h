@@ -14,8 +14,10 @@
 #include "hash.h"
 #include "limitedmap.h"
 #include "netaddress.h"
+#include "netpoller.h"
 #include "protocol.h"
 #include "random.h"
+#include "sharedbytes.h"
 #include "streams.h"
 #include "sync.h"
 #include "uint256.h"
@@ -86,6 +88,10 @@ static const bool DEFAULT_BLOCKSONLY = false;
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
+/** Default number of threads that process peer messages */
+static const int DEFAULT_MSGHAND_THREADS = 4;
+/** Maximum number of threads that process peer messages */
+static const int MAX_MSGHAND_THREADS = 16;
 
 static const ServiceFlags REQUIRED_SERVICES = NODE_NETWORK;
 
@@ -116,6 +122,8 @@ struct CSerializedNetMsg
     CSerializedNetMsg& operator=(const CSerializedNetMsg&) = delete;
 
     std::vector<unsigned char> data;
+    //! Already serialized payload, sent instead of data when not empty
+    CSharedBytes rawData;
     std::string command;
 };
 
@@ -145,6 +153,8 @@ public:
         unsigned int nReceiveFloodSize = 0;
         uint64_t nMaxOutboundTimeframe = 0;
         uint64_t nMaxOutboundLimit = 0;
+        std::string strSocketBackend = DEFAULT_SOCKETBACKEND;
+        int nMessageHandlerThreads = 1;
     };
     CConnman(uint64_t seed0, uint64_t seed1);
     ~CConnman();
@@ -276,6 +286,7 @@ public:
 
     uint64_t GetTotalBytesRecv();
     uint64_t GetTotalBytesSent();
+    uint64_t GetTotalSendCalls();
 
     void SetBestHeight(int height);
     int GetBestHeight() const;
@@ -287,6 +298,8 @@ public:
 
     void WakeMessageHandler();
 private:
+    friend struct CConnmanTest;
+
     struct ListenSocket {
         SOCKET socket;
         bool whitelisted;
@@ -317,7 +330,8 @@ private:
 
     NodeId GetNewNodeId();
 
-    size_t SocketSendData(CNode *pnode) const;
+    /** Send as much of the queue of pnode as the socket takes. nCalls is set to the number of send calls made. */
+    size_t SocketSendData(CNode *pnode, size_t& nCalls) const;
     //!check is the banlist has unwritten changes
     bool BannedSetIsDirty();
     //!set the "dirty" flag for the banlist
@@ -330,7 +344,7 @@ private:
 
     // Network stats
     void RecordBytesRecv(uint64_t bytes);
-    void RecordBytesSent(uint64_t bytes);
+    void RecordBytesSent(uint64_t bytes, uint64_t calls);
 
     // Whether the node should be passed out in ForEach* callbacks
     static bool NodeFullyConnected(const CNode* pnode);
@@ -340,6 +354,7 @@ private:
     CCriticalSection cs_totalBytesSent;
     uint64_t nTotalBytesRecv;
     uint64_t nTotalBytesSent;
+    uint64_t nTotalSendCalls;
 
     // outbound limit & stats
     uint64_t nMaxOutboundTotalBytesSentInCycle;
@@ -356,6 +371,8 @@ private:
     unsigned int nReceiveFloodSize;
 
     std::vector<ListenSocket> vhListenSocket;
+    //! Waits for activity on the sockets, in ThreadSocketHandler
+    std::unique_ptr<CSocketPoller> pSocketPoller;
     std::atomic<bool> fNetworkActive;
     banmap_t setBanned;
     CCriticalSection cs_setBanned;
@@ -383,6 +400,7 @@ private:
     int nMaxOutbound;
     int nMaxAddnode;
     int nMaxFeeler;
+    int nMessageHandlerThreads;
     std::atomic<int> nBestHeight;
     CClientUIInterface* clientInterface;
 
@@ -402,7 +420,7 @@ private:
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
+    std::vector<std::thread> threadMessageHandlers;
 };
 extern std::unique_ptr<CConnman> g_connman;
 void Discover(boost::thread_group& threadGroup);
@@ -500,6 +518,7 @@ public:
     bool fAddnode;
     int nStartingHeight;
     uint64_t nSendBytes;
+    uint64_t nSendCalls;
     mapMsgCmdSize mapSendBytesPerMsgCmd;
     uint64_t nRecvBytes;
     mapMsgCmdSize mapRecvBytesPerMsgCmd;
@@ -537,6 +556,9 @@ public:
         nDataPos = 0;
         nTime = 0;
     }
+    CNetMessage(CNetMessage&&) = default;
+    CNetMessage& operator=(CNetMessage&&) = default;
+    ~CNetMessage();
 
     bool complete() const
     {
@@ -555,6 +577,13 @@ public:
 
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
+
+    /**
+     * Make room for up to nMax more bytes of payload, and point pch at it so
+     * they can be received in place. readData then only hashes them. Returns
+     * the number of bytes there is room for, or 0 if no payload is expected.
+     */
+    unsigned int PreparePayload(char*& pch, unsigned int nMax);
 };
 
 
@@ -570,7 +599,8 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    uint64_t nSendCalls; // number of send system calls made, successful or not
+    std::deque<CSharedBytes> vSendMsg;
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -580,6 +610,8 @@ public:
     size_t nProcessQueueSize;
 
     CCriticalSection cs_sendProcessing;
+    //! Held by the message handler thread working on this node, which keeps its messages in order
+    CCriticalSection cs_msgProcessing;
 
     std::deque<CInv> vRecvGetData;
     uint64_t nRecvBytes;
@@ -630,6 +662,8 @@ public:
     std::atomic<int> nStartingHeight;
 
     // flood relay
+    //! Other peers' message handlers push addresses too, so the following two need cs_addrSend
+    CCriticalSection cs_addrSend;
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
     bool fGetAddr;
@@ -721,6 +755,12 @@ public:
     }
 
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete);
+    /**
+     * If a large payload is being received, get room of up to nMax bytes in
+     * it to receive into directly, for ReceiveMsgBytes to take in without
+     * copying. Returns 0 if bytes should rather be read into a buffer.
+     */
+    unsigned int GetRecvPayloadBuffer(char*& pch, unsigned int nMax);
 
     void SetRecvVersion(int nVersionIn)
     {
@@ -752,6 +792,7 @@ public:
 
     void AddAddressKnown(const CAddress& _addr)
     {
+        LOCK(cs_addrSend);
         addrKnown.insert(_addr.GetKey());
     }
 
@@ -760,6 +801,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_addrSend);
         if (_addr.IsValid() && !addrKnown.contains(_addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand.rand32() % vAddrToSend.size()] = _addr;
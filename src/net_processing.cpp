@@ -16,6 +16,7 @@
 #include "merkleblock.h"
 #include "net.h"
 #include "netmessagemaker.h"
+#include "netmsgcache.h"
 #include "netbase.h"
 #include "policy/fees.h"
 #include "policy/policy.h"
@@ -105,9 +106,17 @@ namespace {
         const CBlockIndex* pindex;                               //!< Optional.
         bool fValidatedHeaders;                                  //!< Whether this block has validated headers at the time of request.
         std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //!< Optional, used for CMPCTBLOCK downloads
+        int64_t nTimeRequested;                                  //!< When the block was asked for, in microseconds.
     };
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
+    /**
+     * Blocks that were delivered and wait in the block pipeline to be
+     * stored, protected by cs_main. They are not requested again, but no
+     * longer count as in flight from the peer that sent them.
+     */
+    std::set<uint256> setBlocksQueued;
+
     /** Stack of nodes which we have set to announce using compact blocks */
     std::list<NodeId> lNodesAnnouncingHeaderAndIDs;
 
@@ -175,6 +184,10 @@ struct CNodeState {
     int64_t nDownloadingSince;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! How many blocks may be in flight from this peer at once.
+    int nMaxBlocksInFlight;
+    //! Moving average of the time in microseconds this peer took per delivered block, or 0 if unknown.
+    int64_t nBlockDeliveryTime;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block announcements.
@@ -211,6 +224,8 @@ struct CNodeState {
         nDownloadingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        nMaxBlocksInFlight = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+        nBlockDeliveryTime = 0;
         fPreferredDownload = false;
         fPreferHeaders = false;
         fPreferHeaderAndIDs = false;
@@ -304,6 +319,24 @@ void FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTime) {
     }
 }
 
+// Requires cs_main.
+// Size the download window of the peer that delivered a block to the rate at
+// which it delivers them: the number of blocks it sends in
+// BLOCK_DOWNLOAD_TARGET_TIME. Must be called before MarkBlockAsReceived.
+void UpdateBlockDeliveryRate(NodeId nodeid, const uint256& hash) {
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != nodeid)
+        return;
+    CNodeState *state = State(nodeid);
+    // Blocks are delivered in the order they were asked for, so the time
+    // since the previous one arrived is what this one took. Blocks that
+    // overtook their queue say little about the rate.
+    if (state->vBlocksInFlight.begin() != itInFlight->second.second)
+        return;
+    state->nBlockDeliveryTime = UpdateBlockDeliveryTime(state->nBlockDeliveryTime, GetTimeMicros() - state->nDownloadingSince);
+    state->nMaxBlocksInFlight = GetBlockDownloadWindow(state->nBlockDeliveryTime);
+}
+
 // Requires cs_main.
 // Returns a bool indicating whether we requested this block.
 // Also used if a block was /not/ received and timed out or started with another peer
@@ -347,7 +380,7 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Pa
     MarkBlockAsReceived(hash);
 
     std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
-            {hash, pindex, pindex != NULL, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : NULL)});
+            {hash, pindex, pindex != NULL, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : NULL), GetTimeMicros()});
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
@@ -468,7 +501,7 @@ const CBlockIndex* LastCommonAncestor(const CBlockIndex* pa, const CBlockIndex*
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
  *  at most count entries. */
-void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller, const Consensus::Params& consensusParams) {
+void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller, const CBlockIndex*& pindexStalled, const Consensus::Params& consensusParams) {
     if (count == 0)
         return;
 
@@ -504,6 +537,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
     int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
+    const CBlockIndex* pindexWaitingFor = NULL;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -532,6 +566,8 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
             if (pindex->nStatus & BLOCK_HAVE_DATA || chainActive.Contains(pindex)) {
                 if (pindex->nChainTx)
                     state->pindexLastCommonBlock = pindex;
+            } else if (setBlocksQueued.count(pindex->GetBlockHash())) {
+                // Received, and about to be stored.
             } else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
                 // The block is not already downloaded, and not yet in flight.
                 if (pindex->nHeight > nWindowEnd) {
@@ -539,6 +575,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
                         // We aren't able to fetch anything, but we would be if the download window was one larger.
                         nodeStaller = waitingfor;
+                        pindexStalled = pindexWaitingFor;
                     }
                     return;
                 }
@@ -549,6 +586,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                pindexWaitingFor = pindex;
             }
         }
     }
@@ -556,6 +594,26 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
 
 } // anon namespace
 
+int64_t UpdateBlockDeliveryTime(int64_t nBlockDeliveryTime, int64_t nTime) {
+    nTime = std::max<int64_t>(nTime, 1);
+    if (nBlockDeliveryTime == 0)
+        return nTime;
+    return (nBlockDeliveryTime * 7 + nTime) / 8;
+}
+
+int GetBlockDownloadWindow(int64_t nBlockDeliveryTime) {
+    int64_t nWindow = BLOCK_DOWNLOAD_TARGET_TIME / std::max<int64_t>(nBlockDeliveryTime, 1);
+    return std::max<int64_t>(MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(nWindow, MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER));
+}
+
+bool ShouldReassignBlock(int64_t nNow, int64_t nTimeRequested, int64_t nBlockDeliveryTime, int64_t nStallerBlockDeliveryTime) {
+    if (nBlockDeliveryTime == 0)
+        return false;
+    if (nStallerBlockDeliveryTime != 0 && nBlockDeliveryTime >= nStallerBlockDeliveryTime)
+        return false;
+    return nNow - nTimeRequested > std::max(BLOCK_REASSIGN_MIN_TIME, 2 * nStallerBlockDeliveryTime);
+}
+
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     LOCK(cs_main);
     CNodeState *state = State(nodeid);
@@ -568,6 +626,8 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.nMaxBlocksInFlight = state->nMaxBlocksInFlight;
+    stats.nBlockDeliveryTime = state->nBlockDeliveryTime;
     return true;
 }
 
@@ -776,6 +836,10 @@ static std::shared_ptr<const CBlock> most_recent_block;
 static std::shared_ptr<const CBlockHeaderAndShortTxIDs> most_recent_compact_block;
 static uint256 most_recent_block_hash;
 
+// Payloads of blocks and transactions that are sent to many peers
+static CNetMsgCache blockMsgCache(MAX_BLOCK_MSG_CACHE_BYTES);
+static CNetMsgCache txMsgCache(MAX_TX_MSG_CACHE_BYTES);
+
 void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock) {
     std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs> (*pblock, true);
     const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
@@ -797,8 +861,9 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
         most_recent_compact_block = pcmpctblock;
     }
 
-    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
-        // TODO: Avoid the repeated-serialization here
+    const CSharedBytes cmpctPayload = blockMsgCache.Get(hashBlock, NetMsgType::CMPCTBLOCK, 0, *pcmpctblock);
+
+    connman->ForEachNode([this, &cmpctPayload, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
         if (pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect)
             return;
         ProcessBlockAvailability(pnode->GetId());
@@ -810,7 +875,7 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
 
             LogPrint("net", "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
                     hashBlock.ToString(), pnode->id);
-            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            connman->PushMessage(pnode, msgMaker.MakeRaw(NetMsgType::CMPCTBLOCK, cmpctPayload));
             state.pindexBestHeaderSent = pindex;
         }
     });
@@ -904,12 +969,13 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
                 recentRejects->reset();
             }
 
-            // Use pcoinsTip->HaveCoinsInCache as a quick approximation to exclude
+            // Use pcoinsTip->HaveCoinInCache as a quick approximation to exclude
             // requesting or processing some txs which have already been included in a block
             return recentRejects->contains(inv.hash) ||
                    mempool.exists(inv.hash) ||
                    mapOrphanTransactions.count(inv.hash) ||
-                   pcoinsTip->HaveCoinsInCache(inv.hash);
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) || // Best effort: only try output 0 and 1
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
         }
     case MSG_BLOCK:
     case MSG_WITNESS_BLOCK:
@@ -969,7 +1035,6 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
     std::vector<CInv> vNotFound;
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
-    LOCK(cs_main);
 
     while (it != pfrom->vRecvGetData.end()) {
         // Don't bother if send buffer is too full to respond anyway
@@ -977,7 +1042,15 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
             break;
 
         const CInv &inv = *it;
+        // Blocks that are not in the cache are read and sent after cs_main is
+        // released, as they need no further access to the chainstate
+        CDiskBlockPos blockPos;
+        bool fCacheBlock = false;
+        bool fSendCmpct = false;
+        bool fPeerWantsWitness = false;
+        std::vector<CInv> vInvContinue;
         {
+            LOCK(cs_main);
             if (interruptMsgProc)
                 return;
 
@@ -1034,53 +1107,24 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        connman.PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block));
-                    else if (inv.type == MSG_WITNESS_BLOCK)
-                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
-                    else if (inv.type == MSG_FILTERED_BLOCK)
-                    {
-                        bool sendMerkleBlock = false;
-                        CMerkleBlock merkleBlock;
-                        {
-                            LOCK(pfrom->cs_filter);
-                            if (pfrom->pfilter) {
-                                sendMerkleBlock = true;
-                                merkleBlock = CMerkleBlock(block, *pfrom->pfilter);
-                            }
-                        }
-                        if (sendMerkleBlock) {
-                            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK, merkleBlock));
-                            // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
-                            // This avoids hurting performance by pointlessly requiring a round-trip
-                            // Note that there is currently no way for a node to request any single transactions we didn't send here -
-                            // they must either disconnect and retry or request the full block.
-                            // Thus, the protocol spec specified allows for us to provide duplicate txn here,
-                            // however we MUST always provide at least what the remote peer needs
-                            typedef std::pair<unsigned int, uint256> PairType;
-                            BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
-                                connman.PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, *block.vtx[pair.first]));
-                        }
-                        // else
-                            // no response
-                    }
-                    else if (inv.type == MSG_CMPCT_BLOCK)
-                    {
-                        // If a peer is asking for old blocks, we're almost guaranteed
-                        // they won't have a useful mempool to match against a compact block,
-                        // and we don't feel like constructing the object for them, so
-                        // instead we respond with the full, non-compact block.
-                        bool fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
-                        int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
-                        if (CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
-                            CBlockHeaderAndShortTxIDs cmpctblock(block, fPeerWantsWitness);
-                            connman.PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
-                        } else
-                            connman.PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, block));
+                    // Blocks near the tip are asked for by many peers at
+                    // once, so their payloads are shared through the cache
+                    bool fRecent = mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
+                    fPeerWantsWitness = inv.type == MSG_WITNESS_BLOCK || (inv.type == MSG_CMPCT_BLOCK && State(pfrom->GetId())->fWantsCmpctWitness);
+                    int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
+                    // If a peer is asking for old blocks, we're almost guaranteed
+                    // they won't have a useful mempool to match against a compact block,
+                    // and we don't feel like constructing the object for them, so
+                    // instead we respond with the full, non-compact block.
+                    fSendCmpct = inv.type == MSG_CMPCT_BLOCK && CanDirectFetch(consensusParams) && fRecent;
+                    const char* strCommand = fSendCmpct ? NetMsgType::CMPCTBLOCK : NetMsgType::BLOCK;
+
+                    CSharedBytes payload;
+                    if (inv.type != MSG_FILTERED_BLOCK && fRecent && blockMsgCache.Lookup(inv.hash, strCommand, nSendFlags, payload)) {
+                        connman.PushMessage(pfrom, msgMaker.MakeRaw(strCommand, std::move(payload)));
+                    } else {
+                        blockPos = mi->second->GetBlockPos();
+                        fCacheBlock = fRecent;
                     }
 
                     // Trigger the peer node to send a getblocks request for the next batch of inventory
@@ -1089,9 +1133,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                         // Bypass PushInventory, this must send even if redundant,
                         // and we want it right after the last block so they don't
                         // wait for other stuff first.
-                        std::vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
-                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::INV, vInv));
+                        vInvContinue.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
                         pfrom->hashContinue.SetNull();
                     }
                 }
@@ -1103,14 +1145,14 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 auto mi = mapRelay.find(inv.hash);
                 int nSendFlags = (inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0);
                 if (mi != mapRelay.end()) {
-                    connman.PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::TX, *mi->second));
+                    connman.PushMessage(pfrom, msgMaker.MakeRaw(NetMsgType::TX, txMsgCache.Get(inv.hash, NetMsgType::TX, nSendFlags, mi->second)));
                     push = true;
                 } else if (pfrom->timeLastMempoolReq) {
                     auto txinfo = mempool.info(inv.hash);
                     // To protect privacy, do not answer getdata using the mempool when
                     // that TX couldn't have been INVed in reply to a MEMPOOL request.
                     if (txinfo.tx && txinfo.nTime <= pfrom->timeLastMempoolReq) {
-                        connman.PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::TX, *txinfo.tx));
+                        connman.PushMessage(pfrom, msgMaker.MakeRaw(NetMsgType::TX, txMsgCache.Get(inv.hash, NetMsgType::TX, nSendFlags, txinfo.tx)));
                         push = true;
                     }
                 }
@@ -1121,10 +1163,66 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
 
             // Track requests for our stuff.
             GetMainSignals().Inventory(inv.hash);
+        }
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK || inv.type == MSG_WITNESS_BLOCK)
-                break;
+        if (!blockPos.IsNull() && inv.type == MSG_WITNESS_BLOCK) {
+            // Blocks are stored with witness data, so these can be sent as
+            // they are on disk, without deserializing. The block may have
+            // been pruned since cs_main was released.
+            CSharedBytes rawBlock;
+            if (ReadRawBlockFromDisk(rawBlock, blockPos, inv.hash, Params().MessageStart())) {
+                if (fCacheBlock)
+                    blockMsgCache.Insert(inv.hash, NetMsgType::BLOCK, 0, rawBlock);
+                connman.PushMessage(pfrom, msgMaker.MakeRaw(NetMsgType::BLOCK, std::move(rawBlock)));
+            } else
+                LogPrint("net", "%s: cannot read block %s for peer=%d\n", __func__, inv.hash.ToString(), pfrom->GetId());
+        } else if (!blockPos.IsNull()) {
+            CBlock block;
+            if (ReadBlockFromDisk(block, blockPos, consensusParams) && block.GetHash() == inv.hash) {
+                if (inv.type == MSG_FILTERED_BLOCK) {
+                    bool sendMerkleBlock = false;
+                    CMerkleBlock merkleBlock;
+                    {
+                        LOCK(pfrom->cs_filter);
+                        if (pfrom->pfilter) {
+                            sendMerkleBlock = true;
+                            merkleBlock = CMerkleBlock(block, *pfrom->pfilter);
+                        }
+                    }
+                    if (sendMerkleBlock) {
+                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK, merkleBlock));
+                        // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
+                        // This avoids hurting performance by pointlessly requiring a round-trip
+                        // Note that there is currently no way for a node to request any single transactions we didn't send here -
+                        // they must either disconnect and retry or request the full block.
+                        // Thus, the protocol spec specified allows for us to provide duplicate txn here,
+                        // however we MUST always provide at least what the remote peer needs
+                        typedef std::pair<unsigned int, uint256> PairType;
+                        BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
+                            connman.PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, *block.vtx[pair.first]));
+                    }
+                    // else
+                        // no response
+                } else {
+                    int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
+                    const char* strCommand = fSendCmpct ? NetMsgType::CMPCTBLOCK : NetMsgType::BLOCK;
+                    CSharedBytes payload;
+                    if (fSendCmpct)
+                        payload = CNetMsgCache::Serialize(nSendFlags, CBlockHeaderAndShortTxIDs(block, fPeerWantsWitness));
+                    else
+                        payload = CNetMsgCache::Serialize(nSendFlags, block);
+                    if (fCacheBlock)
+                        blockMsgCache.Insert(inv.hash, strCommand, nSendFlags, payload);
+                    connman.PushMessage(pfrom, msgMaker.MakeRaw(strCommand, std::move(payload)));
+                }
+            } else
+                LogPrint("net", "%s: cannot read block %s for peer=%d\n", __func__, inv.hash.ToString(), pfrom->GetId());
         }
+        if (!vInvContinue.empty())
+            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::INV, vInvContinue));
+
+        if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK || inv.type == MSG_WITNESS_BLOCK)
+            break;
     }
 
     pfrom->vRecvGetData.erase(pfrom->vRecvGetData.begin(), it);
@@ -2008,7 +2106,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator blockInFlightIt = mapBlocksInFlight.find(pindex->GetBlockHash());
         bool fAlreadyInFlight = blockInFlightIt != mapBlocksInFlight.end();
 
-        if (pindex->nStatus & BLOCK_HAVE_DATA) // Nothing to do here
+        if (pindex->nStatus & BLOCK_HAVE_DATA || setBlocksQueued.count(pindex->GetBlockHash())) // Nothing to do here
             return true;
 
         if (pindex->nChainWork <= chainActive.Tip()->nChainWork || // We know something better
@@ -2321,6 +2419,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             while (pindexWalk && !chainActive.Contains(pindexWalk) && vToFetch.size() <= MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
                 if (!(pindexWalk->nStatus & BLOCK_HAVE_DATA) &&
                         !mapBlocksInFlight.count(pindexWalk->GetBlockHash()) &&
+                        !setBlocksQueued.count(pindexWalk->GetBlockHash()) &&
                         (!IsWitnessEnabled(pindexWalk->pprev, chainparams.GetConsensus()) || State(pfrom->GetId())->fHaveWitness)) {
                     // We don't have this block, and it's not yet in flight.
                     vToFetch.push_back(pindexWalk);
@@ -2382,15 +2481,55 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             LOCK(cs_main);
             // Also always process if we requested the block explicitly, as we may
             // need it even though it is not a candidate for a new best tip.
-            forceProcessing |= MarkBlockAsReceived(hash);
+            UpdateBlockDeliveryRate(pfrom->GetId(), hash);
+            forceProcessing |= mapBlocksInFlight.count(hash) > 0;
             // mapBlockSource is only used for sending reject messages and DoS scores,
             // so the race between here and cs_main in ProcessNewBlock is fine.
             mapBlockSource.emplace(hash, std::make_pair(pfrom->GetId(), true));
         }
-        bool fNewBlock = false;
-        ProcessNewBlock(chainparams, pblock, forceProcessing, &fNewBlock);
-        if (fNewBlock)
-            pfrom->nLastBlockTime = GetTime();
+        // During initial sync, leave checking and connecting the block to the
+        // block pipeline and get back to receiving. The block is no longer in
+        // flight from this peer, but is kept from being requested again while
+        // it waits in the queue.
+        const NodeId nodeid = pfrom->GetId();
+        CConnman* pconnman = &connman;
+        bool fQueued = false;
+        if (IsInitialBlockDownload()) {
+            {
+                LOCK(cs_main);
+                MarkBlockAsReceived(hash);
+                fQueued = setBlocksQueued.insert(hash).second;
+            }
+            // A copy of the block that is still queued is left to that one
+            if (!fQueued)
+                return true;
+            fQueued = QueueNewBlock(pblock, forceProcessing, [hash, nodeid, pconnman](bool fNewBlock) {
+                {
+                    LOCK(cs_main);
+                    setBlocksQueued.erase(hash);
+                }
+                if (fNewBlock) {
+                    pconnman->ForNode(nodeid, [](CNode* pnode) {
+                        pnode->nLastBlockTime = GetTime();
+                        return true;
+                    });
+                }
+            });
+            if (!fQueued) {
+                LOCK(cs_main);
+                setBlocksQueued.erase(hash);
+            }
+        }
+        if (!fQueued) {
+            {
+                LOCK(cs_main);
+                MarkBlockAsReceived(hash);
+            }
+            bool fNewBlock = false;
+            ProcessNewBlock(chainparams, pblock, forceProcessing, &fNewBlock);
+            if (fNewBlock)
+                pfrom->nLastBlockTime = GetTime();
+        }
     }
 
 
@@ -2414,7 +2553,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_addrSend);
+            pfrom->vAddrToSend.clear();
+        }
         std::vector<CAddress> vAddr = connman.GetAddresses();
         FastRandomContext insecure_rand;
         BOOST_FOREACH(const CAddress &addr, vAddr)
@@ -2636,6 +2778,24 @@ static bool SendRejectsAndCheckIfBanned(CNode* pnode, CConnman& connman)
     return false;
 }
 
+/**
+ * Messages that are handled without cs_main, or take it only to punish the
+ * peer. Rejects and bans after these are left to SendMessages, so that peers
+ * sending them are not held up by others that are busy with the chainstate.
+ */
+static bool IsLockFreeCommand(const std::string& strCommand)
+{
+    return strCommand == NetMsgType::PING ||
+           strCommand == NetMsgType::PONG ||
+           strCommand == NetMsgType::ADDR ||
+           strCommand == NetMsgType::GETADDR ||
+           strCommand == NetMsgType::FEEFILTER ||
+           strCommand == NetMsgType::FILTERLOAD ||
+           strCommand == NetMsgType::FILTERADD ||
+           strCommand == NetMsgType::FILTERCLEAR ||
+           strCommand == NetMsgType::GETDATA;
+}
+
 bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
 {
     const CChainParams& chainparams = Params();
@@ -2750,8 +2910,10 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
             LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
         }
 
-        LOCK(cs_main);
-        SendRejectsAndCheckIfBanned(pfrom, connman);
+        if (!IsLockFreeCommand(strCommand)) {
+            LOCK(cs_main);
+            SendRejectsAndCheckIfBanned(pfrom, connman);
+        }
 
     return fMoreWork;
 }
@@ -2833,6 +2995,7 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         //
         if (pto->nNextAddrSend < nNow) {
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
+            LOCK(pto->cs_addrSend);
             std::vector<CAddress> vAddr;
             vAddr.reserve(pto->vAddrToSend.size());
             BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
@@ -2969,12 +3132,15 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                     {
                         LOCK(cs_most_recent_block);
                         if (most_recent_block_hash == pBestIndex->GetBlockHash()) {
-                            if (state.fWantsCmpctWitness)
-                                connman.PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *most_recent_compact_block));
-                            else {
-                                CBlockHeaderAndShortTxIDs cmpctblock(*most_recent_block, state.fWantsCmpctWitness);
-                                connman.PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
+                            CSharedBytes payload;
+                            if (!blockMsgCache.Lookup(most_recent_block_hash, NetMsgType::CMPCTBLOCK, nSendFlags, payload)) {
+                                if (state.fWantsCmpctWitness)
+                                    payload = CNetMsgCache::Serialize(nSendFlags, *most_recent_compact_block);
+                                else
+                                    payload = CNetMsgCache::Serialize(nSendFlags, CBlockHeaderAndShortTxIDs(*most_recent_block, state.fWantsCmpctWitness));
+                                blockMsgCache.Insert(most_recent_block_hash, NetMsgType::CMPCTBLOCK, nSendFlags, payload);
                             }
+                            connman.PushMessage(pto, msgMaker.MakeRaw(NetMsgType::CMPCTBLOCK, std::move(payload)));
                             fGotBlockFromCache = true;
                         }
                     }
@@ -3193,10 +3359,11 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         // Message: getdata (blocks)
         //
         std::vector<CInv> vGetData;
-        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < state.nMaxBlocksInFlight) {
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            const CBlockIndex* pindexStalled = NULL;
+            FindNextBlocksToDownload(pto->GetId(), state.nMaxBlocksInFlight - state.nBlocksInFlight, vToDownload, staller, pindexStalled, consensusParams);
             BOOST_FOREACH(const CBlockIndex *pindex, vToDownload) {
                 uint32_t nFetchFlags = GetFetchFlags(pto, pindex->pprev, consensusParams);
                 vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
@@ -3204,6 +3371,24 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                 LogPrint("net", "Requesting block %s (%d) peer=%d\n", pindex->GetBlockHash().ToString(),
                     pindex->nHeight, pto->id);
             }
+            if (staller != -1 && pindexStalled != NULL) {
+                // Ask this peer for the block that holds up the download window if it
+                // delivers faster, and the block is overdue at the rate of the peer it
+                // is in flight from, rather than waiting for that peer to time out.
+                CNodeState *stateStaller = State(staller);
+                std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itStalled = mapBlocksInFlight.find(pindexStalled->GetBlockHash());
+                if (itStalled != mapBlocksInFlight.end() && itStalled->second.first == staller &&
+                        ShouldReassignBlock(nNow, itStalled->second.second->nTimeRequested, state.nBlockDeliveryTime, stateStaller->nBlockDeliveryTime)) {
+                    LogPrint("net", "Reassigning block %s (%d) from peer=%d to faster peer=%d\n", pindexStalled->GetBlockHash().ToString(),
+                        pindexStalled->nHeight, staller, pto->id);
+                    uint32_t nFetchFlags = GetFetchFlags(pto, pindexStalled->pprev, consensusParams);
+                    vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindexStalled->GetBlockHash()));
+                    MarkBlockAsInFlight(pto->GetId(), pindexStalled->GetBlockHash(), consensusParams, pindexStalled);
+                    // Give the slow peer less to hold up in the future
+                    stateStaller->nMaxBlocksInFlight = std::max(MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, stateStaller->nMaxBlocksInFlight / 2);
+                    staller = -1;
+                }
+            }
             if (state.nBlocksInFlight == 0 && staller != -1) {
                 if (State(staller)->nStallingSince == 0) {
                     State(staller)->nStallingSince = nNow;
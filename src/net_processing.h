@@ -17,6 +17,10 @@ static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
 static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
 /** Default number of orphan+recently-replaced txn to keep around for block reconstruction */
 static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
+/** Bytes of serialized recent blocks and compact blocks kept to send to more peers */
+static const size_t MAX_BLOCK_MSG_CACHE_BYTES = 16 * 1000 * 1000;
+/** Bytes of serialized relayed transactions kept to send to more peers */
+static const size_t MAX_TX_MSG_CACHE_BYTES = 4 * 1000 * 1000;
 
 /** Register with a network node to receive its signals */
 void RegisterNodeSignals(CNodeSignals& nodeSignals);
@@ -41,8 +45,24 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int nMaxBlocksInFlight;
+    int64_t nBlockDeliveryTime;
 };
 
+/**
+ * Moving average of the time in microseconds a peer takes per block, after
+ * it delivered one in nTime. nBlockDeliveryTime is 0 before the first block.
+ */
+int64_t UpdateBlockDeliveryTime(int64_t nBlockDeliveryTime, int64_t nTime);
+/** How many blocks may be in flight from a peer that takes nBlockDeliveryTime per block */
+int GetBlockDownloadWindow(int64_t nBlockDeliveryTime);
+/**
+ * Whether a block that holds up the download window, requested at
+ * nTimeRequested from a peer taking nStallerBlockDeliveryTime per block
+ * (0 if unknown), should be asked from a peer taking nBlockDeliveryTime.
+ */
+bool ShouldReassignBlock(int64_t nNow, int64_t nTimeRequested, int64_t nBlockDeliveryTime, int64_t nStallerBlockDeliveryTime);
+
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 /** Increase a node's misbehavior score. */
@@ -29,6 +29,15 @@ public:
         return Make(0, std::move(sCommand), std::forward<Args>(args)...);
     }
 
+    //! Wrap an already serialized payload, which is sent without being copied
+    CSerializedNetMsg MakeRaw(std::string sCommand, CSharedBytes payload) const
+    {
+        CSerializedNetMsg msg;
+        msg.command = std::move(sCommand);
+        msg.rawData = std::move(payload);
+        return msg;
+    }
+
 private:
     const int nVersion;
 };
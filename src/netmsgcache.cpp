@@ -0,0 +1,62 @@
+// Copyright (c) 2009-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "netmsgcache.h"
+
+bool CNetMsgCache::Lookup(const uint256& hash, const std::string& strCommand, int nFlags, CSharedBytes& payload, const void* source) const
+{
+    LOCK(cs);
+    std::map<Key, Entry>::const_iterator it = mapEntries.find(Key(hash, strCommand, nFlags));
+    if (it == mapEntries.end())
+        return false;
+    if (source && it->second.source.get() != source)
+        return false;
+    payload = it->second.payload;
+    return true;
+}
+
+void CNetMsgCache::Insert(const uint256& hash, const std::string& strCommand, int nFlags, const CSharedBytes& payload, std::shared_ptr<const void> source)
+{
+    LOCK(cs);
+    Key key(hash, strCommand, nFlags);
+    std::map<Key, Entry>::iterator it = mapEntries.find(key);
+    if (it != mapEntries.end()) {
+        // The key keeps its place in queueKeys
+        nBytes -= it->second.payload.size();
+    } else {
+        it = mapEntries.insert(std::make_pair(key, Entry())).first;
+        queueKeys.push_back(key);
+    }
+    it->second.payload = payload;
+    it->second.source = std::move(source);
+    nBytes += payload.size();
+
+    // Drop the oldest payloads, but always keep the newest one
+    while (nBytes > nMaxBytes && queueKeys.size() > 1) {
+        std::map<Key, Entry>::iterator itOld = mapEntries.find(queueKeys.front());
+        nBytes -= itOld->second.payload.size();
+        mapEntries.erase(itOld);
+        queueKeys.pop_front();
+    }
+}
+
+size_t CNetMsgCache::Size() const
+{
+    LOCK(cs);
+    return mapEntries.size();
+}
+
+size_t CNetMsgCache::Bytes() const
+{
+    LOCK(cs);
+    return nBytes;
+}
+
+void CNetMsgCache::Clear()
+{
+    LOCK(cs);
+    mapEntries.clear();
+    queueKeys.clear();
+    nBytes = 0;
+}
@@ -0,0 +1,108 @@
+// Copyright (c) 2009-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NETMSGCACHE_H
+#define BITCOIN_NETMSGCACHE_H
+
+#include "serialize.h"
+#include "sharedbytes.h"
+#include "streams.h"
+#include "sync.h"
+#include "uint256.h"
+#include "version.h"
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+/**
+ * Serialized payloads of messages that are sent to many peers, such as
+ * new blocks and relayed transactions. A payload is serialized once, and the
+ * send queues of all peers share the same immutable bytes.
+ *
+ * Entries are keyed by (hash, command, serialization flags). The oldest
+ * entries are dropped once the payloads take more than the byte limit, but
+ * payloads that are still queued for a peer stay alive until they are sent.
+ */
+class CNetMsgCache
+{
+private:
+    typedef std::tuple<uint256, std::string, int> Key;
+
+    struct Entry
+    {
+        CSharedBytes payload;
+        //! The object the payload was serialized from, if it has to be matched
+        std::shared_ptr<const void> source;
+    };
+
+    mutable CCriticalSection cs;
+    std::map<Key, Entry> mapEntries;
+    //! Keys in order of insertion, oldest first
+    std::deque<Key> queueKeys;
+    size_t nBytes;
+    const size_t nMaxBytes;
+
+public:
+    explicit CNetMsgCache(size_t nMaxBytesIn) : nBytes(0), nMaxBytes(nMaxBytesIn) {}
+
+    /**
+     * Find the payload of a message. If source is given, only a payload
+     * serialized from that very object is returned; this tells apart
+     * objects with equal hashes but different serializations, such as
+     * transactions with different witnesses.
+     */
+    bool Lookup(const uint256& hash, const std::string& strCommand, int nFlags, CSharedBytes& payload, const void* source = NULL) const;
+
+    //! Store the payload of a message, replacing any previous one
+    void Insert(const uint256& hash, const std::string& strCommand, int nFlags, const CSharedBytes& payload, std::shared_ptr<const void> source = nullptr);
+
+    //! Serialize obj the way CNetMsgMaker would for any peer, into shareable bytes
+    template <typename T>
+    static CSharedBytes Serialize(int nFlags, const T& obj)
+    {
+        std::vector<unsigned char> vch;
+        CVectorWriter{SER_NETWORK, nFlags | PROTOCOL_VERSION, vch, 0, obj};
+        return CSharedBytes(std::move(vch));
+    }
+
+    /**
+     * Return the cached payload of a message, serializing obj first if it
+     * is missing. Only for objects whose encoding does not depend on the
+     * protocol version of the peer, beyond nFlags.
+     */
+    template <typename T>
+    CSharedBytes Get(const uint256& hash, const std::string& strCommand, int nFlags, const T& obj)
+    {
+        CSharedBytes payload;
+        if (!Lookup(hash, strCommand, nFlags, payload)) {
+            payload = Serialize(nFlags, obj);
+            Insert(hash, strCommand, nFlags, payload);
+        }
+        return payload;
+    }
+
+    //! Same as above, for an object that is matched by identity as well
+    template <typename T>
+    CSharedBytes Get(const uint256& hash, const std::string& strCommand, int nFlags, const std::shared_ptr<const T>& pobj)
+    {
+        CSharedBytes payload;
+        if (!Lookup(hash, strCommand, nFlags, payload, pobj.get())) {
+            payload = Serialize(nFlags, *pobj);
+            Insert(hash, strCommand, nFlags, payload, pobj);
+        }
+        return payload;
+    }
+
+    //! Number of cached payloads
+    size_t Size() const;
+    //! Total size of the cached payloads
+    size_t Bytes() const;
+    void Clear();
+};
+
+#endif // BITCOIN_NETMSGCACHE_H
@@ -0,0 +1,216 @@
+// Copyright (c) 2009-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "netpoller.h"
+
+#include "netbase.h"
+#include "util.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <string.h>
+
+#include <boost/foreach.hpp>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+namespace {
+
+/** Rebuilds the fd_sets for every call, and cannot watch sockets from FD_SETSIZE on */
+class CSelectSocketPoller : public CSocketPoller
+{
+public:
+    std::string GetName() const { return "select"; }
+
+    bool IsWatchable(SOCKET hSocket) const { return IsSelectableSocket(hSocket); }
+
+    bool Wait(const std::vector<SocketWatch>& vWatch, int nTimeoutMs, ReadySockets& vReady)
+    {
+        vReady.clear();
+
+        struct timeval timeout;
+        timeout.tv_sec  = nTimeoutMs / 1000;
+        timeout.tv_usec = (nTimeoutMs % 1000) * 1000;
+
+        fd_set fdsetRecv;
+        fd_set fdsetSend;
+        fd_set fdsetError;
+        FD_ZERO(&fdsetRecv);
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        SOCKET hSocketMax = 0;
+        bool have_fds = false;
+
+        BOOST_FOREACH(const SocketWatch& watch, vWatch) {
+            if (!IsWatchable(watch.hSocket))
+                continue;
+            FD_SET(watch.hSocket, &fdsetError);
+            if (watch.nEvents & SOCKET_RECV)
+                FD_SET(watch.hSocket, &fdsetRecv);
+            if (watch.nEvents & SOCKET_SEND)
+                FD_SET(watch.hSocket, &fdsetSend);
+            hSocketMax = std::max(hSocketMax, watch.hSocket);
+            have_fds = true;
+        }
+
+        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        if (nSelect == SOCKET_ERROR)
+            return false;
+        if (nSelect == 0)
+            return true;
+
+        BOOST_FOREACH(const SocketWatch& watch, vWatch) {
+            if (!IsWatchable(watch.hSocket))
+                continue;
+            int nEvents = 0;
+            if (FD_ISSET(watch.hSocket, &fdsetRecv))
+                nEvents |= SOCKET_RECV;
+            if (FD_ISSET(watch.hSocket, &fdsetSend))
+                nEvents |= SOCKET_SEND;
+            if (FD_ISSET(watch.hSocket, &fdsetError))
+                nEvents |= SOCKET_ERR;
+            if (nEvents)
+                vReady.push_back(std::make_pair(watch.hSocket, nEvents));
+        }
+        return true;
+    }
+};
+
+#ifdef HAVE_SYS_EPOLL_H
+/**
+ * Keeps the sockets registered with the kernel between calls, and only
+ * updates the registration of sockets whose events changed. Waiting costs
+ * time in the number of ready sockets rather than in all of them.
+ */
+class CEpollSocketPoller : public CSocketPoller
+{
+private:
+    struct WatchState
+    {
+        int64_t nOwner;
+        int nEvents;
+        //! Last call to Wait that listed the socket
+        uint64_t nLastSeen;
+    };
+
+    int epollfd;
+    //! Every socket registered with the kernel
+    std::unordered_map<SOCKET, WatchState> mapWatched;
+    uint64_t nWaitCount;
+    std::vector<struct epoll_event> vEvents;
+
+    bool Control(int op, SOCKET hSocket, int nEvents)
+    {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        if (nEvents & SOCKET_RECV)
+            ev.events |= EPOLLIN;
+        if (nEvents & SOCKET_SEND)
+            ev.events |= EPOLLOUT;
+        ev.data.fd = hSocket;
+        return epoll_ctl(epollfd, op, hSocket, &ev) == 0;
+    }
+
+public:
+    CEpollSocketPoller(int epollfdIn) : epollfd(epollfdIn), nWaitCount(0) {}
+    ~CEpollSocketPoller() { close(epollfd); }
+
+    std::string GetName() const { return "epoll"; }
+
+    bool IsWatchable(SOCKET hSocket) const { return hSocket != INVALID_SOCKET; }
+
+    bool Wait(const std::vector<SocketWatch>& vWatch, int nTimeoutMs, ReadySockets& vReady)
+    {
+        vReady.clear();
+        nWaitCount++;
+        size_t nListed = 0;
+
+        BOOST_FOREACH(const SocketWatch& watch, vWatch) {
+            std::unordered_map<SOCKET, WatchState>::iterator it = mapWatched.find(watch.hSocket);
+            if (it != mapWatched.end() && it->second.nOwner == watch.nOwner && it->second.nEvents == watch.nEvents) {
+                it->second.nLastSeen = nWaitCount;
+                nListed++;
+                continue;
+            }
+            // A closed socket leaves the kernel's list by itself, so a
+            // descriptor that was reused by a new owner has to be added again
+            bool fRegistered = it != mapWatched.end() && it->second.nOwner == watch.nOwner;
+            bool fResult = Control(fRegistered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, watch.hSocket, watch.nEvents);
+            if (!fResult && errno == (fRegistered ? ENOENT : EEXIST))
+                fResult = Control(fRegistered ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, watch.hSocket, watch.nEvents);
+            if (!fResult) {
+                LogPrint("net", "%s: cannot watch socket %d: %s\n", __func__, watch.hSocket, NetworkErrorString(errno));
+                if (it != mapWatched.end())
+                    mapWatched.erase(it);
+                continue;
+            }
+            WatchState& state = mapWatched[watch.hSocket];
+            state.nOwner = watch.nOwner;
+            state.nEvents = watch.nEvents;
+            state.nLastSeen = nWaitCount;
+            nListed++;
+        }
+        if (mapWatched.size() > nListed) {
+            for (std::unordered_map<SOCKET, WatchState>::iterator it = mapWatched.begin(); it != mapWatched.end(); ) {
+                if (it->second.nLastSeen == nWaitCount) {
+                    ++it;
+                    continue;
+                }
+                // Fails for sockets that were closed already, which is fine
+                epoll_ctl(epollfd, EPOLL_CTL_DEL, it->first, NULL);
+                it = mapWatched.erase(it);
+            }
+        }
+
+        vEvents.resize(std::max(mapWatched.size(), size_t(1)));
+        int nReady = epoll_wait(epollfd, vEvents.data(), vEvents.size(), nTimeoutMs);
+        if (nReady < 0)
+            return errno == EINTR;
+
+        for (int i = 0; i < nReady; i++) {
+            int nEvents = 0;
+            if (vEvents[i].events & EPOLLIN)
+                nEvents |= SOCKET_RECV;
+            if (vEvents[i].events & EPOLLOUT)
+                nEvents |= SOCKET_SEND;
+            if (vEvents[i].events & (EPOLLERR | EPOLLHUP))
+                nEvents |= SOCKET_ERR;
+            SOCKET hSocket = vEvents[i].data.fd;
+            vReady.push_back(std::make_pair(hSocket, nEvents));
+        }
+        return true;
+    }
+};
+#endif
+
+} // anon namespace
+
+std::unique_ptr<CSocketPoller> CreateSocketPoller(const std::string& strBackend)
+{
+    if (strBackend == "select")
+        return std::unique_ptr<CSocketPoller>(new CSelectSocketPoller());
+#ifdef HAVE_SYS_EPOLL_H
+    if (strBackend == "epoll") {
+        int epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollfd < 0) {
+            LogPrintf("%s: epoll_create1 failed: %s\n", __func__, NetworkErrorString(errno));
+            return std::unique_ptr<CSocketPoller>();
+        }
+        return std::unique_ptr<CSocketPoller>(new CEpollSocketPoller(epollfd));
+    }
+#endif
+    return std::unique_ptr<CSocketPoller>();
+}
+
+std::string GetSocketBackendNames()
+{
+#ifdef HAVE_SYS_EPOLL_H
+    return "epoll, select";
+#else
+    return "select";
+#endif
+}
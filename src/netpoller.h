@@ -0,0 +1,77 @@
+// Copyright (c) 2009-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NETPOLLER_H
+#define BITCOIN_NETPOLLER_H
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "compat.h"
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef HAVE_SYS_EPOLL_H
+static const char* const DEFAULT_SOCKETBACKEND = "epoll";
+#else
+static const char* const DEFAULT_SOCKETBACKEND = "select";
+#endif
+
+/** Readiness events to wait for on a socket */
+enum SocketEvent
+{
+    SOCKET_RECV = (1 << 0),
+    SOCKET_SEND = (1 << 1),
+    //! Always reported, whether it was asked for or not
+    SOCKET_ERR  = (1 << 2),
+};
+
+/** A socket to wait on, and the events to wait for */
+struct SocketWatch
+{
+    SOCKET hSocket;
+    //! Identifies the user of the socket, so a reused descriptor is noticed
+    int64_t nOwner;
+    int nEvents;
+
+    SocketWatch(SOCKET hSocketIn, int64_t nOwnerIn, int nEventsIn) : hSocket(hSocketIn), nOwner(nOwnerIn), nEvents(nEventsIn) {}
+};
+
+/**
+ * Waits until sockets are ready for reading or writing, using one of the
+ * mechanisms the system offers.
+ */
+class CSocketPoller
+{
+public:
+    typedef std::vector<std::pair<SOCKET, int> > ReadySockets;
+
+    virtual ~CSocketPoller() {}
+
+    virtual std::string GetName() const = 0;
+
+    //! Whether hSocket can be waited on at all
+    virtual bool IsWatchable(SOCKET hSocket) const = 0;
+
+    /**
+     * Wait up to nTimeoutMs milliseconds for any of the sockets in vWatch to
+     * become ready, and return the ready ones with their events in vReady.
+     * vWatch lists all sockets of interest; sockets missing from it are no
+     * longer waited on. Returns false if waiting failed.
+     */
+    virtual bool Wait(const std::vector<SocketWatch>& vWatch, int nTimeoutMs, ReadySockets& vReady) = 0;
+};
+
+/** Create a poller using the named backend, or nothing if it is not available */
+std::unique_ptr<CSocketPoller> CreateSocketPoller(const std::string& strBackend);
+
+/** Names of the backends available on this system, for help messages */
+std::string GetSocketBackendNames();
+
+#endif // BITCOIN_NETPOLLER_H
@@ -23,6 +23,21 @@ uint256 CBlockHeader::GetPoWHash() const
     return thash;
 }
 
+std::vector<uint256> GetPoWHashes(const std::vector<CBlockHeader>& headers)
+{
+    std::vector<uint256> vHash(headers.size());
+    if (headers.empty())
+        return vHash;
+    std::vector<char> vInput(80 * headers.size());
+    std::vector<char> vOutput(32 * headers.size());
+    for (size_t i = 0; i < headers.size(); i++)
+        memcpy(&vInput[80 * i], BEGIN(headers[i].nVersion), 80);
+    scrypt_1024_1_1_256_multi(&vInput[0], &vOutput[0], headers.size());
+    for (size_t i = 0; i < headers.size(); i++)
+        memcpy(vHash[i].begin(), &vOutput[32 * i], 32);
+    return vHash;
+}
+
 std::string CBlock::ToString() const
 {
     std::stringstream s;
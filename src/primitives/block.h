@@ -163,6 +163,12 @@ struct CBlockLocator
     }
 };
 
+/**
+ * Compute the scrypt PoW hashes of several headers at once, using the
+ * multi-lane scrypt kernel when one is available.
+ */
+std::vector<uint256> GetPoWHashes(const std::vector<CBlockHeader>& headers);
+
 /** Compute the consensus-critical block weight (see BIP 141). */
 int64_t GetBlockWeight(const CBlock& tx);
 
@@ -5,6 +5,7 @@
 #include "pubkey.h"
 
 #include <secp256k1.h>
+#include <secp256k1_batch.h>
 #include <secp256k1_recovery.h>
 
 namespace
@@ -184,6 +185,46 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
     return secp256k1_ecdsa_verify(secp256k1_context_verify, &sig, hash.begin(), &pubkey);
 }
 
+bool CSignatureBatch::Add(const CPubKey& pubkey, const uint256& hash, const std::vector<unsigned char>& vchSig) {
+    static_assert(sizeof(secp256k1_ecdsa_signature) == sizeof(Entry().sig), "unexpected signature size");
+    static_assert(sizeof(secp256k1_pubkey) == sizeof(Entry().pubkey), "unexpected public key size");
+    if (!pubkey.IsValid() || vchSig.size() == 0)
+        return false;
+    Entry entry;
+    secp256k1_ecdsa_signature sig;
+    // Inputs spent together often share a key, so reuse the previous parse
+    if (!lastPubKey.IsValid() || pubkey != lastPubKey) {
+        secp256k1_pubkey parsed;
+        if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &parsed, &pubkey[0], pubkey.size()))
+            return false;
+        memcpy(lastParsed, &parsed, sizeof(lastParsed));
+        lastPubKey = pubkey;
+    }
+    memcpy(entry.pubkey, lastParsed, sizeof(entry.pubkey));
+    if (!ecdsa_signature_parse_der_lax(secp256k1_context_verify, &sig, &vchSig[0], vchSig.size()))
+        return false;
+    secp256k1_ecdsa_signature_normalize(secp256k1_context_verify, &sig, &sig);
+    memcpy(entry.sig, &sig, sizeof(entry.sig));
+    entry.hash = hash;
+    vEntries.push_back(entry);
+    return true;
+}
+
+bool CSignatureBatch::Verify(std::vector<bool>& vResult) const {
+    std::vector<const secp256k1_ecdsa_signature*> vSigs(vEntries.size());
+    std::vector<const unsigned char*> vMsgs(vEntries.size());
+    std::vector<const secp256k1_pubkey*> vPubKeys(vEntries.size());
+    for (size_t i = 0; i < vEntries.size(); i++) {
+        vSigs[i] = (const secp256k1_ecdsa_signature*)vEntries[i].sig;
+        vMsgs[i] = vEntries[i].hash.begin();
+        vPubKeys[i] = (const secp256k1_pubkey*)vEntries[i].pubkey;
+    }
+    std::vector<int> vValid(vEntries.size());
+    bool fAllValid = secp256k1_ecdsa_verify_batch(secp256k1_context_verify, vValid.data(), vSigs.data(), vMsgs.data(), vPubKeys.data(), vEntries.size());
+    vResult.assign(vValid.begin(), vValid.end());
+    return fAllValid;
+}
+
 bool CPubKey::RecoverCompact(const uint256 &hash, const std::vector<unsigned char>& vchSig) {
     if (vchSig.size() != 65)
         return false;
@@ -10,6 +10,7 @@
 #include "serialize.h"
 #include "uint256.h"
 
+#include <algorithm>
 #include <stdexcept>
 #include <vector>
 
@@ -190,6 +191,49 @@ public:
     bool Derive(CPubKey& pubkeyChild, ChainCode &ccChild, unsigned int nChild, const ChainCode& cc) const;
 };
 
+/**
+ * ECDSA signatures gathered to be verified together, which shares the
+ * modular inversions of their s values. Keys and signatures are parsed as
+ * they are added, so only the elliptic curve work is deferred, and the
+ * result for each signature is the same as CPubKey::Verify would give.
+ */
+class CSignatureBatch
+{
+private:
+    //! Parsed signature, key and message, in libsecp256k1's formats
+    struct Entry
+    {
+        unsigned char sig[64];
+        unsigned char pubkey[64];
+        uint256 hash;
+    };
+
+    std::vector<Entry> vEntries;
+
+    //! The key added last, and its parsed form
+    CPubKey lastPubKey;
+    unsigned char lastParsed[64];
+
+public:
+    /**
+     * Queue a signature for verification. Returns false, without queueing
+     * it, if the key or the signature cannot be parsed, which makes the
+     * signature invalid.
+     */
+    bool Add(const CPubKey& pubkey, const uint256& hash, const std::vector<unsigned char>& vchSig);
+
+    /**
+     * Verify the queued signatures. vResult receives whether each of them is
+     * valid, in the order they were added. Returns whether all of them are.
+     */
+    bool Verify(std::vector<bool>& vResult) const;
+
+    size_t size() const { return vEntries.size(); }
+    //! Forget the signatures added after the first n
+    void resize(size_t n) { vEntries.resize(std::min(n, vEntries.size())); }
+    void clear() { vEntries.clear(); }
+};
+
 struct CExtPubKey {
     unsigned char nDepth;
     unsigned char vchFingerprint[4];
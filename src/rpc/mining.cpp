@@ -11,6 +11,7 @@
 #include "consensus/params.h"
 #include "consensus/validation.h"
 #include "core_io.h"
+#include "crypto/scrypt.h"
 #include "hash.h"
 #include "init.h"
 #include "miner.h"
@@ -98,6 +99,34 @@ UniValue getnetworkhashps(const JSONRPCRequest& request)
     return GetNetworkHashPS(request.params.size() > 0 ? request.params[0].get_int() : 120, request.params.size() > 1 ? request.params[1].get_int() : -1);
 }
 
+/**
+ * Search nonces from pblock->nNonce upwards until the header meets its target,
+ * nMaxTries runs out or nInnerLoopCount is reached. Consecutive nonces are
+ * hashed together with the multi-lane scrypt kernel; on return nNonce and
+ * nMaxTries are exactly as if every nonce had been tried one at a time.
+ */
+static void ScanNonces(CBlock* pblock, uint64_t& nMaxTries, unsigned int nInnerLoopCount)
+{
+    const unsigned int nWays = scrypt_multi_ways();
+    std::vector<CBlockHeader> vHeaders;
+    while (nMaxTries > 0 && pblock->nNonce < nInnerLoopCount) {
+        unsigned int nBatch = std::min<uint64_t>(std::min(nWays, nInnerLoopCount - pblock->nNonce), nMaxTries);
+        vHeaders.assign(nBatch, pblock->GetBlockHeader());
+        for (unsigned int i = 0; i < nBatch; i++)
+            vHeaders[i].nNonce += i;
+        std::vector<uint256> vHashPoW = GetPoWHashes(vHeaders);
+        for (unsigned int i = 0; i < nBatch; i++) {
+            if (CheckProofOfWork(vHashPoW[i], pblock->nBits, Params().GetConsensus())) {
+                pblock->nNonce += i;
+                nMaxTries -= i;
+                return;
+            }
+        }
+        pblock->nNonce += nBatch;
+        nMaxTries -= nBatch;
+    }
+}
+
 UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nGenerate, uint64_t nMaxTries, bool keepScript)
 {
     static const int nInnerLoopCount = 0x10000;
@@ -155,10 +184,7 @@ UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nG
                 throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Miner key");
             }
 
-            while (nMaxTries > 0 && pblock->nNonce < nInnerLoopCount && !CheckProofOfWork(pblock->GetPoWHash(), pblock->nBits, Params().GetConsensus())) {
-                ++pblock->nNonce;
-                --nMaxTries;
-            }
+            ScanNonces(pblock, nMaxTries, nInnerLoopCount);
 
             //sign
             CHashWriter ss(SER_GETHASH, 0);
@@ -178,10 +204,7 @@ UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nG
 
         ///////////////////////////////
         else {
-            while (nMaxTries > 0 && pblock->nNonce < nInnerLoopCount && !CheckProofOfWork(pblock->GetPoWHash(), pblock->nBits, Params().GetConsensus())) {
-                ++pblock->nNonce;
-                --nMaxTries;
-            }
+            ScanNonces(pblock, nMaxTries, nInnerLoopCount);
         }
         if (nMaxTries == 0) {
             break;
@@ -585,13 +608,12 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
 
     // Update block
     static CBlockIndex* pindexPrev;
-    static int64_t nStart;
     static std::unique_ptr<CBlockTemplate> pblocktemplate;
     // Cache whether the last invocation was with segwit support, to avoid returning
     // a segwit-block to a non-segwit caller.
     static bool fLastTemplateSupportsSegwit = true;
     if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5) ||
+        mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast ||
         fLastTemplateSupportsSegwit != fSupportsSegwit)
     {
         // Clear pindexPrev so future calls make a new block, despite any failures from here on
@@ -600,12 +622,12 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
         // Store the pindexBest used before CreateNewBlock, to avoid races
         nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
         CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
         fLastTemplateSupportsSegwit = fSupportsSegwit;
 
-        // Create new block
+        // Update block, which only takes a full assembly after a new tip
+        static LiveBlockAssembler assembler(Params());
         CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy, fSupportsSegwit);
+        pblocktemplate = assembler.GetBlockTemplate(scriptDummy, fSupportsSegwit);
         if (!pblocktemplate)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
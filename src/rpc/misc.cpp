@@ -4,8 +4,10 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "base58.h"
+#include "chain.h"
 #include "clientversion.h"
 #include "init.h"
+#include "memusage.h"
 #include "validation.h"
 #include "net.h"
 #include "netbase.h"
@@ -467,6 +469,33 @@ static UniValue RPCLockedMemoryInfo()
     return obj;
 }
 
+static UniValue RPCBlockIndexMemoryInfo()
+{
+    LOCK(cs_main);
+    uint64_t nCompact = 0, nText = 0, nUsage = 0, nStringUsage = 0;
+    for (const auto& entry : mapBlockIndex) {
+        const CBlockIndexVerify& verify = entry.second->verify;
+        nUsage += sizeof(CBlockIndexVerify) + verify.DynamicMemoryUsage();
+        // What the same nVerify took when held as a std::string
+        nStringUsage += sizeof(std::string);
+        if (verify.IsNull())
+            continue;
+        size_t nLen = verify.IsCompact() ? CBlockIndexVerify::COMPACT_SIGNATURE_BASE64_SIZE : verify.ToBase64().size();
+        nStringUsage += memusage::MallocUsage(nLen + 1);
+        if (verify.IsCompact())
+            nCompact++;
+        else
+            nText++;
+    }
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("entries", uint64_t(mapBlockIndex.size())));
+    obj.push_back(Pair("verify_compact", nCompact));
+    obj.push_back(Pair("verify_text", nText));
+    obj.push_back(Pair("verify_usage", nUsage));
+    obj.push_back(Pair("verify_saved", nStringUsage > nUsage ? nStringUsage - nUsage : 0));
+    return obj;
+}
+
 UniValue getmemoryinfo(const JSONRPCRequest& request)
 {
     /* Please, avoid using the word "pool" here in the RPC interface or help,
@@ -485,6 +514,13 @@ UniValue getmemoryinfo(const JSONRPCRequest& request)
             "    \"locked\": xxxxxx,       (numeric) Amount of bytes that succeeded locking. If this number is smaller than total, locking pages failed at some point and key data could be swapped to disk.\n"
             "    \"chunks_used\": xxxxx,   (numeric) Number allocated chunks\n"
             "    \"chunks_free\": xxxxx,   (numeric) Number unused chunks\n"
+            "  },\n"
+            "  \"blockindex\": {           (json object) Information about the block index\n"
+            "    \"entries\": xxxxx,       (numeric) Number of block index entries\n"
+            "    \"verify_compact\": xxxx, (numeric) Entries whose miner signature is held as a 65-byte compact signature\n"
+            "    \"verify_text\": xxxx,    (numeric) Entries whose non-canonical miner signature is held as text\n"
+            "    \"verify_usage\": xxxxx,  (numeric) Bytes used for miner signatures\n"
+            "    \"verify_saved\": xxxxx,  (numeric) Bytes saved compared to holding every signature as a string\n"
             "  }\n"
             "}\n"
             "\nExamples:\n"
@@ -493,6 +529,7 @@ UniValue getmemoryinfo(const JSONRPCRequest& request)
         );
     UniValue obj(UniValue::VOBJ);
     obj.push_back(Pair("locked", RPCLockedMemoryInfo()));
+    obj.push_back(Pair("blockindex", RPCBlockIndexMemoryInfo()));
     return obj;
 }
 
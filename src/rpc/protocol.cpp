@@ -61,6 +61,93 @@ UniValue JSONRPCError(int code, const string& message)
     return error;
 }
 
+void JSONStreamWriter::Separate()
+{
+    fUsed = true;
+    if (fAfterKey) {
+        fAfterKey = false;
+        return;
+    }
+    if (!vEmpty.empty()) {
+        if (!vEmpty.back())
+            strBuffer += ',';
+        vEmpty.back() = false;
+    }
+}
+
+void JSONStreamWriter::Append(const std::string& str)
+{
+    strBuffer += str;
+    if (strBuffer.size() >= CHUNK_SIZE)
+        Flush();
+}
+
+void JSONStreamWriter::BeginObject()
+{
+    Separate();
+    Append("{");
+    vEmpty.push_back(true);
+}
+
+void JSONStreamWriter::EndObject()
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    vEmpty.pop_back();
+    Append("}");
+}
+
+void JSONStreamWriter::BeginArray()
+{
+    Separate();
+    Append("[");
+    vEmpty.push_back(true);
+}
+
+void JSONStreamWriter::EndArray()
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    vEmpty.pop_back();
+    Append("]");
+}
+
+void JSONStreamWriter::Key(const std::string& key)
+{
+    Separate();
+    // Let UniValue take care of escaping
+    Append(UniValue(key).write() + ":");
+    fAfterKey = true;
+}
+
+void JSONStreamWriter::Value(const UniValue& value)
+{
+    Separate();
+    Append(value.write());
+}
+
+void JSONStreamWriter::BeginString()
+{
+    Separate();
+    Append("\"");
+}
+
+void JSONStreamWriter::StringPart(const std::string& str)
+{
+    Append(str);
+}
+
+void JSONStreamWriter::EndString()
+{
+    Append("\"");
+}
+
+void JSONStreamWriter::Flush()
+{
+    if (strBuffer.empty())
+        return;
+    WriteChunk(strBuffer);
+    strBuffer.clear();
+}
+
 /** Username used when cookie authentication is in use (arbitrary, only for
  * recognizability in debugging/logging purposes)
  */
@@ -10,6 +10,7 @@
 #include <map>
 #include <stdint.h>
 #include <string>
+#include <vector>
 #include <boost/filesystem.hpp>
 
 #include <univalue.h>
@@ -82,6 +83,57 @@ UniValue JSONRPCReplyObj(const UniValue& result, const UniValue& error, const Un
 std::string JSONRPCReply(const UniValue& result, const UniValue& error, const UniValue& id);
 UniValue JSONRPCError(int code, const std::string& message);
 
+/**
+ * Writes a JSON document piece by piece and hands it out in chunks of about
+ * CHUNK_SIZE bytes while it is being produced, so that large results need
+ * not be built up in memory as a whole before they can be sent.
+ */
+class JSONStreamWriter
+{
+private:
+    std::string strBuffer;
+    //! For every open object or array, whether nothing was written into it yet
+    std::vector<bool> vEmpty;
+    //! Whether the next value follows a key, and needs no separator
+    bool fAfterKey;
+    bool fUsed;
+
+    //! Write the separator needed in front of the next key or value
+    void Separate();
+    void Append(const std::string& str);
+
+protected:
+    //! Send out the next piece of the document
+    virtual void WriteChunk(const std::string& strChunk) = 0;
+
+public:
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    JSONStreamWriter() : fAfterKey(false), fUsed(false) {}
+    virtual ~JSONStreamWriter() {}
+
+    //! Whether anything was written yet
+    bool IsUsed() const { return fUsed; }
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    //! Write the key of the next value in an object
+    void Key(const std::string& key);
+    //! Write a complete value
+    void Value(const UniValue& value);
+    /**
+     * Write a string value in parts, so that e.g. a long hex string does not
+     * have to be built as a whole. The parts are not escaped.
+     */
+    void BeginString();
+    void StringPart(const std::string& str);
+    void EndString();
+    //! Hand out everything that is still buffered
+    void Flush();
+};
+
 /** Get name of RPC authentication cookie file */
 boost::filesystem::path GetAuthCookieFile();
 /** Generate a new RPC authentication cookie and write it to disk */
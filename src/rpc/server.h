@@ -52,8 +52,13 @@ public:
     bool fHelp;
     std::string URI;
     std::string authUser;
+    /**
+     * If set, a handler may write its result to this instead of returning
+     * it, which callers notice by pstream->IsUsed().
+     */
+    JSONStreamWriter* pstream;
 
-    JSONRPCRequest() { id = NullUniValue; params = NullUniValue; fHelp = false; }
+    JSONRPCRequest() { id = NullUniValue; params = NullUniValue; fHelp = false; pstream = NULL; }
     void parse(const UniValue& valRequest);
 };
 
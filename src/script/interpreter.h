@@ -133,6 +133,16 @@ public:
         return false;
     }
 
+    /**
+     * Check a signature that CHECKMULTISIG tries against one of its keys.
+     * Trying a signature against a key it does not belong to is normal
+     * there, so it must really be checked, never assumed valid.
+     */
+    virtual bool CheckSigInMultiSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode, SigVersion sigversion) const
+    {
+        return CheckSig(scriptSig, vchPubKey, scriptCode, sigversion);
+    }
+
     virtual bool CheckLockTime(const CScriptNum& nLockTime) const
     {
          return false;
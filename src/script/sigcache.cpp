@@ -5,15 +5,30 @@
 
 #include "sigcache.h"
 
+#include "clientversion.h"
+#include "crypto/common.h"
+#include "crypto/hmac_sha256.h"
+#include "hash.h"
 #include "memusage.h"
 #include "pubkey.h"
 #include "random.h"
+#include "streams.h"
 #include "uint256.h"
 #include "util.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
 
 #include "cuckoocache.h"
+#include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace {
 
 /**
@@ -77,8 +92,30 @@ public:
     }
     uint32_t setup_bytes(size_t n)
     {
+        // A new nonce leaves nothing from before reachable
+        GetRandBytes(nonce.begin(), 32);
         return setValid.setup_bytes(n);
     }
+
+    //! Get the nonce and the entries to save, older ones first
+    void Save(uint256& nonceOut, std::vector<uint256>& vEntries)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        nonceOut = nonce;
+        setValid.for_each_live([&vEntries](const uint256& entry) { vEntries.push_back(entry); });
+    }
+
+    //! Take over the nonce of saved entries, and add them
+    void Load(const uint256& nonceIn, const unsigned char* pentries, uint32_t nEntries)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+        nonce = nonceIn;
+        for (uint32_t i = 0; i < nEntries; i++) {
+            uint256 entry;
+            memcpy(entry.begin(), pentries + i * sizeof(uint256), sizeof(uint256));
+            setValid.insert(entry);
+        }
+    }
 };
 
 /* In previous versions of this code, signatureCache was a local static variable
@@ -88,6 +125,153 @@ public:
  * signatureCache could be made local to VerifySignature.
 */
 static CSignatureCache signatureCache;
+
+/**
+ * Cache of header signatures (nVerify) known to come from the miner key, to
+ * avoid recovering the public key again each time the same block is checked
+ * (compact block reconstruction, reorgs, re-submission).
+ */
+class CMinerSignatureCache
+{
+private:
+     //! Entries are SHA256(nonce || hashPrevBlock || miner key ID || nVerify):
+    uint256 nonce;
+    typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
+    map_type setValid;
+    boost::shared_mutex cs_minersigcache;
+
+public:
+    CMinerSignatureCache()
+    {
+        GetRandBytes(nonce.begin(), 32);
+    }
+
+    void
+    ComputeEntry(uint256& entry, const uint256& hashPrevBlock, const std::string& strVerify, const CKeyID& keyID)
+    {
+        CSHA256().Write(nonce.begin(), 32).Write(hashPrevBlock.begin(), 32).Write(keyID.begin(), keyID.size()).Write((const unsigned char*)strVerify.data(), strVerify.size()).Finalize(entry.begin());
+    }
+
+    bool
+    Get(const uint256& entry)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_minersigcache);
+        return setValid.contains(entry, false);
+    }
+
+    void Set(uint256& entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_minersigcache);
+        setValid.insert(entry);
+    }
+    uint32_t setup_bytes(size_t n)
+    {
+        return setValid.setup_bytes(n);
+    }
+};
+
+static CMinerSignatureCache minerSignatureCache;
+
+static const char* SIG_CACHE_FILENAME = "sigcache.dat";
+static const char* SIG_CACHE_KEY_FILENAME = "sigcache.key";
+static const unsigned char SIG_CACHE_FILE_MAGIC[8] = {'s', 'i', 'g', 'c', 'a', 'c', 'h', 'e'};
+static const uint32_t SIG_CACHE_DUMP_VERSION = 2;
+// Magic, version, nonce and number of entries. The entries follow, and then
+// the HMAC-SHA256 of all that. Entries are trusted as verified signatures, so
+// the MAC is keyed with a secret of this node's, kept apart in
+// SIG_CACHE_KEY_FILENAME: whoever can only replace the cache file cannot
+// forge a valid one.
+static const size_t SIG_CACHE_HEADER_SIZE = 8 + 4 + 32 + 4;
+static const size_t SIG_CACHE_KEY_SIZE = 32;
+
+/** Read-only contents of a file, memory mapped where possible */
+class CReadOnlyFile
+{
+private:
+    std::vector<unsigned char> vch;
+    bool fMapped;
+
+public:
+    const unsigned char* pbegin;
+    size_t nSize;
+
+    CReadOnlyFile() : fMapped(false), pbegin(NULL), nSize(0) {}
+    ~CReadOnlyFile()
+    {
+#ifndef WIN32
+        if (fMapped)
+            munmap((void*)pbegin, nSize);
+#endif
+    }
+
+    bool Open(const boost::filesystem::path& path)
+    {
+#ifndef WIN32
+        int fd = open(path.string().c_str(), O_RDONLY);
+        if (fd == -1)
+            return false;
+        struct stat st;
+        void* p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+            p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p != MAP_FAILED) {
+            fMapped = true;
+            pbegin = (const unsigned char*)p;
+            nSize = st.st_size;
+            return true;
+        }
+#endif
+        FILE* file = fopen(path.string().c_str(), "rb");
+        if (!file)
+            return false;
+        unsigned char buf[65536];
+        size_t nRead;
+        while ((nRead = fread(buf, 1, sizeof(buf), file)) > 0)
+            vch.insert(vch.end(), buf, buf + nRead);
+        fclose(file);
+        pbegin = vch.data();
+        nSize = vch.size();
+        return true;
+    }
+};
+}
+
+/** Read the key the signature cache file is authenticated with, creating it
+ *  first if asked to and there is none yet. */
+static bool GetSignatureCacheKey(unsigned char* key, bool fCreate)
+{
+    boost::filesystem::path path = GetDataDir() / SIG_CACHE_KEY_FILENAME;
+    FILE* file = fopen(path.string().c_str(), "rb");
+    if (file) {
+        bool fRead = fread(key, 1, SIG_CACHE_KEY_SIZE, file) == SIG_CACHE_KEY_SIZE && fgetc(file) == EOF;
+        fclose(file);
+        if (fRead)
+            return true;
+    }
+    if (!fCreate)
+        return false;
+
+    GetStrongRandBytes(key, SIG_CACHE_KEY_SIZE);
+    boost::filesystem::path pathTmp = GetDataDir() / (std::string(SIG_CACHE_KEY_FILENAME) + ".new");
+    // The key is a secret: only this user may read it
+#ifndef WIN32
+    int fd = open(pathTmp.string().c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+        return false;
+    if (fchmod(fd, S_IRUSR | S_IWUSR) != 0 || !(file = fdopen(fd, "wb"))) {
+        close(fd);
+        return false;
+    }
+#else
+    file = fopen(pathTmp.string().c_str(), "wb");
+    if (!file)
+        return false;
+#endif
+    bool fWritten = fwrite(key, 1, SIG_CACHE_KEY_SIZE, file) == SIG_CACHE_KEY_SIZE;
+    FileCommit(file);
+    fclose(file);
+    return fWritten && RenameOver(pathTmp, path);
 }
 
 // To be called once in AppInit2/TestingSetup to initialize the signatureCache
@@ -99,6 +283,98 @@ void InitSignatureCache()
     size_t nElems = signatureCache.setup_bytes(nMaxCacheSize);
     LogPrintf("Using %zu MiB out of %zu requested for signature cache, able to store %zu elements\n",
             (nElems*sizeof(uint256)) >>20, nMaxCacheSize>>20, nElems);
+    size_t nMinerElems = minerSignatureCache.setup_bytes((size_t)DEFAULT_MAX_MINER_SIG_CACHE_SIZE << 20);
+    LogPrintf("Using %zu MiB for miner signature cache, able to store %zu elements\n",
+            (nMinerElems*sizeof(uint256)) >>20, nMinerElems);
+}
+
+bool LoadSignatureCache()
+{
+    int64_t nStart = GetTimeMicros();
+    CReadOnlyFile file;
+    if (!file.Open(GetDataDir() / SIG_CACHE_FILENAME)) {
+        LogPrintf("Failed to open signature cache file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    unsigned char key[SIG_CACHE_KEY_SIZE];
+    if (!GetSignatureCacheKey(key, false)) {
+        LogPrintf("Failed to read signature cache key from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    const unsigned char* p = file.pbegin;
+    if (file.nSize < SIG_CACHE_HEADER_SIZE + CHMAC_SHA256::OUTPUT_SIZE ||
+        memcmp(p, SIG_CACHE_FILE_MAGIC, sizeof(SIG_CACHE_FILE_MAGIC)) != 0 ||
+        ReadLE32(p + 8) != SIG_CACHE_DUMP_VERSION) {
+        LogPrintf("Signature cache file has an unknown format. Continuing anyway.\n");
+        return false;
+    }
+    uint256 nonce;
+    memcpy(nonce.begin(), p + 12, 32);
+    uint32_t nEntries = ReadLE32(p + 44);
+    uint256 hash;
+    CHMAC_SHA256(key, sizeof(key)).Write(p, file.nSize - CHMAC_SHA256::OUTPUT_SIZE).Finalize(hash.begin());
+    if (file.nSize != SIG_CACHE_HEADER_SIZE + (uint64_t)nEntries * sizeof(uint256) + CHMAC_SHA256::OUTPUT_SIZE ||
+        memcmp(hash.begin(), p + file.nSize - CHMAC_SHA256::OUTPUT_SIZE, CHMAC_SHA256::OUTPUT_SIZE) != 0) {
+        LogPrintf("Signature cache file is corrupt. Continuing anyway.\n");
+        return false;
+    }
+
+    signatureCache.Load(nonce, p + SIG_CACHE_HEADER_SIZE, nEntries);
+    LogPrintf("Imported %u signature cache entries from disk: %gs\n", nEntries, (GetTimeMicros() - nStart) * 0.000001);
+    return true;
+}
+
+void DumpSignatureCache()
+{
+    int64_t nStart = GetTimeMicros();
+
+    uint256 nonce;
+    std::vector<uint256> vEntries;
+    signatureCache.Save(nonce, vEntries);
+    static_assert(sizeof(uint256) == 32, "Entries are written as one array");
+
+    int64_t nMid = GetTimeMicros();
+
+    unsigned char key[SIG_CACHE_KEY_SIZE];
+    if (!GetSignatureCacheKey(key, true)) {
+        LogPrintf("Failed to write signature cache key to disk. Continuing anyway.\n");
+        return;
+    }
+
+    try {
+        FILE* filestr = fopen((GetDataDir() / (std::string(SIG_CACHE_FILENAME) + ".new")).string().c_str(), "wb");
+        if (!filestr) {
+            return;
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        unsigned char header[SIG_CACHE_HEADER_SIZE];
+        memcpy(header, SIG_CACHE_FILE_MAGIC, sizeof(SIG_CACHE_FILE_MAGIC));
+        WriteLE32(header + 8, SIG_CACHE_DUMP_VERSION);
+        memcpy(header + 12, nonce.begin(), 32);
+        WriteLE32(header + 44, vEntries.size());
+        CHMAC_SHA256 hasher(key, sizeof(key));
+        hasher.Write(header, sizeof(header));
+        file.write((const char*)header, sizeof(header));
+        if (!vEntries.empty()) {
+            hasher.Write(vEntries[0].begin(), vEntries.size() * sizeof(uint256));
+            file.write((const char*)vEntries[0].begin(), vEntries.size() * sizeof(uint256));
+        }
+        uint256 hash;
+        hasher.Finalize(hash.begin());
+        file.write((const char*)hash.begin(), hash.size());
+
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(GetDataDir() / (std::string(SIG_CACHE_FILENAME) + ".new"), GetDataDir() / SIG_CACHE_FILENAME);
+        int64_t nLast = GetTimeMicros();
+        LogPrintf("Dumped signature cache: %gs to copy, %gs to dump\n", (nMid - nStart) * 0.000001, (nLast - nMid) * 0.000001);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump signature cache: %s. Continuing anyway.\n", e.what());
+    }
 }
 
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
@@ -113,3 +389,80 @@ bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsig
         signatureCache.Set(entry);
     return true;
 }
+
+CDeferredSignatures::~CDeferredSignatures()
+{
+    for (const uint256& entry : vCacheHits)
+        signatureCache.Get(entry, true);
+}
+
+bool CDeferredSignatures::Add(const uint256& entry, bool store, const CPubKey& pubkey, const uint256& sighash, const std::vector<unsigned char>& vchSig)
+{
+    if (!batch.Add(pubkey, sighash, vchSig))
+        return false;
+    vCacheEntries.push_back(std::make_pair(entry, store));
+    return true;
+}
+
+bool CDeferredSignatures::Verify(std::vector<bool>& vResult)
+{
+    bool fAllValid = batch.Verify(vResult);
+    for (size_t i = 0; i < vCacheEntries.size(); i++) {
+        if (vResult[i] && vCacheEntries[i].second)
+            signatureCache.Set(vCacheEntries[i].first);
+    }
+    return fAllValid;
+}
+
+void CDeferredSignatures::resize(size_t n)
+{
+    batch.resize(n);
+    vCacheEntries.resize(batch.size());
+}
+
+bool DeferringTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+{
+    uint256 entry;
+    signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
+    if (signatureCache.Get(entry, false)) {
+        if (!store)
+            deferred.AddCacheHit(entry);
+        return true;
+    }
+    if (!fVerifyNow)
+        return deferred.Add(entry, store, pubkey, sighash, vchSig);
+    if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
+        return false;
+    if (store)
+        signatureCache.Set(entry);
+    return true;
+}
+
+bool DeferringTransactionSignatureChecker::CheckSigInMultiSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode, SigVersion sigversion) const
+{
+    fVerifyNow = true;
+    bool fOk = CheckSig(scriptSig, vchPubKey, scriptCode, sigversion);
+    fVerifyNow = false;
+    return fOk;
+}
+
+bool CheckMinerSignature(const uint256& hashPrevBlock, const std::string& strVerify, const CKeyID& keyID)
+{
+    uint256 entry;
+    minerSignatureCache.ComputeEntry(entry, hashPrevBlock, strVerify, keyID);
+    if (minerSignatureCache.Get(entry))
+        return true;
+
+    std::vector<unsigned char> vchSig = DecodeBase64(strVerify.c_str());
+    CHashWriter ss(SER_GETHASH, 0);
+    const std::string strMessageMagic = "Solidus Signed Message:\n";
+    const std::string strMessage = hashPrevBlock.ToString();
+    ss << strMessageMagic;
+    ss << strMessage;
+
+    CPubKey pubkey;
+    if (!pubkey.RecoverCompact(ss.GetHash(), vchSig) || pubkey.GetID() != keyID)
+        return false;
+    minerSignatureCache.Set(entry);
+    return true;
+}
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_SCRIPT_SIGCACHE_H
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
+#include "pubkey.h"
 #include "script/interpreter.h"
 
 #include <vector>
@@ -16,7 +17,12 @@
 static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 32;
 // Maximum sig cache size allowed
 static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
+// Size of the miner header signature cache in MB (over 30000 headers)
+static const unsigned int DEFAULT_MAX_MINER_SIG_CACHE_SIZE = 1;
+// Default for -persistsigcache
+static const bool DEFAULT_PERSIST_SIG_CACHE = true;
 
+class CKeyID;
 class CPubKey;
 
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
@@ -30,6 +36,81 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/**
+ * Signatures whose verification was deferred by a
+ * DeferringTransactionSignatureChecker, with their signature cache entries.
+ *
+ * Cache hits of checkers that do not store are only taken out of the cache
+ * when this is destroyed: until the checks are done, a check may have to be
+ * run again and find them there.
+ */
+class CDeferredSignatures
+{
+private:
+    CSignatureBatch batch;
+    //! Cache entry of each signature, and whether to store it if valid
+    std::vector<std::pair<uint256, bool> > vCacheEntries;
+    //! Cache entries that were found, to be erased
+    std::vector<uint256> vCacheHits;
+
+public:
+    ~CDeferredSignatures();
+
+    bool Add(const uint256& entry, bool store, const CPubKey& pubkey, const uint256& sighash, const std::vector<unsigned char>& vchSig);
+    void AddCacheHit(const uint256& entry) { vCacheHits.push_back(entry); }
+
+    /**
+     * Verify the signatures together, and add the valid ones to the cache
+     * where asked. vResult receives whether each is valid, in the order they
+     * were added. Returns whether all of them are.
+     */
+    bool Verify(std::vector<bool>& vResult);
+
+    size_t size() const { return batch.size(); }
+    //! Forget the signatures added after the first n
+    void resize(size_t n);
+};
+
+/**
+ * Looks signatures up in the cache like CachingTransactionSignatureChecker,
+ * but instead of verifying the ones it misses, it adds them to a
+ * CDeferredSignatures and assumes they are valid. A script run with this
+ * checker only has the right result if all deferred signatures turn out to
+ * be valid; otherwise it has to be run again with a checker that verifies
+ * right away. Signatures CHECKMULTISIG tries are verified right away, as
+ * they often do not match the key they are tried with.
+ */
+class DeferringTransactionSignatureChecker : public TransactionSignatureChecker
+{
+private:
+    bool store;
+    CDeferredSignatures& deferred;
+    //! Set while checking a signature for CHECKMULTISIG
+    mutable bool fVerifyNow;
+
+public:
+    DeferringTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amount, bool storeIn, PrecomputedTransactionData& txdataIn, CDeferredSignatures& deferredIn) : TransactionSignatureChecker(txToIn, nInIn, amount, txdataIn), store(storeIn), deferred(deferredIn), fVerifyNow(false) {}
+
+    bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
+    bool CheckSigInMultiSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode, SigVersion sigversion) const;
+};
+
 void InitSignatureCache();
 
+/**
+ * Load the signature cache saved by DumpSignatureCache, taking over its salt.
+ * To be called right after InitSignatureCache, before the cache is used.
+ */
+bool LoadSignatureCache();
+
+/** Save the signature cache, with its salt, to disk */
+void DumpSignatureCache();
+
+/**
+ * Check that the base64 compact signature strVerify of a post-fork block
+ * header, over its hashPrevBlock, was made by the miner key keyID. Results
+ * that pass are cached so the key is only recovered once per header.
+ */
+bool CheckMinerSignature(const uint256& hashPrevBlock, const std::string& strVerify, const CKeyID& keyID);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
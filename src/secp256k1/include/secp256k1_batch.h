@@ -0,0 +1,40 @@
+#ifndef _SECP256K1_BATCH_
+# define _SECP256K1_BATCH_
+
+# include "secp256k1.h"
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+/** Verify a number of ECDSA signatures at once.
+ *
+ *  Gives the same result for each signature as secp256k1_ecdsa_verify, but
+ *  shares the work that does not depend on the individual signature: the
+ *  modular inversions of the s values are done together, with a single
+ *  inversion per group of signatures.
+ *
+ *  Returns: 1: all signatures are valid (or n is 0)
+ *           0: at least one signature is invalid
+ *  Args:    ctx:     a secp256k1 context object, initialized for verification.
+ *  Out:     results: if not NULL, a pointer to an array of n ints, set to 1
+ *                    for each correct signature and 0 for each incorrect one
+ *  In:      sigs:    an array of n pointers to parsed, lower-S signatures
+ *           msgs32:  an array of n pointers to the 32-byte messages signed
+ *           pubkeys: an array of n pointers to parsed public keys
+ *           n:       the number of signatures
+ */
+SECP256K1_API int secp256k1_ecdsa_verify_batch(
+    const secp256k1_context* ctx,
+    int *results,
+    const secp256k1_ecdsa_signature * const *sigs,
+    const unsigned char * const *msgs32,
+    const secp256k1_pubkey * const *pubkeys,
+    size_t n
+) SECP256K1_ARG_NONNULL(1);
+
+# ifdef __cplusplus
+}
+# endif
+
+#endif
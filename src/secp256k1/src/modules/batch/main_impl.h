@@ -0,0 +1,78 @@
+/**********************************************************************
+ * Copyright (c) 2021 The Bitcoin Core developers                     *
+ * Distributed under the MIT software license, see the accompanying   *
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.*
+ **********************************************************************/
+
+#ifndef _SECP256K1_MODULE_BATCH_MAIN_
+#define _SECP256K1_MODULE_BATCH_MAIN_
+
+#include "include/secp256k1_batch.h"
+
+/** Number of signatures whose s values are inverted together. */
+#define SECP256K1_ECDSA_BATCH_GROUP 32
+
+int secp256k1_ecdsa_verify_batch(const secp256k1_context* ctx, int *results, const secp256k1_ecdsa_signature * const *sigs, const unsigned char * const *msgs32, const secp256k1_pubkey * const *pubkeys, size_t n) {
+    secp256k1_scalar r[SECP256K1_ECDSA_BATCH_GROUP], s[SECP256K1_ECDSA_BATCH_GROUP];
+    secp256k1_scalar m[SECP256K1_ECDSA_BATCH_GROUP], acc[SECP256K1_ECDSA_BATCH_GROUP];
+    secp256k1_ge q[SECP256K1_ECDSA_BATCH_GROUP];
+    int valid[SECP256K1_ECDSA_BATCH_GROUP];
+    int all = 1;
+    size_t i, j;
+    VERIFY_CHECK(ctx != NULL);
+    ARG_CHECK(secp256k1_ecmult_context_is_built(&ctx->ecmult_ctx));
+    ARG_CHECK(n == 0 || sigs != NULL);
+    ARG_CHECK(n == 0 || msgs32 != NULL);
+    ARG_CHECK(n == 0 || pubkeys != NULL);
+
+    for (i = 0; i < n; i += SECP256K1_ECDSA_BATCH_GROUP) {
+        size_t len = n - i < SECP256K1_ECDSA_BATCH_GROUP ? n - i : SECP256K1_ECDSA_BATCH_GROUP;
+        secp256k1_scalar inv, sn;
+
+        /* Load the group, and multiply its s values together, keeping the
+         * partial products. Signatures that fail the checks which do not
+         * need the inverse get s = 1 instead, so the product stays nonzero. */
+        for (j = 0; j < len; j++) {
+            ARG_CHECK(sigs[i + j] != NULL);
+            ARG_CHECK(msgs32[i + j] != NULL);
+            ARG_CHECK(pubkeys[i + j] != NULL);
+            secp256k1_scalar_set_b32(&m[j], msgs32[i + j], NULL);
+            secp256k1_ecdsa_signature_load(ctx, &r[j], &s[j], sigs[i + j]);
+            valid[j] = !secp256k1_scalar_is_zero(&r[j]) && !secp256k1_scalar_is_zero(&s[j]) &&
+                       !secp256k1_scalar_is_high(&s[j]) && secp256k1_pubkey_load(ctx, &q[j], pubkeys[i + j]);
+            if (!valid[j]) {
+                secp256k1_scalar_set_int(&s[j], 1);
+            }
+            if (j == 0) {
+                acc[0] = s[0];
+            } else {
+                secp256k1_scalar_mul(&acc[j], &acc[j - 1], &s[j]);
+            }
+        }
+
+        /* Invert the product once, and peel off the inverse of each s from
+         * the back (Montgomery's trick). */
+        secp256k1_scalar_inverse_var(&inv, &acc[len - 1]);
+        for (j = len; j-- > 0;) {
+            if (j > 0) {
+                secp256k1_scalar_mul(&sn, &inv, &acc[j - 1]);
+                secp256k1_scalar_mul(&inv, &inv, &s[j]);
+            } else {
+                sn = inv;
+            }
+            if (valid[j]) {
+                valid[j] = secp256k1_ecdsa_sig_verify_inv(&ctx->ecmult_ctx, &r[j], &sn, &q[j], &m[j]);
+            }
+        }
+
+        for (j = 0; j < len; j++) {
+            if (results != NULL) {
+                results[i + j] = valid[j];
+            }
+            all &= valid[j];
+        }
+    }
+    return all;
+}
+
+#endif
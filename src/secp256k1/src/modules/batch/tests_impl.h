@@ -0,0 +1,75 @@
+/**********************************************************************
+ * Copyright (c) 2021 The Bitcoin Core developers                     *
+ * Distributed under the MIT software license, see the accompanying   *
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.*
+ **********************************************************************/
+
+#ifndef _SECP256K1_MODULE_BATCH_TESTS_
+#define _SECP256K1_MODULE_BATCH_TESTS_
+
+#define BATCH_TEST_SIGS 80
+
+void test_ecdsa_verify_batch(void) {
+    unsigned char privkey[32];
+    unsigned char messages[BATCH_TEST_SIGS][32];
+    secp256k1_ecdsa_signature signatures[BATCH_TEST_SIGS];
+    secp256k1_pubkey pubkeys[BATCH_TEST_SIGS];
+    const secp256k1_ecdsa_signature *psigs[BATCH_TEST_SIGS];
+    const unsigned char *pmsgs[BATCH_TEST_SIGS];
+    const secp256k1_pubkey *ppubkeys[BATCH_TEST_SIGS];
+    int results[BATCH_TEST_SIGS];
+    int expected[BATCH_TEST_SIGS];
+    int all = 1;
+    int i;
+
+    for (i = 0; i < BATCH_TEST_SIGS; i++) {
+        secp256k1_scalar msg, key;
+        random_scalar_order_test(&msg);
+        random_scalar_order_test(&key);
+        secp256k1_scalar_get_b32(privkey, &key);
+        secp256k1_scalar_get_b32(messages[i], &msg);
+        CHECK(secp256k1_ec_pubkey_create(ctx, &pubkeys[i], privkey) == 1);
+        CHECK(secp256k1_ecdsa_sign(ctx, &signatures[i], messages[i], privkey, NULL, NULL) == 1);
+        /* Break some of the signatures, in different ways. */
+        switch (secp256k1_rand_int(6)) {
+        case 0:
+            messages[i][secp256k1_rand_int(32)] ^= 1 + secp256k1_rand_int(255);
+            break;
+        case 1:
+            memset(signatures[i].data + 32 * secp256k1_rand_int(2), 0, 32);
+            break;
+        case 2:
+            if (i > 0) {
+                pubkeys[i] = pubkeys[i - 1];
+            }
+            break;
+        }
+        expected[i] = secp256k1_ecdsa_verify(ctx, &signatures[i], messages[i], &pubkeys[i]);
+        all &= expected[i];
+        psigs[i] = &signatures[i];
+        pmsgs[i] = messages[i];
+        ppubkeys[i] = &pubkeys[i];
+    }
+
+    /* Every prefix, so groups are full and partial. */
+    for (i = 0; i <= BATCH_TEST_SIGS; i += 1 + secp256k1_rand_int(16)) {
+        int j, prefix_all = 1;
+        for (j = 0; j < i; j++) {
+            prefix_all &= expected[j];
+        }
+        CHECK(secp256k1_ecdsa_verify_batch(ctx, results, psigs, pmsgs, ppubkeys, i) == prefix_all);
+        for (j = 0; j < i; j++) {
+            CHECK(results[j] == expected[j]);
+        }
+    }
+    CHECK(secp256k1_ecdsa_verify_batch(ctx, NULL, psigs, pmsgs, ppubkeys, BATCH_TEST_SIGS) == all);
+}
+
+void run_ecdsa_verify_batch(void) {
+    int i;
+    for (i = 0; i < count; i++) {
+        test_ecdsa_verify_batch();
+    }
+}
+
+#endif
@@ -0,0 +1,47 @@
+// Copyright (c) 2009-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SHAREDBYTES_H
+#define BITCOIN_SHAREDBYTES_H
+
+#include <memory>
+#include <stddef.h>
+#include <vector>
+
+/**
+ * A read-only range of bytes whose storage is kept alive by shared
+ * ownership, so it can be handed to several consumers (peers, HTTP replies)
+ * without copying. The storage can be a vector, or e.g. a memory-mapped
+ * file of which the range is a part.
+ */
+class CSharedBytes
+{
+private:
+    std::shared_ptr<const void> owner;
+    const unsigned char* pbegin;
+    size_t nSize;
+
+public:
+    CSharedBytes() : pbegin(NULL), nSize(0) {}
+
+    //! Refer to nSizeIn bytes at pbeginIn, which stay valid as long as ownerIn is alive
+    CSharedBytes(std::shared_ptr<const void> ownerIn, const unsigned char* pbeginIn, size_t nSizeIn) : owner(std::move(ownerIn)), pbegin(pbeginIn), nSize(nSizeIn) {}
+
+    //! Take over the contents of a vector
+    explicit CSharedBytes(std::vector<unsigned char>&& vch)
+    {
+        std::shared_ptr<std::vector<unsigned char> > pvch = std::make_shared<std::vector<unsigned char> >(std::move(vch));
+        pbegin = pvch->data();
+        nSize = pvch->size();
+        owner = std::move(pvch);
+    }
+
+    const unsigned char* data() const { return pbegin; }
+    const unsigned char* begin() const { return pbegin; }
+    const unsigned char* end() const { return pbegin + nSize; }
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+};
+
+#endif // BITCOIN_SHAREDBYTES_H
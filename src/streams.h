@@ -245,6 +245,8 @@ public:
     void insert(iterator it, size_type n, const char& x) { vch.insert(it, n, x); }
     value_type* data()                               { return vch.data() + nReadPos; }
     const value_type* data() const                   { return vch.data() + nReadPos; }
+    //! Exchange the underlying buffer, e.g. to reuse an allocation
+    void swap_buffer(vector_type& vchOther)          { vch.swap(vchOther); nReadPos = 0; }
 
     void insert(iterator it, std::vector<char>::const_iterator first, std::vector<char>::const_iterator last)
     {
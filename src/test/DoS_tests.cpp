@@ -215,4 +215,50 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     BOOST_CHECK(mapOrphanTransactions.empty());
 }
 
+BOOST_AUTO_TEST_CASE(block_download_window)
+{
+    // The first block sets the delivery time, later ones move it by an eighth
+    int64_t nDeliveryTime = UpdateBlockDeliveryTime(0, 80000);
+    BOOST_CHECK_EQUAL(nDeliveryTime, 80000);
+    nDeliveryTime = UpdateBlockDeliveryTime(nDeliveryTime, 160000);
+    BOOST_CHECK_EQUAL(nDeliveryTime, 90000);
+    // Blocks that arrive at once count as taking a microsecond
+    BOOST_CHECK_EQUAL(UpdateBlockDeliveryTime(0, 0), 1);
+    BOOST_CHECK_EQUAL(UpdateBlockDeliveryTime(0, -5), 1);
+    // A steady rate is converged on
+    for (int i = 0; i < 100; i++)
+        nDeliveryTime = UpdateBlockDeliveryTime(nDeliveryTime, 40000);
+    BOOST_CHECK(nDeliveryTime >= 40000 && nDeliveryTime < 40010);
+
+    // The window holds BLOCK_DOWNLOAD_TARGET_TIME worth of blocks, within bounds
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(BLOCK_DOWNLOAD_TARGET_TIME / 10), 10);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(1), MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(BLOCK_DOWNLOAD_TARGET_TIME / 1000), MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(BLOCK_DOWNLOAD_TARGET_TIME), MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(100 * BLOCK_DOWNLOAD_TARGET_TIME), MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, 2);
+    BOOST_CHECK_EQUAL(MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, 128);
+}
+
+BOOST_AUTO_TEST_CASE(block_reassign_timeout)
+{
+    const int64_t nRequested = 1000000000;
+
+    // Only to a peer whose rate is known, and faster than the staller's
+    BOOST_CHECK(!ShouldReassignBlock(nRequested + 10000000, nRequested, 0, 100000));
+    BOOST_CHECK(!ShouldReassignBlock(nRequested + 10000000, nRequested, 100000, 100000));
+    BOOST_CHECK(!ShouldReassignBlock(nRequested + 10000000, nRequested, 200000, 100000));
+    BOOST_CHECK(ShouldReassignBlock(nRequested + 10000000, nRequested, 50000, 100000));
+    BOOST_CHECK(ShouldReassignBlock(nRequested + 10000000, nRequested, 50000, 0));
+
+    // Once the block is overdue: twice the staller's time per block...
+    BOOST_CHECK(!ShouldReassignBlock(nRequested + 2 * 400000, nRequested, 50000, 400000));
+    BOOST_CHECK(ShouldReassignBlock(nRequested + 2 * 400000 + 1, nRequested, 50000, 400000));
+    // ...but never before BLOCK_REASSIGN_MIN_TIME
+    BOOST_CHECK(!ShouldReassignBlock(nRequested + BLOCK_REASSIGN_MIN_TIME, nRequested, 10000, 50000));
+    BOOST_CHECK(ShouldReassignBlock(nRequested + BLOCK_REASSIGN_MIN_TIME + 1, nRequested, 10000, 50000));
+    BOOST_CHECK(!ShouldReassignBlock(nRequested + BLOCK_REASSIGN_MIN_TIME, nRequested, 10000, 0));
+    BOOST_CHECK(ShouldReassignBlock(nRequested + BLOCK_REASSIGN_MIN_TIME + 1, nRequested, 10000, 0));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -314,6 +314,53 @@ BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest)
     }
 }
 
+BOOST_AUTO_TEST_CASE(LargeMempoolRoundTripTest)
+{
+    // Large enough for the mempool to be matched on several threads, on
+    // machines that have the cores for it
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 42;
+    std::vector<CTransactionRef> vtxPool;
+    for (int i = 0; i < 20000; i++) {
+        tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        vtxPool.push_back(MakeTransactionRef(tx));
+        pool.addUnchecked(vtxPool.back()->GetHash(), entry.FromTx(*vtxPool.back()));
+    }
+
+    CBlock block;
+    tx.vin[0].prevout.SetNull();
+    tx.vin[0].scriptSig.resize(10);
+    block.vtx.push_back(MakeTransactionRef(tx));
+    // Transactions from all over the mempool, and one that is missing from it
+    for (size_t i = 0; i < vtxPool.size(); i += 97)
+        block.vtx.push_back(vtxPool[i]);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    block.vtx.push_back(MakeTransactionRef(tx));
+    block.nVersion = 1;
+    block.hashPrevBlock = GetRandHash();
+    block.nBits = 0x1e0ffff0;
+    bool mutated;
+    block.hashMerkleRoot = BlockMerkleRoot(block, &mutated);
+    assert(!mutated);
+    while (!CheckProofOfWork(block.GetPoWHash(), block.nBits, Params().GetConsensus())) ++block.nNonce;
+
+    CBlockHeaderAndShortTxIDs shortIDs(block, true);
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(shortIDs, extra_txn) == READ_STATUS_OK);
+    for (size_t i = 0; i < block.vtx.size() - 1; i++)
+        BOOST_CHECK(partialBlock.IsTxAvailable(i));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(block.vtx.size() - 1));
+
+    CBlock block2;
+    BOOST_CHECK(partialBlock.FillBlock(block2, {block.vtx.back()}) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.hashMerkleRoot.ToString(), BlockMerkleRoot(block2, &mutated).ToString());
+    BOOST_CHECK(!mutated);
+}
+
 BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest) {
     BlockTransactionsRequest req1;
     req1.blockhash = GetRandHash();
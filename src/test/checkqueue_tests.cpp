@@ -0,0 +1,122 @@
+// Copyright (c) 2009-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+#include "random.h"
+
+#include "test/test_bitcoin.h"
+
+#include <atomic>
+#include <memory>
+
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+/** Counts how often checks ran, in total and per check, and fails if asked to */
+struct CountingCheck
+{
+    std::atomic<int>* pnCount;
+    std::atomic<int>* pnRuns;
+    bool fResult;
+
+    CountingCheck() : pnCount(NULL), pnRuns(NULL), fResult(true) {}
+    CountingCheck(std::atomic<int>& nCount, std::atomic<int>& nRuns, bool fResultIn) : pnCount(&nCount), pnRuns(&nRuns), fResult(fResultIn) {}
+
+    bool operator()()
+    {
+        (*pnCount)++;
+        (*pnRuns)++;
+        return fResult;
+    }
+
+    void swap(CountingCheck& x)
+    {
+        std::swap(pnCount, x.pnCount);
+        std::swap(pnRuns, x.pnRuns);
+        std::swap(fResult, x.fResult);
+    }
+};
+
+// Adds rounds of checks in batches of random sizes, some of them with a
+// failing check, and compares what the queue returns and how many checks
+// ran with what was added.
+static void TestCheckQueue(int nThreads)
+{
+    CCheckQueue<CountingCheck> queue(128);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CountingCheck>::Thread, boost::ref(queue)));
+
+    FastRandomContext insecure_rand(true);
+    for (int nRound = 0; nRound < 20; nRound++) {
+        std::atomic<int> nCount(0);
+        // How often each added check ran
+        std::unique_ptr<std::atomic<int>[]> vRuns(new std::atomic<int>[50 * 1000]);
+        int nAdded = 0;
+        bool fFail = nRound % 4 == 3;
+        {
+            CCheckQueueControl<CountingCheck> control(&queue);
+            for (int nBatch = 0; nBatch < 50; nBatch++) {
+                std::vector<CountingCheck> vChecks;
+                int nSize = 1 + insecure_rand.rand32() % (nBatch % 10 == 0 ? 1000 : 10);
+                for (int i = 0; i < nSize; i++) {
+                    vRuns[nAdded + i] = 0;
+                    vChecks.push_back(CountingCheck(nCount, vRuns[nAdded + i], !(fFail && nBatch == 25 && i == 0)));
+                }
+                nAdded += nSize;
+                control.Add(vChecks);
+            }
+            BOOST_CHECK_EQUAL(control.Wait(), !fFail);
+        }
+        // A failure may skip checks, but never runs one twice
+        int nRanTwice = 0, nSkipped = 0;
+        for (int i = 0; i < nAdded; i++) {
+            nRanTwice += vRuns[i] > 1;
+            nSkipped += vRuns[i] == 0;
+        }
+        BOOST_CHECK_EQUAL(nRanTwice, 0);
+        if (fFail)
+            BOOST_CHECK(nCount.load() <= nAdded);
+        else {
+            BOOST_CHECK_EQUAL(nSkipped, 0);
+            BOOST_CHECK_EQUAL(nCount.load(), nAdded);
+        }
+        BOOST_CHECK(queue.IsIdle());
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_threads)
+{
+    TestCheckQueue(0);
+    TestCheckQueue(1);
+    TestCheckQueue(4);
+    // More workers than there are deques for
+    TestCheckQueue(MAX_CHECKQUEUE_DEQUES + 3);
+}
+
+BOOST_AUTO_TEST_CASE(workstealingdeque)
+{
+    CWorkStealingDeque<int> deque;
+    std::vector<int> vValues(300);
+    for (size_t i = 0; i < vValues.size(); i++)
+        deque.Push(&vValues[i]);
+
+    // The owner pops the newest, thieves steal the oldest
+    BOOST_CHECK(deque.Pop() == &vValues[299]);
+    int* p;
+    BOOST_CHECK(deque.Steal(p) && p == &vValues[0]);
+    for (size_t i = 298; i >= 150; i--)
+        BOOST_CHECK(deque.Pop() == &vValues[i]);
+    for (size_t i = 1; i < 150; i++)
+        BOOST_CHECK(deque.Steal(p) && p == &vValues[i]);
+    BOOST_CHECK(deque.Pop() == NULL);
+    BOOST_CHECK(deque.Steal(p) && p == NULL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
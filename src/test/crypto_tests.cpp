@@ -255,6 +255,36 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256_implementations) {
+    // Every implementation the CPU supports must agree with the portable
+    // one, both on a stream and on batches of 64-byte inputs of every size.
+    std::vector<unsigned char> in(64 * 37);
+    for (size_t i = 0; i < in.size(); i++)
+        in[i] = insecure_rand();
+    std::vector<unsigned char> expected(32 * 37);
+    for (size_t i = 0; i < 37; i++) {
+        unsigned char hash[CSHA256::OUTPUT_SIZE];
+        CSHA256().Write(&in[64 * i], 64).Finalize(hash);
+        CSHA256().Write(hash, sizeof(hash)).Finalize(&expected[32 * i]);
+    }
+
+    const char* names[] = {"standard", "sse4.1", "avx2", "shani"};
+    for (size_t n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+        if (!SHA256SelectImplementation(names[n])) {
+            BOOST_CHECK(n != 0);
+            continue;
+        }
+        TestSHA256("abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+        TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
+        for (size_t blocks = 0; blocks <= 37; blocks++) {
+            std::vector<unsigned char> out(32 * blocks);
+            SHA256D64(out.data(), in.data(), blocks);
+            BOOST_CHECK(std::equal(out.begin(), out.end(), expected.begin()));
+        }
+    }
+    SHA256AutoDetect();
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
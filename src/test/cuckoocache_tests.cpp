@@ -391,4 +391,35 @@ BOOST_AUTO_TEST_CASE(cuckoocache_generations)
     test_cache_generations<CuckooCache::cache<uint256, uint256Hasher>>();
 }
 
+/* Test that for_each_live lists exactly the elements that were not erased,
+ * and that a cache filled from the list contains all of them.
+ */
+BOOST_AUTO_TEST_CASE(cuckoocache_for_each_live)
+{
+    insecure_rand = FastRandomContext(true);
+    CuckooCache::cache<uint256, uint256Hasher> cc{};
+    cc.setup(1 << 12);
+    std::vector<uint256> hashes(1000);
+    for (uint256& h : hashes) {
+        insecure_GetRandHash(h);
+        cc.insert(h);
+    }
+    for (size_t i = 0; i < 100; ++i)
+        BOOST_CHECK(cc.contains(hashes[i], true));
+
+    std::vector<uint256> live;
+    cc.for_each_live([&live](const uint256& h) { live.push_back(h); });
+    BOOST_CHECK_EQUAL(live.size(), 900U);
+    std::sort(live.begin(), live.end());
+    for (size_t i = 0; i < hashes.size(); ++i)
+        BOOST_CHECK_EQUAL(std::binary_search(live.begin(), live.end(), hashes[i]), i >= 100);
+
+    CuckooCache::cache<uint256, uint256Hasher> copy{};
+    copy.setup(1 << 12);
+    for (const uint256& h : live)
+        copy.insert(h);
+    for (size_t i = 100; i < hashes.size(); ++i)
+        BOOST_CHECK(copy.contains(hashes[i], false));
+}
+
 BOOST_AUTO_TEST_SUITE_END();
@@ -98,6 +98,8 @@ BOOST_AUTO_TEST_CASE(siphash)
     static const unsigned char t4[5] = {27,28,29,30,31};
     hasher.Write(t4, 5);
     BOOST_CHECK_EQUAL(hasher.Finalize(),  0x7127512f72f27cceull);
+    BOOST_CHECK_EQUAL(SipHashUint256Extra(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, uint256S("1f1e1d1c1b1a191817161514131211100f0e0d0c0b0a09080706050403020100"), 0x23222120),
+                      CSipHasher(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL).Write(uint256S("1f1e1d1c1b1a191817161514131211100f0e0d0c0b0a09080706050403020100").begin(), 32).Write((const unsigned char*)"\x20\x21\x22\x23", 4).Finalize());
     hasher.Write(0x2726252423222120ULL);
     BOOST_CHECK_EQUAL(hasher.Finalize(),  0x0e3ea96b5304a7d0ull);
     hasher.Write(0x2F2E2D2C2B2A2928ULL);
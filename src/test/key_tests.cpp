@@ -5,6 +5,9 @@
 #include "key.h"
 
 #include "base58.h"
+#include "chainparams.h"
+#include "hash.h"
+#include "script/sigcache.h"
 #include "script/script.h"
 #include "uint256.h"
 #include "util.h"
@@ -186,4 +189,34 @@ BOOST_AUTO_TEST_CASE(key_test1)
     BOOST_CHECK(detsigc == ParseHex("2052d8a32079c11e79db95af63bb9600c5b04f21a9ca33dc129c2bfa8ac9dc1cd561d8ae5e0f6c1a16bde3719c64c2fd70e404b6428ab9a69566962e8771b5944d"));
 }
 
+BOOST_AUTO_TEST_CASE(miner_signature)
+{
+    // The miner key ID is decoded from the main network miner address
+    CTxDestination dest = CBitcoinAddress("SWScdsR85bFkKeyYEtamhMjKVg1aN6LLTy").Get();
+    BOOST_CHECK(boost::get<CKeyID>(&dest) != NULL);
+    BOOST_CHECK(*boost::get<CKeyID>(&dest) == CKeyID(Params(CBaseChainParams::MAIN).GetConsensus().minerKeyID));
+    BOOST_CHECK(Params(CBaseChainParams::REGTEST).GetConsensus().minerKeyID.IsNull());
+
+    // Sign a header the way generateBlocks does
+    CKey key;
+    key.MakeNewKey(true);
+    uint256 hashPrevBlock = GetRandHash();
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << std::string("Solidus Signed Message:\n");
+    ss << hashPrevBlock.ToString();
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.SignCompact(ss.GetHash(), vchSig));
+    std::string strVerify = EncodeBase64(vchSig.data(), vchSig.size());
+
+    BOOST_CHECK(CheckMinerSignature(hashPrevBlock, strVerify, key.GetPubKey().GetID()));
+    // Second check is served from the cache
+    BOOST_CHECK(CheckMinerSignature(hashPrevBlock, strVerify, key.GetPubKey().GetID()));
+
+    CKey key2;
+    key2.MakeNewKey(true);
+    BOOST_CHECK(!CheckMinerSignature(hashPrevBlock, strVerify, key2.GetPubKey().GetID()));
+    BOOST_CHECK(!CheckMinerSignature(GetRandHash(), strVerify, key.GetPubKey().GetID()));
+    BOOST_CHECK(!CheckMinerSignature(hashPrevBlock, "", key.GetPubKey().GetID()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,14 +2,20 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "blockpipeline.h"
 #include "chainparams.h"
 #include "validation.h"
 #include "net.h"
+#include "sharedbytes.h"
+#include "streams.h"
 
 #include "test/test_bitcoin.h"
 
+#include <atomic>
+
 #include <boost/signals2/signal.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(main_tests, TestingSetup)
 
@@ -73,4 +79,114 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+BOOST_AUTO_TEST_CASE(read_raw_block)
+{
+    const CBlockIndex* pindex = chainActive.Genesis();
+    BOOST_REQUIRE(pindex);
+
+    CBlock block;
+    BOOST_REQUIRE(ReadBlockFromDisk(block, pindex, Params().GetConsensus()));
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+
+    // Read twice, the second time from the cached mapping
+    for (int i = 0; i < 2; i++) {
+        CSharedBytes rawBlock;
+        BOOST_CHECK(ReadRawBlockFromDisk(rawBlock, pindex, Params().MessageStart()));
+        BOOST_CHECK(std::vector<unsigned char>(rawBlock.begin(), rawBlock.end()) == std::vector<unsigned char>(ss.begin(), ss.end()));
+    }
+
+    // Wrong network magic
+    CSharedBytes rawBlock;
+    CMessageHeader::MessageStartChars messageStart;
+    memcpy(messageStart, Params().MessageStart(), sizeof(messageStart));
+    messageStart[0] ^= 0xff;
+    BOOST_CHECK(!ReadRawBlockFromDisk(rawBlock, pindex, messageStart));
+    BOOST_CHECK(rawBlock.empty());
+
+    // Not a block position
+    BOOST_CHECK(!ReadRawBlockFromDisk(rawBlock, CDiskBlockPos(pindex->nFile, 0), Params().MessageStart()));
+
+    // Not the block asked for
+    BOOST_CHECK(!ReadRawBlockFromDisk(rawBlock, pindex->GetBlockPos(), uint256(), Params().MessageStart()));
+    BOOST_CHECK(rawBlock.empty());
+    BOOST_CHECK(ReadRawBlockFromDisk(rawBlock, pindex->GetBlockPos(), pindex->GetBlockHash(), Params().MessageStart()));
+}
+
+BOOST_AUTO_TEST_CASE(block_pipeline)
+{
+    // The stages run on the pipeline's threads, so they only record what
+    // they saw; the checks are made here
+    std::atomic<int> nAccepted(0);
+    std::atomic<int> nNotForced(0);
+    std::atomic<int> nRounds(0);
+    std::shared_ptr<const CBlock> pblockConnected;
+    // Blocks with an odd nonce fail the check stage
+    CBlockPipeline pipeline(
+        [&nAccepted, &nNotForced](const std::shared_ptr<const CBlock>& pblock, bool fForceProcessing, bool* fNewBlock) {
+            if (!fForceProcessing)
+                nNotForced++;
+            nAccepted++;
+            *fNewBlock = true;
+            return pblock->nNonce % 2 == 0;
+        },
+        [&nRounds, &pblockConnected](const std::shared_ptr<const CBlock>& pblock) {
+            nRounds++;
+            pblockConnected = pblock;
+        });
+
+    // The queue is bounded while no worker drains it
+    std::vector<std::shared_ptr<CBlock> > vBlocks;
+    for (unsigned int i = 0; i <= MAX_PIPELINE_QUEUED_BLOCKS; i++) {
+        vBlocks.push_back(std::make_shared<CBlock>());
+        vBlocks.back()->nNonce = 2 * i;
+        BOOST_CHECK_EQUAL(pipeline.Submit(vBlocks.back(), true), i < MAX_PIPELINE_QUEUED_BLOCKS);
+    }
+    BOOST_CHECK_EQUAL(pipeline.GetQueuedBlocks(), MAX_PIPELINE_QUEUED_BLOCKS);
+
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 3; i++)
+        threadGroup.create_thread([&pipeline] { pipeline.CheckThread(); });
+    threadGroup.create_thread([&pipeline] { pipeline.ConnectThread(); });
+
+    pipeline.WaitIdle();
+    BOOST_CHECK_EQUAL(pipeline.GetQueuedBlocks(), 0U);
+    BOOST_CHECK_EQUAL(nAccepted, (int)MAX_PIPELINE_QUEUED_BLOCKS);
+    BOOST_CHECK_EQUAL(nNotForced, 0);
+    // Blocks stored while a round is running are connected together
+    BOOST_CHECK(nRounds >= 1 && nRounds <= (int)MAX_PIPELINE_QUEUED_BLOCKS);
+    BOOST_CHECK(pblockConnected);
+
+    // A block that fails its checks is not connected, nor reported as new
+    int nRoundsBefore = nRounds;
+    std::shared_ptr<CBlock> pblockInvalid = std::make_shared<CBlock>();
+    pblockInvalid->nNonce = 1;
+    std::atomic<int> nDone(0);
+    std::atomic<int> nNewBlocks(0);
+    BOOST_CHECK(pipeline.Submit(pblockInvalid, true, [&nDone, &nNewBlocks](bool fNewBlock) {
+        nNewBlocks += fNewBlock;
+        nDone++;
+    }));
+    pipeline.WaitIdle();
+    BOOST_CHECK_EQUAL(nRounds, nRoundsBefore);
+    BOOST_CHECK_EQUAL(nAccepted, (int)MAX_PIPELINE_QUEUED_BLOCKS + 1);
+    BOOST_CHECK_EQUAL(nDone, 1);
+    BOOST_CHECK_EQUAL(nNewBlocks, 0);
+
+    // The caller hears back once the block was stored
+    BOOST_CHECK(pipeline.Submit(vBlocks.back(), true, [&nDone, &nNewBlocks](bool fNewBlock) {
+        nNewBlocks += fNewBlock;
+        nDone++;
+    }));
+    pipeline.WaitIdle();
+    BOOST_CHECK_EQUAL(nDone, 2);
+    BOOST_CHECK_EQUAL(nNewBlocks, 1);
+    BOOST_CHECK_EQUAL(nRounds, nRoundsBefore + 1);
+    BOOST_CHECK(pblockConnected == vBlocks.back());
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -584,4 +584,102 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+
+BOOST_AUTO_TEST_CASE(MempoolSnapshotTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(2);
+    for (int i = 0; i < 2; i++) {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 33000LL;
+    }
+    // Spends both outputs of the parent, and an output not in the mempool
+    CMutableTransaction txChild;
+    txChild.vin.resize(3);
+    for (int i = 0; i < 2; i++) {
+        txChild.vin[i].scriptSig = CScript() << OP_11;
+        txChild.vin[i].prevout = COutPoint(txParent.GetHash(), i);
+    }
+    txChild.vin[2].scriptSig = CScript() << OP_11;
+    txChild.vin[2].prevout = COutPoint(GetRandHash(), 0);
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 11000LL;
+
+    std::shared_ptr<const TxMempoolSnapshot> snapshot = pool.GetSnapshot();
+    BOOST_CHECK(snapshot->empty());
+
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(10000LL).FromTx(txParent));
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(1000LL).FromTx(txChild));
+
+    // Earlier snapshots are not affected by changes
+    BOOST_CHECK(snapshot->empty());
+    // The copies the pool keeps count towards its memory usage
+    size_t nUsage = pool.DynamicMemoryUsage();
+    snapshot = pool.GetSnapshot();
+    BOOST_CHECK_EQUAL(snapshot->size(), 2);
+    BOOST_CHECK(pool.DynamicMemoryUsage() >= nUsage + 2 * sizeof(TxMempoolSnapshotEntry));
+    BOOST_CHECK(pool.GetSnapshot() == snapshot);
+    std::shared_ptr<const TxMempoolSnapshotEntry> parentEntry, childEntry;
+    BOOST_FOREACH(const std::shared_ptr<const TxMempoolSnapshotEntry>& s, *snapshot) {
+        if (s->entry.GetTx().GetHash() == txParent.GetHash()) {
+            BOOST_CHECK(s->vDepends.empty());
+            BOOST_CHECK_EQUAL(s->entry.GetCountWithDescendants(), 2);
+            parentEntry = s;
+        } else {
+            BOOST_CHECK(s->entry.GetTx().GetHash() == txChild.GetHash());
+            BOOST_CHECK(s->vDepends == std::vector<uint256>(1, txParent.GetHash()));
+            BOOST_CHECK_EQUAL(s->entry.GetCountWithAncestors(), 2);
+            childEntry = s;
+        }
+    }
+
+    // An unrelated transaction only adds its own entry; the others are shared
+    CMutableTransaction txOther;
+    txOther.vin.resize(1);
+    txOther.vin[0].scriptSig = CScript() << OP_11;
+    txOther.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txOther.vout.resize(1);
+    txOther.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txOther.vout[0].nValue = 12000LL;
+    pool.addUnchecked(txOther.GetHash(), entry.Fee(2000LL).FromTx(txOther));
+    BOOST_CHECK_EQUAL(snapshot->size(), 2);
+    snapshot = pool.GetSnapshot();
+    BOOST_CHECK_EQUAL(snapshot->size(), 3);
+    BOOST_CHECK(std::count(snapshot->begin(), snapshot->end(), parentEntry) == 1);
+    BOOST_CHECK(std::count(snapshot->begin(), snapshot->end(), childEntry) == 1);
+
+    // Fee deltas are reflected in the entry and its ancestors
+    pool.PrioritiseTransaction(txChild.GetHash(), txChild.GetHash().ToString(), 0, 500LL);
+    BOOST_CHECK(pool.GetSnapshot() != snapshot);
+    snapshot = pool.GetSnapshot();
+    BOOST_CHECK(std::count(snapshot->begin(), snapshot->end(), parentEntry) == 0);
+    BOOST_CHECK(std::count(snapshot->begin(), snapshot->end(), childEntry) == 0);
+    BOOST_FOREACH(const std::shared_ptr<const TxMempoolSnapshotEntry>& s, *snapshot) {
+        if (s->entry.GetTx().GetHash() == txChild.GetHash())
+            BOOST_CHECK_EQUAL(s->entry.GetModifiedFee(), 1500LL);
+        if (s->entry.GetTx().GetHash() == txParent.GetHash())
+            BOOST_CHECK_EQUAL(s->entry.GetModFeesWithDescendants(), 11500LL);
+    }
+
+    // Removing the parent as if it was mined updates the child's parents
+    std::vector<CTransactionRef> vtx(1, MakeTransactionRef(txParent));
+    pool.removeForBlock(vtx, 1);
+    BOOST_CHECK_EQUAL(snapshot->size(), 3);
+    snapshot = pool.GetSnapshot();
+    BOOST_CHECK_EQUAL(snapshot->size(), 2);
+    BOOST_FOREACH(const std::shared_ptr<const TxMempoolSnapshotEntry>& s, *snapshot) {
+        BOOST_CHECK(s->vDepends.empty());
+        BOOST_CHECK_EQUAL(s->entry.GetCountWithAncestors(), 1);
+    }
+
+    pool.clear();
+    BOOST_CHECK(pool.GetSnapshot()->empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
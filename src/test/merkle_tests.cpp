@@ -133,4 +133,34 @@ BOOST_AUTO_TEST_CASE(merkle_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(merkle_large_test)
+{
+    // Blocks large enough for their lower levels to be hashed by several threads
+    const int sizes[] = {4097, 16389, 20000};
+    for (size_t n = 0; n < sizeof(sizes) / sizeof(sizes[0]); n++) {
+        int ntx = sizes[n];
+        CBlock block;
+        block.vtx.resize(ntx);
+        for (int j = 0; j < ntx; j++) {
+            CMutableTransaction mtx;
+            mtx.nLockTime = j;
+            block.vtx[j] = MakeTransactionRef(std::move(mtx));
+        }
+        bool oldMutated = false, newMutated = false;
+        std::vector<uint256> merkleTree;
+        uint256 root = BlockMerkleRoot(block, &newMutated);
+        BOOST_CHECK(BlockBuildMerkleTree(block, &oldMutated, merkleTree) == root);
+        BOOST_CHECK(!oldMutated && !newMutated);
+
+        // Duplicating the last transactions keeps the root, but is detected.
+        int duplicate = 1 << ctz(ntx);
+        block.vtx.resize(ntx + duplicate);
+        for (int j = 0; j < duplicate; j++) {
+            block.vtx[ntx + j] = block.vtx[ntx + j - duplicate];
+        }
+        BOOST_CHECK(BlockMerkleRoot(block, &newMutated) == root);
+        BOOST_CHECK(newMutated);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -23,6 +23,8 @@
 
 #include <boost/test/unit_test.hpp>
 
+extern std::map<std::string, std::string> mapArgs;
+
 BOOST_FIXTURE_TEST_SUITE(miner_tests, TestingSetup)
 
 static CFeeRate blockMinFeeRate = CFeeRate(DEFAULT_BLOCK_MIN_TX_FEE);
@@ -493,4 +495,110 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+
+BOOST_AUTO_TEST_CASE(LiveBlockAssembler_update)
+{
+    const CChainParams& chainparams = Params(CBaseChainParams::MAIN);
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    TestMemPoolEntryHelper entry;
+    LOCK(cs_main);
+    mempool.clear();
+    // Keep the template from being assembled anew while testing updates
+    SetMockTime(GetTime());
+
+    LiveBlockAssembler assembler(chainparams);
+    std::unique_ptr<CBlockTemplate> pblocktemplate = assembler.GetBlockTemplate(scriptPubKey);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+    const CAmount nSubsidy = GetBlockSubsidy(chainActive.Height() + 1, chainparams.GetConsensus());
+
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txParent.vin[0].scriptSig = CScript() << OP_1;
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    txParent.vout[0].nValue = 100000;
+    CMutableTransaction txChild = txParent;
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    // Too low a fee to be added on its own; only package selection takes it
+    // along with its child
+    CMutableTransaction txFree = txParent;
+    txFree.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    CMutableTransaction txFreeChild = txParent;
+    txFreeChild.vin[0].prevout = COutPoint(txFree.GetHash(), 0);
+
+    mempool.addUnchecked(txParent.GetHash(), entry.Fee(10000).FromTx(txParent));
+    mempool.addUnchecked(txChild.GetHash(), entry.Fee(20000).FromTx(txChild));
+    mempool.addUnchecked(txFree.GetHash(), entry.Fee(0).FromTx(txFree));
+    mempool.addUnchecked(txFreeChild.GetHash(), entry.Fee(20000).FromTx(txFreeChild));
+
+    pblocktemplate = assembler.GetBlockTemplate(scriptPubKey);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 3);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == txParent.GetHash());
+    BOOST_CHECK(pblocktemplate->block.vtx[2]->GetHash() == txChild.GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0]->GetValueOut(), nSubsidy + 30000);
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -30000);
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[2], 20000);
+
+    // Removing the parent from the mempool takes the child along, and the
+    // space is filled again by package selection
+    mempool.removeRecursive(txParent);
+    pblocktemplate = assembler.GetBlockTemplate(scriptPubKey);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 3);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == txFree.GetHash());
+    BOOST_CHECK(pblocktemplate->block.vtx[2]->GetHash() == txFreeChild.GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0]->GetValueOut(), nSubsidy + 20000);
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -20000);
+
+    SetMockTime(0);
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_CASE(LiveBlockAssembler_refill)
+{
+    const CChainParams& chainparams = Params(CBaseChainParams::MAIN);
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    TestMemPoolEntryHelper entry;
+    LOCK(cs_main);
+    mempool.clear();
+    SetMockTime(GetTime());
+
+    CMutableTransaction txHigh;
+    txHigh.vin.resize(1);
+    txHigh.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txHigh.vin[0].scriptSig = CScript() << OP_1;
+    txHigh.vout.resize(1);
+    txHigh.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    txHigh.vout[0].nValue = 100000;
+    CMutableTransaction txLow = txHigh;
+    txLow.vin[0].prevout = COutPoint(GetRandHash(), 0);
+
+    // Room for one of the two next to the coinbase
+    ForceSetArg("-blockmaxweight", std::to_string(4000 + 3 * GetTransactionWeight(txHigh) / 2));
+    LiveBlockAssembler assembler(chainparams);
+    mapArgs.erase("-blockmaxweight");
+    BOOST_REQUIRE(assembler.GetBlockTemplate(scriptPubKey));
+
+    mempool.addUnchecked(txHigh.GetHash(), entry.Fee(20000).FromTx(txHigh));
+    mempool.addUnchecked(txLow.GetHash(), entry.Fee(10000).FromTx(txLow));
+    std::unique_ptr<CBlockTemplate> pblocktemplate = assembler.GetBlockTemplate(scriptPubKey);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 2);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == txHigh.GetHash());
+
+    // The space left by a removed transaction is filled again right away
+    mempool.removeRecursive(txHigh);
+    pblocktemplate = assembler.GetBlockTemplate(scriptPubKey);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 2);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == txLow.GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -10000);
+
+    SetMockTime(0);
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
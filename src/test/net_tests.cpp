@@ -10,8 +10,15 @@
 #include "streams.h"
 #include "net.h"
 #include "netbase.h"
+#include "netmessagemaker.h"
+#include "netmsgcache.h"
 #include "chainparams.h"
 
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 class CAddrManSerializationMock : public CAddrMan
 {
 public:
@@ -70,6 +77,26 @@ CDataStream AddrmanToStream(CAddrManSerializationMock& _addrman)
     return CDataStream(vchData, SER_DISK, CLIENT_VERSION);
 }
 
+struct CConnmanTest
+{
+    static void AddNode(CConnman& connman, CNode* pnode)
+    {
+        LOCK(connman.cs_vNodes);
+        connman.vNodes.push_back(pnode);
+    }
+
+    static void ClearNodes(CConnman& connman)
+    {
+        LOCK(connman.cs_vNodes);
+        connman.vNodes.clear();
+    }
+
+    static void ThreadMessageHandler(CConnman& connman)
+    {
+        connman.ThreadMessageHandler();
+    }
+};
+
 BOOST_FIXTURE_TEST_SUITE(net_tests, BasicTestingSetup)
 
 BOOST_AUTO_TEST_CASE(caddrdb_read)
@@ -172,4 +199,254 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE(cnetmessage_payload_in_place)
+{
+    // Large enough to be received into a reused buffer
+    std::vector<unsigned char> vPayload(100 * 1024);
+    for (size_t i = 0; i < vPayload.size(); i++)
+        vPayload[i] = (unsigned char)(i * 7);
+    uint256 hash = Hash(vPayload.begin(), vPayload.end());
+    CMessageHeader hdr(Params().MessageStart(), "block", vPayload.size());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CDataStream ssHeader(SER_NETWORK, INIT_PROTO_VERSION);
+    ssHeader << hdr;
+
+    for (int nRound = 0; nRound < 2; nRound++) {
+        CNetMessage msg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+        char* pch = NULL;
+        BOOST_CHECK_EQUAL(msg.PreparePayload(pch, 1000), 0);
+        BOOST_CHECK_EQUAL(msg.readHeader(&ssHeader[0], ssHeader.size()), (int)ssHeader.size());
+
+        // The first part is copied, the rest is written into the message directly
+        size_t nPos = 1000;
+        BOOST_CHECK_EQUAL(msg.readData((const char*)&vPayload[0], nPos), (int)nPos);
+        while (nPos < vPayload.size()) {
+            unsigned int nRoom = msg.PreparePayload(pch, 30000);
+            BOOST_REQUIRE(nRoom > 0 && nRoom <= 30000);
+            BOOST_CHECK(pch == &msg.vRecv[nPos]);
+            memcpy(pch, &vPayload[nPos], nRoom);
+            BOOST_CHECK_EQUAL(msg.readData(pch, nRoom), (int)nRoom);
+            nPos += nRoom;
+        }
+        BOOST_CHECK(msg.complete());
+        BOOST_CHECK_EQUAL(msg.PreparePayload(pch, 1000), 0);
+        BOOST_CHECK(msg.vRecv.size() == vPayload.size() && memcmp(&msg.vRecv[0], &vPayload[0], vPayload.size()) == 0);
+        BOOST_CHECK(msg.GetMessageHash() == hash);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(netmsgcache_share_and_evict)
+{
+    CNetMsgCache cache(1000);
+    std::vector<unsigned char> vch(400, 0x42);
+    uint256 hashA = Hash(vch.begin(), vch.begin() + 1);
+    uint256 hashB = Hash(vch.begin(), vch.begin() + 2);
+
+    // A payload is serialized once and shared afterwards
+    CSharedBytes payload = cache.Get(hashA, NetMsgType::BLOCK, 0, vch);
+    BOOST_CHECK_EQUAL(payload.size(), GetSerializeSize(vch, SER_NETWORK, PROTOCOL_VERSION));
+    CSharedBytes again = cache.Get(hashA, NetMsgType::BLOCK, 0, std::vector<unsigned char>());
+    BOOST_CHECK(again.data() == payload.data());
+
+    // Commands and flags are part of the key
+    CSharedBytes found;
+    BOOST_CHECK(!cache.Lookup(hashA, NetMsgType::CMPCTBLOCK, 0, found));
+    BOOST_CHECK(!cache.Lookup(hashA, NetMsgType::BLOCK, SERIALIZE_TRANSACTION_NO_WITNESS, found));
+
+    // Identity-matched payloads are not returned for another object
+    std::shared_ptr<const std::vector<unsigned char> > pvch = std::make_shared<const std::vector<unsigned char> >(vch);
+    std::shared_ptr<const std::vector<unsigned char> > pvchOther = std::make_shared<const std::vector<unsigned char> >(vch);
+    cache.Get(hashB, NetMsgType::TX, 0, pvch);
+    BOOST_CHECK(cache.Lookup(hashB, NetMsgType::TX, 0, found, pvch.get()));
+    BOOST_CHECK(!cache.Lookup(hashB, NetMsgType::TX, 0, found, pvchOther.get()));
+    BOOST_CHECK_EQUAL(cache.Size(), 2);
+
+    // The oldest payload is dropped when the limit is exceeded, while
+    // holders of it keep valid bytes
+    cache.Insert(hashB, NetMsgType::BLOCK, 0, CSharedBytes(std::vector<unsigned char>(400)));
+    BOOST_CHECK(!cache.Lookup(hashA, NetMsgType::BLOCK, 0, found));
+    BOOST_CHECK_EQUAL(cache.Size(), 2);
+    BOOST_CHECK(cache.Bytes() <= 1000);
+    BOOST_CHECK_EQUAL(payload.data()[payload.size() - 1], 0x42);
+
+    // The newest payload is kept even if it is larger than the limit
+    cache.Insert(hashA, NetMsgType::BLOCK, 0, CSharedBytes(std::vector<unsigned char>(2000)));
+    BOOST_CHECK_EQUAL(cache.Size(), 1);
+    BOOST_CHECK(cache.Lookup(hashA, NetMsgType::BLOCK, 0, found));
+    cache.Clear();
+    BOOST_CHECK_EQUAL(cache.Bytes(), 0);
+}
+
+#ifndef WIN32
+static void CheckSocketPoller(const std::string& strBackend)
+{
+    std::unique_ptr<CSocketPoller> poller = CreateSocketPoller(strBackend);
+    BOOST_REQUIRE(poller);
+    BOOST_CHECK_EQUAL(poller->GetName(), strBackend);
+
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    std::vector<SocketWatch> vWatch;
+    vWatch.push_back(SocketWatch(fds[0], 1, SOCKET_RECV));
+    CSocketPoller::ReadySockets vReady;
+
+    // Nothing to read yet
+    BOOST_CHECK(poller->Wait(vWatch, 0, vReady));
+    BOOST_CHECK(vReady.empty());
+
+    char ch = 'x';
+    BOOST_CHECK_EQUAL(send(fds[1], &ch, 1, 0), 1);
+    BOOST_CHECK(poller->Wait(vWatch, 1000, vReady));
+    BOOST_REQUIRE_EQUAL(vReady.size(), 1);
+    BOOST_CHECK_EQUAL(vReady[0].first, fds[0]);
+    BOOST_CHECK(vReady[0].second & SOCKET_RECV);
+
+    // Sockets can be watched for sending instead
+    vWatch[0].nEvents = SOCKET_SEND;
+    BOOST_CHECK(poller->Wait(vWatch, 1000, vReady));
+    BOOST_REQUIRE_EQUAL(vReady.size(), 1);
+    BOOST_CHECK_EQUAL(vReady[0].second & (SOCKET_RECV | SOCKET_SEND), SOCKET_SEND);
+
+    // A descriptor that is closed and reused by another owner is still watched
+    SOCKET hOld = fds[0];
+    close(fds[0]);
+    close(fds[1]);
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    BOOST_REQUIRE_EQUAL(fds[0], hOld);
+    vWatch[0] = SocketWatch(fds[0], 2, SOCKET_RECV);
+    BOOST_CHECK_EQUAL(send(fds[1], &ch, 1, 0), 1);
+    BOOST_CHECK(poller->Wait(vWatch, 1000, vReady));
+    BOOST_REQUIRE_EQUAL(vReady.size(), 1);
+    BOOST_CHECK(vReady[0].second & SOCKET_RECV);
+
+    // Sockets that are no longer listed are not reported
+    vWatch.clear();
+    BOOST_CHECK(poller->Wait(vWatch, 0, vReady));
+    BOOST_CHECK(vReady.empty());
+    close(fds[0]);
+    close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(socket_poller)
+{
+    CheckSocketPoller("select");
+#ifdef HAVE_SYS_EPOLL_H
+    CheckSocketPoller("epoll");
+#endif
+    BOOST_CHECK(!CreateSocketPoller("none"));
+}
+
+BOOST_AUTO_TEST_CASE(push_message_single_send_call)
+{
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CConnman connman(0x1337, 0x1337);
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CNode node(0, NODE_NETWORK, 0, fds[0], CAddress(CService(ipv4Addr, 7777), NODE_NETWORK), 0, 0, "", false);
+
+    // The header and the payload leave in one call
+    uint64_t nonce = 42;
+    uint64_t nTotalCalls = connman.GetTotalSendCalls();
+    uint64_t nTotalBytes = connman.GetTotalBytesSent();
+    connman.PushMessage(&node, CNetMsgMaker(INIT_PROTO_VERSION).Make(NetMsgType::PING, nonce));
+    BOOST_CHECK_EQUAL(node.nSendCalls, 1);
+    BOOST_CHECK_EQUAL(node.nSendBytes, CMessageHeader::HEADER_SIZE + sizeof(nonce));
+    BOOST_CHECK(node.vSendMsg.empty());
+    BOOST_CHECK_EQUAL(connman.GetTotalSendCalls() - nTotalCalls, 1);
+    BOOST_CHECK_EQUAL(connman.GetTotalBytesSent() - nTotalBytes, CMessageHeader::HEADER_SIZE + sizeof(nonce));
+
+    char buf[64];
+    BOOST_CHECK_EQUAL(recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT), (int)(CMessageHeader::HEADER_SIZE + sizeof(nonce)));
+    BOOST_CHECK(memcmp(buf + CMessageHeader::HEADER_SIZE, &nonce, sizeof(nonce)) == 0);
+    close(fds[1]);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(message_handler_threads)
+{
+    const int nNodes = 4;
+    const int nMessages = 50;
+    const int nThreads = 4;
+
+    // Record what the handler threads did; the checks run on this thread
+    std::mutex mutexLog;
+    std::map<NodeId, int> mapBusy;
+    std::map<NodeId, std::vector<int> > mapHandled;
+    int nHandled = 0;
+    bool fOverlap = false;
+
+    boost::signals2::scoped_connection connProcess = GetNodeSignals().ProcessMessages.connect(
+        [&](CNode* pnode, CConnman&, std::atomic<bool>&) {
+            {
+                std::lock_guard<std::mutex> lock(mutexLog);
+                if (mapBusy[pnode->GetId()]++ != 0)
+                    fOverlap = true;
+            }
+            std::list<CNetMessage> msgs;
+            bool fMoreWork;
+            {
+                LOCK(pnode->cs_vProcessMsg);
+                if (pnode->vProcessMsg.empty()) {
+                    std::lock_guard<std::mutex> lock(mutexLog);
+                    mapBusy[pnode->GetId()]--;
+                    return false;
+                }
+                msgs.splice(msgs.begin(), pnode->vProcessMsg, pnode->vProcessMsg.begin());
+                fMoreWork = !pnode->vProcessMsg.empty();
+            }
+            int nSequence;
+            msgs.front().vRecv >> nSequence;
+            // Give another thread the chance to pick up the same node
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            std::lock_guard<std::mutex> lock(mutexLog);
+            mapHandled[pnode->GetId()].push_back(nSequence);
+            nHandled++;
+            mapBusy[pnode->GetId()]--;
+            return fMoreWork;
+        });
+    boost::signals2::scoped_connection connSend = GetNodeSignals().SendMessages.connect(
+        [](CNode*, CConnman&, std::atomic<bool>&) { return true; });
+
+    CConnman connman(0x1337, 0x1337);
+    std::vector<std::unique_ptr<CNode> > vNodes;
+    for (int i = 0; i < nNodes; i++) {
+        in_addr ipv4Addr;
+        ipv4Addr.s_addr = 0xa0b0c001 + i;
+        vNodes.emplace_back(new CNode(i, NODE_NETWORK, 0, INVALID_SOCKET, CAddress(CService(ipv4Addr, 7777), NODE_NETWORK), 0, 0, "", false));
+        for (int n = 0; n < nMessages; n++) {
+            CNetMessage msg(Params().MessageStart(), SER_NETWORK, PROTOCOL_VERSION);
+            msg.vRecv << n;
+            vNodes.back()->vProcessMsg.push_back(std::move(msg));
+        }
+        CConnmanTest::AddNode(connman, vNodes.back().get());
+    }
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nThreads; i++)
+        threads.emplace_back(CConnmanTest::ThreadMessageHandler, std::ref(connman));
+
+    for (int i = 0; i < 1000; i++) {
+        {
+            std::lock_guard<std::mutex> lock(mutexLog);
+            if (nHandled == nNodes * nMessages)
+                break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    connman.Interrupt();
+    for (std::thread& thread : threads)
+        thread.join();
+    CConnmanTest::ClearNodes(connman);
+
+    BOOST_CHECK(!fOverlap);
+    BOOST_CHECK_EQUAL(nHandled, nNodes * nMessages);
+    for (int i = 0; i < nNodes; i++) {
+        const std::vector<int>& vHandled = mapHandled[i];
+        BOOST_CHECK_EQUAL(vHandled.size(), (size_t)nMessages);
+        for (size_t n = 0; n < vHandled.size(); n++)
+            BOOST_CHECK_EQUAL(vHandled[n], (int)n);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -4,9 +4,12 @@
 
 #include "chain.h"
 #include "chainparams.h"
+#include "clientversion.h"
 #include "pow.h"
 #include "random.h"
+#include "streams.h"
 #include "util.h"
+#include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 
 #include <boost/test/unit_test.hpp>
@@ -93,4 +96,71 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(blockindex_cached_powhash)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+
+    CBlockHeader header = Params().GenesisBlock().GetBlockHeader();
+    uint256 hash = header.GetHash();
+    CBlockIndex index(header);
+    index.phashBlock = &hash;
+    BOOST_CHECK(index.GetBlockPoWHash() == header.GetPoWHash());
+
+    CDataStream ssOld(SER_DISK, CLIENT_VERSION);
+    ssOld << CDiskBlockIndex(&index);
+
+    // The cached hash is returned without rehashing
+    uint256 hashPoW = uint256S("0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef");
+    index.SetBlockPoWHash(hashPoW);
+    BOOST_CHECK(index.GetBlockPoWHash() == hashPoW);
+
+    // It is stored apart from the index record, which serializes as before
+    CDataStream ssNew(SER_DISK, CLIENT_VERSION);
+    ssNew << CDiskBlockIndex(&index);
+    BOOST_CHECK(ssNew.str() == ssOld.str());
+    CDiskBlockIndex diskNew;
+    ssNew >> diskNew;
+    BOOST_CHECK(!(diskNew.nStatus & BLOCK_HAVE_POWHASH));
+    BOOST_CHECK(diskNew.GetBlockHash() == hash);
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_compact_verify)
+{
+    CBlockHeader header = Params(CBaseChainParams::MAIN).GenesisBlock().GetBlockHeader();
+    header.nTime = 1649496601;
+    std::vector<unsigned char> vchSig(CBlockIndexVerify::COMPACT_SIGNATURE_SIZE);
+    GetRandBytes(vchSig.data(), vchSig.size());
+    vchSig[0] = 31;
+
+    // A canonical signature is held in binary and rebuilt exactly
+    header.nVerify = EncodeBase64(vchSig.data(), vchSig.size());
+    CBlockIndex index(header);
+    BOOST_CHECK(index.verify.IsCompact());
+    BOOST_CHECK_EQUAL(index.verify.ToBase64(), header.nVerify);
+    BOOST_CHECK(index.GetBlockHeader().GetHash() == header.GetHash());
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << CDiskBlockIndex(&index);
+    CDiskBlockIndex diskindex;
+    ss >> diskindex;
+    BOOST_CHECK(diskindex.verify.IsCompact());
+    BOOST_CHECK(diskindex.GetBlockHash() == header.GetHash());
+
+    CBlockIndex copy(index);
+    BOOST_CHECK_EQUAL(copy.verify.ToBase64(), header.nVerify);
+
+    // Anything else is kept as text
+    const char* strOther[] = {"not base64", "AAAA", "H8LcgmyJnKK7SKUW19EVmYiXOtSCA88RTX+p+dBUSfUjLcdXM1ZnCqSk+mnoZ+xf1ohiBM4x+IhM1kZCATgvirk"};
+    for (const char* str : strOther) {
+        header.nVerify = str;
+        CBlockIndex other(header);
+        BOOST_CHECK(!other.verify.IsNull() && !other.verify.IsCompact());
+        BOOST_CHECK_EQUAL(other.verify.ToBase64(), header.nVerify);
+        BOOST_CHECK(other.GetBlockHeader().GetHash() == header.GetHash());
+    }
+
+    header.nVerify = "";
+    BOOST_CHECK(CBlockIndex(header).verify.IsNull());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
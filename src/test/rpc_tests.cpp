@@ -343,4 +343,65 @@ BOOST_AUTO_TEST_CASE(rpc_convert_values_generatetoaddress)
     BOOST_CHECK_EQUAL(result[2].get_int(), 9);
 }
 
+class TestJSONStreamWriter : public JSONStreamWriter
+{
+protected:
+    void WriteChunk(const std::string& strChunk)
+    {
+        vChunks.push_back(strChunk);
+    }
+
+public:
+    std::vector<std::string> vChunks;
+
+    std::string Output() const
+    {
+        return boost::algorithm::join(vChunks, "");
+    }
+};
+
+BOOST_AUTO_TEST_CASE(rpc_json_stream_writer)
+{
+    TestJSONStreamWriter stream;
+    BOOST_CHECK(!stream.IsUsed());
+    stream.BeginObject();
+    stream.Key("a\"b");
+    stream.Value(1);
+    stream.Key("list");
+    stream.BeginArray();
+    stream.Value("x");
+    stream.BeginObject();
+    stream.EndObject();
+    stream.BeginString();
+    stream.StringPart("00");
+    stream.StringPart("ff");
+    stream.EndString();
+    stream.EndArray();
+    stream.Key("empty");
+    stream.BeginArray();
+    stream.EndArray();
+    stream.EndObject();
+    BOOST_CHECK(stream.IsUsed());
+    // Nothing is handed out before a full chunk is buffered
+    BOOST_CHECK(stream.vChunks.empty());
+    stream.Flush();
+
+    UniValue expected;
+    BOOST_CHECK(expected.read("{\"a\\\"b\":1,\"list\":[\"x\",{},\"00ff\"],\"empty\":[]}"));
+    BOOST_CHECK_EQUAL(stream.Output(), expected.write());
+
+    // Large documents are split into chunks
+    TestJSONStreamWriter large;
+    large.BeginArray();
+    for (int i = 0; i < 100000; i++)
+        large.Value(i);
+    large.EndArray();
+    large.Flush();
+    BOOST_CHECK(large.vChunks.size() > 1);
+    UniValue result;
+    BOOST_CHECK(result.read(large.Output()));
+    BOOST_CHECK_EQUAL(result.size(), 100000);
+    BOOST_CHECK_EQUAL(result[99999].get_int(), 99999);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
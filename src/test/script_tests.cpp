@@ -7,9 +7,12 @@
 #include "core_io.h"
 #include "key.h"
 #include "keystore.h"
+#include "random.h"
 #include "script/script.h"
 #include "script/script_error.h"
+#include "script/sigcache.h"
 #include "script/sign.h"
+#include "validation.h"
 #include "util.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
@@ -1443,4 +1446,112 @@ BOOST_AUTO_TEST_CASE(script_FindAndDelete)
     BOOST_CHECK(s == expect);
 }
 
+BOOST_AUTO_TEST_CASE(script_RunChecks)
+{
+    // Spends of <pubkey> CHECKSIG with a good signature, of <pubkey> CHECKSIG
+    // NOT with a bad one, which are both valid, and of <pubkey> CHECKSIG with
+    // a bad signature, which is not. The second kind only passes a batch if
+    // the script is run again after the batch finds its signature invalid.
+    const unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC;
+    std::vector<CMutableTransaction> vCredit;
+    std::vector<CTransaction> vSpend;
+    std::vector<PrecomputedTransactionData> vTxData;
+    vSpend.reserve(30);
+    vTxData.reserve(30);
+    for (int i = 0; i < 30; i++) {
+        int nKind = i % 3;
+        CKey key;
+        key.MakeNewKey(i % 2 == 0);
+        CScript scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+        if (nKind == 1)
+            scriptPubKey << OP_NOT;
+        vCredit.push_back(BuildCreditingTransaction(scriptPubKey));
+        CMutableTransaction txSpend = BuildSpendingTransaction(CScript(), CScriptWitness(), vCredit.back());
+        uint256 hash = SignatureHash(scriptPubKey, txSpend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        if (nKind != 0)
+            hash = GetRandHash();
+        std::vector<unsigned char> vchSig;
+        BOOST_CHECK(key.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        txSpend.vin[0].scriptSig << vchSig;
+        vSpend.push_back(CTransaction(txSpend));
+        vTxData.push_back(PrecomputedTransactionData(vSpend.back()));
+    }
+
+    std::vector<CScriptCheck> vValid, vInvalid;
+    for (size_t i = 0; i < vSpend.size(); i++) {
+        CScriptCheck check(vCredit[i].vout[0], vSpend[i], 0, flags, false, &vTxData[i]);
+        BOOST_CHECK_EQUAL(check(), i % 3 != 2);
+        (i % 3 != 2 ? vValid : vInvalid).push_back(check);
+    }
+
+    BOOST_CHECK(RunChecks(vValid));
+    for (size_t i = 0; i < vInvalid.size(); i++) {
+        std::vector<CScriptCheck> vChecks(vValid);
+        vChecks.insert(vChecks.begin() + (i * 7) % vChecks.size(), vInvalid[i]);
+        BOOST_CHECK(!RunChecks(vChecks));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(script_RunChecks_multisig_and_cache)
+{
+    const unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC;
+
+    // A 2-of-3 multisig signed by the first and the last key. CHECKMULTISIG
+    // tries the second signature against the second key before the third.
+    CKey keys[3];
+    for (int i = 0; i < 3; i++)
+        keys[i].MakeNewKey(true);
+    CScript scriptMulti = CScript() << OP_2 << ToByteVector(keys[0].GetPubKey()) << ToByteVector(keys[1].GetPubKey()) << ToByteVector(keys[2].GetPubKey()) << OP_3 << OP_CHECKMULTISIG;
+    CMutableTransaction txCreditMulti = BuildCreditingTransaction(scriptMulti);
+    CMutableTransaction txSpendMulti = BuildSpendingTransaction(CScript(), CScriptWitness(), txCreditMulti);
+    uint256 hashMulti = SignatureHash(scriptMulti, txSpendMulti, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    txSpendMulti.vin[0].scriptSig << OP_0;
+    for (int i = 0; i < 3; i += 2) {
+        std::vector<unsigned char> vchSig;
+        BOOST_CHECK(keys[i].Sign(hashMulti, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        txSpendMulti.vin[0].scriptSig << vchSig;
+    }
+    CTransaction spendMulti(txSpendMulti);
+    PrecomputedTransactionData txdataMulti(spendMulti);
+    CScriptCheck checkMulti(txCreditMulti.vout[0], spendMulti, 0, flags, false, &txdataMulti);
+
+    // Its signatures are verified right away, not deferred
+    {
+        CDeferredSignatures deferred;
+        BOOST_CHECK(checkMulti.RunDeferred(deferred));
+        BOOST_CHECK_EQUAL(deferred.size(), 0U);
+    }
+
+    // A spend whose signature is in the cache
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction txCredit = BuildCreditingTransaction(scriptPubKey);
+    CMutableTransaction txSpend = BuildSpendingTransaction(CScript(), CScriptWitness(), txCredit);
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(SignatureHash(scriptPubKey, txSpend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE), vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    txSpend.vin[0].scriptSig << vchSig;
+    CTransaction spend(txSpend);
+    PrecomputedTransactionData txdata(spend);
+    BOOST_CHECK(CScriptCheck(txCredit.vout[0], spend, 0, flags, true, &txdata)());
+    CScriptCheck checkCached(txCredit.vout[0], spend, 0, flags, false, &txdata);
+
+    // A checker that does not store leaves the hit in the cache until the
+    // checks are done, as they may have to be run again
+    {
+        CDeferredSignatures deferred;
+        BOOST_CHECK(checkCached.RunDeferred(deferred));
+        BOOST_CHECK(checkCached.RunDeferred(deferred));
+        BOOST_CHECK_EQUAL(deferred.size(), 0U);
+    }
+
+    std::vector<CScriptCheck> vChecks;
+    vChecks.push_back(checkMulti);
+    vChecks.push_back(checkCached);
+    BOOST_CHECK(RunChecks(vChecks));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include "pubkey.h"
 #include "txmempool.h"
 #include "random.h"
+#include "script/sigcache.h"
 #include "script/standard.h"
 #include "test/test_bitcoin.h"
 #include "utiltime.h"
@@ -84,4 +85,73 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+// Whether the signature cache has the entry for a signature, without
+// verifying it
+static bool
+InSignatureCache(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& hash)
+{
+    CTransaction tx;
+    PrecomputedTransactionData txdata(tx);
+    CDeferredSignatures deferred;
+    DeferringTransactionSignatureChecker checker(&tx, 0, 0, true, txdata, deferred);
+    return checker.VerifySignature(vchSig, pubkey, hash) && deferred.size() == 0;
+}
+
+BOOST_FIXTURE_TEST_CASE(sigcache_persist, TestingSetup)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    uint256 hash = GetRandHash();
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(hash, vchSig));
+
+    CTransaction tx;
+    PrecomputedTransactionData txdata(tx);
+    CachingTransactionSignatureChecker checker(&tx, 0, 0, true, txdata);
+    BOOST_CHECK(checker.VerifySignature(vchSig, key.GetPubKey(), hash));
+    BOOST_CHECK(InSignatureCache(vchSig, key.GetPubKey(), hash));
+    DumpSignatureCache();
+
+    // A restart starts out with a new salt, and the saved one back
+    InitSignatureCache();
+    BOOST_CHECK(!InSignatureCache(vchSig, key.GetPubKey(), hash));
+    BOOST_CHECK(LoadSignatureCache());
+    BOOST_CHECK(InSignatureCache(vchSig, key.GetPubKey(), hash));
+
+    // A file saved under another node's key is ignored
+    boost::filesystem::path pathKey = GetDataDir() / "sigcache.key";
+    boost::filesystem::remove(pathKey);
+    DumpSignatureCache();
+    BOOST_CHECK(boost::filesystem::exists(pathKey));
+#ifndef WIN32
+    // Only readable by its owner
+    BOOST_CHECK((boost::filesystem::status(pathKey).permissions() & boost::filesystem::all_all) == (boost::filesystem::owner_read | boost::filesystem::owner_write));
+#endif
+    boost::filesystem::path path = GetDataDir() / "sigcache.dat";
+    boost::filesystem::path pathOther = GetDataDir() / "sigcache.other";
+    boost::filesystem::copy_file(path, pathOther);
+    boost::filesystem::remove(pathKey);
+    DumpSignatureCache();
+    boost::filesystem::remove(path);
+    boost::filesystem::rename(pathOther, path);
+    InitSignatureCache();
+    BOOST_CHECK(!LoadSignatureCache());
+    BOOST_CHECK(!InSignatureCache(vchSig, key.GetPubKey(), hash));
+
+    // So is one without its key
+    BOOST_CHECK(checker.VerifySignature(vchSig, key.GetPubKey(), hash));
+    DumpSignatureCache();
+    boost::filesystem::remove(pathKey);
+    InitSignatureCache();
+    BOOST_CHECK(!LoadSignatureCache());
+
+    // And a damaged one
+    BOOST_CHECK(checker.VerifySignature(vchSig, key.GetPubKey(), hash));
+    DumpSignatureCache();
+    boost::filesystem::resize_file(path, boost::filesystem::file_size(path) - 1);
+    InitSignatureCache();
+    BOOST_CHECK(!LoadSignatureCache());
+    BOOST_CHECK(!InSignatureCache(vchSig, key.GetPubKey(), hash));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -10,8 +10,11 @@
 #include "dbwrapper.h"
 #include "chain.h"
 
+#include <condition_variable>
 #include <map>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -27,6 +30,8 @@ static constexpr int DB_PEAK_USAGE_FACTOR = 2;
 static constexpr int MAX_BLOCK_COINSDB_USAGE = 200 * DB_PEAK_USAGE_FACTOR;
 //! Always periodic flush if less than this much space still available.
 static constexpr int MIN_BLOCK_COINSDB_USAGE = 50 * DB_PEAK_USAGE_FACTOR;
+//! Share of the coins cache limit (%) that is kept as unmodified entries after a flush made because of its size or age.
+static constexpr int COINS_CACHE_KEEP_PERCENT = 40;
 //! -dbcache default (MiB)
 static const int64_t nDefaultDbCache = 450;
 //! max. -dbcache (MiB)
@@ -75,11 +80,75 @@ protected:
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     CCoinsViewCursor *Cursor() const;
+
+    //! Same as BatchWrite, but leaves mapCoins untouched, so it can be read from while being written
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock);
+
+    //! Attempt to update from an older database format. Returns false on error or interruption.
+    bool Upgrade();
+};
+
+/**
+ * CCoinsView on top of the coin database that writes flushed changes on a
+ * background thread.
+ *
+ * BatchWrite() takes over the changes, hands them to the writer thread and
+ * returns right away, so a cache on top can be flushed without waiting for
+ * the database. Until they are written, lookups find the changes in memory.
+ * They are written in a single batch together with the best block marker,
+ * so after a crash the database is consistent at either the previous or the
+ * new best block.
+ *
+ * One set of changes is written at a time; BatchWrite() waits for the
+ * previous one first. If a write fails, further writes are refused.
+ */
+class CCoinsViewAsyncWriter : public CCoinsView
+{
+private:
+    CCoinsViewDB* db;
+
+    mutable std::mutex mutex;
+    mutable std::condition_variable cond;
+
+    //! Changes taken over by BatchWrite() that are not in the database yet
+    CCoinsMap mapPending;
+    uint256 hashPending;
+    //! Memory used by mapPending
+    size_t nPendingUsage;
+    //! Whether the writer thread has mapPending to write
+    bool fWriting;
+    bool fFailed;
+    bool fStop;
+
+    std::thread thread;
+
+    void ThreadWrite();
+
+public:
+    explicit CCoinsViewAsyncWriter(CCoinsViewDB* dbIn);
+    //! Writes the pending changes, if any, before returning
+    ~CCoinsViewAsyncWriter();
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
+    uint256 GetBestBlock() const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    //! Waits for the pending changes to be written first
+    CCoinsViewCursor *Cursor() const;
+
+    //! Wait until all changes taken over so far are written. Returns false if writing them failed.
+    bool Sync();
+
+    //! Whether writing changes to the database failed
+    bool HasFailed() const;
+
+    //! Memory used by the changes that are not written yet, which is on top of that of the caches
+    size_t DynamicMemoryUsage() const;
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -88,8 +157,8 @@ class CCoinsViewDBCursor: public CCoinsViewCursor
 public:
     ~CCoinsViewDBCursor() {}
 
-    bool GetKey(uint256 &key) const;
-    bool GetValue(CCoins &coins) const;
+    bool GetKey(COutPoint &key) const;
+    bool GetValue(Coin &coin) const;
     unsigned int GetValueSize() const;
 
     bool Valid() const;
@@ -99,7 +168,7 @@ private:
     CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn):
         CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
     std::unique_ptr<CDBIterator> pcursor;
-    std::pair<char, uint256> keyTmp;
+    std::pair<char, COutPoint> keyTmp;
 
     friend class CCoinsViewDB;
 };
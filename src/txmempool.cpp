@@ -116,9 +116,11 @@ void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendan
             cachedDescendants[updateIt].insert(cit);
             // Update ancestor state for each descendant
             mapTx.modify(cit, update_ancestor_state(updateIt->GetTxSize(), updateIt->GetModifiedFee(), 1, updateIt->GetSigOpCost()));
+            SnapshotEntryChanged(cit);
         }
     }
     mapTx.modify(updateIt, update_descendant_state(modifySize, modifyFee, modifyCount));
+    SnapshotEntryChanged(updateIt);
 }
 
 // vHashesToUpdate is the set of transaction hashes from a disconnected block
@@ -245,6 +247,7 @@ void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors
     const CAmount updateFee = updateCount * it->GetModifiedFee();
     BOOST_FOREACH(txiter ancestorIt, setAncestors) {
         mapTx.modify(ancestorIt, update_descendant_state(updateSize, updateFee, updateCount));
+        SnapshotEntryChanged(ancestorIt);
     }
 }
 
@@ -260,6 +263,7 @@ void CTxMemPool::UpdateEntryForAncestors(txiter it, const setEntries &setAncesto
         updateSigOpsCost += ancestorIt->GetSigOpCost();
     }
     mapTx.modify(it, update_ancestor_state(updateSize, updateFee, updateCount, updateSigOpsCost));
+    SnapshotEntryChanged(it);
 }
 
 void CTxMemPool::UpdateChildrenForRemoval(txiter it)
@@ -291,6 +295,7 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
             int modifySigOps = -removeIt->GetSigOpCost();
             BOOST_FOREACH(txiter dit, setDescendants) {
                 mapTx.modify(dit, update_ancestor_state(modifySize, modifyFee, -1, modifySigOps));
+                SnapshotEntryChanged(dit);
             }
         }
     }
@@ -348,8 +353,14 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee,
     assert(int(nSigOpCostWithAncestors) >= 0);
 }
 
+/** Memory used by a snapshot copy of an entry. The transaction itself is shared with mapTx. */
+static size_t SnapshotEntryUsage(const std::shared_ptr<const TxMempoolSnapshotEntry>& pentry)
+{
+    return memusage::DynamicUsage(pentry) + memusage::DynamicUsage(pentry->vDepends);
+}
+
 CTxMemPool::CTxMemPool(const CFeeRate& _minReasonableRelayFee) :
-    nTransactionsUpdated(0)
+    nTransactionsUpdated(0), fSnapshotTracked(false), cachedSnapshotUsage(0)
 {
     _clear(); //lock free clear
 
@@ -366,17 +377,10 @@ CTxMemPool::~CTxMemPool()
     delete minerPolicyEstimator;
 }
 
-void CTxMemPool::pruneSpent(const uint256 &hashTx, CCoins &coins)
+bool CTxMemPool::isSpent(const COutPoint& outpoint)
 {
     LOCK(cs);
-
-    auto it = mapNextTx.lower_bound(COutPoint(hashTx, 0));
-
-    // iterate over all COutPoints in mapNextTx whose hash equals the provided hashTx
-    while (it != mapNextTx.end() && it->first->hash == hashTx) {
-        coins.Spend(it->first->n); // and remove those outputs from coins
-        it++;
-    }
+    return mapNextTx.count(outpoint);
 }
 
 unsigned int CTxMemPool::GetTransactionsUpdated() const
@@ -400,6 +404,7 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     LOCK(cs);
     indexed_transaction_set::iterator newit = mapTx.insert(entry).first;
     mapLinks.insert(make_pair(newit, TxLinks()));
+    SnapshotEntryChanged(newit);
 
     // Update transaction for any feeDelta created by PrioritiseTransaction
     // TODO: refactor so that the fee delta is calculated before inserting
@@ -454,6 +459,15 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
 {
     NotifyEntryRemoved(it->GetSharedTx(), reason);
     const uint256 hash = it->GetTx().GetHash();
+    if (fSnapshotTracked) {
+        std::map<uint256, std::shared_ptr<const TxMempoolSnapshotEntry> >::iterator itSnapshot = mapSnapshotEntries.find(hash);
+        if (itSnapshot != mapSnapshotEntries.end()) {
+            cachedSnapshotUsage -= SnapshotEntryUsage(itSnapshot->second);
+            mapSnapshotEntries.erase(itSnapshot);
+        }
+        setSnapshotDirty.erase(hash);
+        snapshot.reset();
+    }
     BOOST_FOREACH(const CTxIn& txin, it->GetTx().vin)
         mapNextTx.erase(txin.prevout);
 
@@ -554,9 +568,9 @@ void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMem
                 indexed_transaction_set::const_iterator it2 = mapTx.find(txin.prevout.hash);
                 if (it2 != mapTx.end())
                     continue;
-                const CCoins *coins = pcoins->AccessCoins(txin.prevout.hash);
-                if (nCheckFrequency != 0) assert(coins);
-                if (!coins || (coins->IsCoinBase() && ((signed long)nMemPoolHeight) - coins->nHeight < COINBASE_MATURITY)) {
+                const Coin &coin = pcoins->AccessCoin(txin.prevout);
+                if (nCheckFrequency != 0) assert(!coin.IsSpent());
+                if (coin.IsSpent() || (coin.IsCoinBase() && ((signed long)nMemPoolHeight) - coin.nHeight < COINBASE_MATURITY)) {
                     txToRemove.insert(it);
                     break;
                 }
@@ -564,6 +578,7 @@ void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMem
         }
         if (!validLP) {
             mapTx.modify(it, update_lock_points(lp));
+            SnapshotEntryChanged(it);
         }
     }
     setEntries setAllRemoves;
@@ -633,6 +648,10 @@ void CTxMemPool::_clear()
     blockSinceLastRollingFeeBump = false;
     rollingMinimumFeeRate = 0;
     ++nTransactionsUpdated;
+    mapSnapshotEntries.clear();
+    setSnapshotDirty.clear();
+    cachedSnapshotUsage = 0;
+    snapshot.reset();
 }
 
 void CTxMemPool::clear()
@@ -684,8 +703,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                     parentSigOpCost += it2->GetSigOpCost();
                 }
             } else {
-                const CCoins* coins = pcoins->AccessCoins(txin.prevout.hash);
-                assert(coins && coins->IsAvailable(txin.prevout.n));
+                assert(pcoins->HaveCoin(txin.prevout));
             }
             // Check whether its inputs are marked in mapNextTx.
             auto it3 = mapNextTx.find(txin.prevout);
@@ -769,6 +787,11 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
 
     assert(totalTxSize == checkTotal);
     assert(innerUsage == cachedInnerUsage);
+
+    uint64_t snapshotUsage = 0;
+    for (const auto& item : mapSnapshotEntries)
+        snapshotUsage += SnapshotEntryUsage(item.second);
+    assert(snapshotUsage == cachedSnapshotUsage);
 }
 
 bool CTxMemPool::CompareDepthAndScore(const uint256& hasha, const uint256& hashb)
@@ -829,6 +852,59 @@ void CTxMemPool::queryHashes(std::vector<uint256>& vtxid)
     }
 }
 
+void CTxMemPool::SnapshotEntryChanged(txiter it)
+{
+    if (!fSnapshotTracked)
+        return;
+    setSnapshotDirty.insert(it->GetTx().GetHash());
+    snapshot.reset();
+}
+
+std::shared_ptr<const TxMempoolSnapshot> CTxMemPool::GetSnapshot() const
+{
+    LOCK(cs);
+    if (!fSnapshotTracked) {
+        // First caller: copy every entry, and from now on have the mutators
+        // record which entries need to be copied again
+        fSnapshotTracked = true;
+        for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); ++it)
+            setSnapshotDirty.insert(it->GetTx().GetHash());
+    }
+    if (!snapshot) {
+        BOOST_FOREACH(const uint256& hash, setSnapshotDirty) {
+            indexed_transaction_set::const_iterator it = mapTx.find(hash);
+            assert(it != mapTx.end());
+            std::shared_ptr<TxMempoolSnapshotEntry> pentry = std::make_shared<TxMempoolSnapshotEntry>(*it);
+            GetDepends(it->GetTx(), pentry->vDepends);
+            std::shared_ptr<const TxMempoolSnapshotEntry>& pslot = mapSnapshotEntries[hash];
+            if (pslot)
+                cachedSnapshotUsage -= SnapshotEntryUsage(pslot);
+            pslot = std::move(pentry);
+            cachedSnapshotUsage += SnapshotEntryUsage(pslot);
+        }
+        setSnapshotDirty.clear();
+
+        std::shared_ptr<TxMempoolSnapshot> newSnapshot = std::make_shared<TxMempoolSnapshot>();
+        newSnapshot->reserve(mapSnapshotEntries.size());
+        for (const auto& item : mapSnapshotEntries)
+            newSnapshot->push_back(item.second);
+        snapshot = std::move(newSnapshot);
+    }
+    return snapshot;
+}
+
+void CTxMemPool::GetDepends(const CTransaction& tx, std::vector<uint256>& vDepends) const
+{
+    LOCK(cs);
+    vDepends.clear();
+    BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+        if (mapTx.count(txin.prevout.hash))
+            vDepends.push_back(txin.prevout.hash);
+    }
+    std::sort(vDepends.begin(), vDepends.end());
+    vDepends.erase(std::unique(vDepends.begin(), vDepends.end()), vDepends.end());
+}
+
 static TxMempoolInfo GetInfo(CTxMemPool::indexed_transaction_set::const_iterator it) {
     return TxMempoolInfo{it->GetSharedTx(), it->GetTime(), CFeeRate(it->GetFee(), it->GetTxSize()), it->GetModifiedFee() - it->GetFee()};
 }
@@ -930,6 +1006,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const std::string str
         txiter it = mapTx.find(hash);
         if (it != mapTx.end()) {
             mapTx.modify(it, update_fee_delta(deltas.second));
+            SnapshotEntryChanged(it);
             // Now update all ancestors' modified fees with descendants
             setEntries setAncestors;
             uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -937,6 +1014,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const std::string str
             CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
             BOOST_FOREACH(txiter ancestorIt, setAncestors) {
                 mapTx.modify(ancestorIt, update_descendant_state(0, nFeeDelta, 0));
+                SnapshotEntryChanged(ancestorIt);
             }
             // Now update all descendants' modified fees with ancestors
             setEntries setDescendants;
@@ -944,6 +1022,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const std::string str
             setDescendants.erase(it);
             BOOST_FOREACH(txiter descendantIt, setDescendants) {
                 mapTx.modify(descendantIt, update_ancestor_state(0, nFeeDelta, 0, 0));
+                SnapshotEntryChanged(descendantIt);
             }
         }
     }
@@ -977,26 +1056,34 @@ bool CTxMemPool::HasNoInputsOf(const CTransaction &tx) const
 
 CCoinsViewMemPool::CCoinsViewMemPool(CCoinsView* baseIn, const CTxMemPool& mempoolIn) : CCoinsViewBacked(baseIn), mempool(mempoolIn) { }
 
-bool CCoinsViewMemPool::GetCoins(const uint256 &txid, CCoins &coins) const {
+bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     // If an entry in the mempool exists, always return that one, as it's guaranteed to never
     // conflict with the underlying cache, and it cannot have pruned entries (as it contains full)
     // transactions. First checking the underlying cache risks returning a pruned entry instead.
-    CTransactionRef ptx = mempool.get(txid);
+    CTransactionRef ptx = mempool.get(outpoint.hash);
     if (ptx) {
-        coins = CCoins(*ptx, MEMPOOL_HEIGHT);
-        return true;
+        if (outpoint.n < ptx->vout.size()) {
+            coin = Coin(ptx->vout[outpoint.n], MEMPOOL_HEIGHT, false);
+            return true;
+        } else {
+            return false;
+        }
     }
-    return (base->GetCoins(txid, coins) && !coins.IsPruned());
+    return (base->GetCoin(outpoint, coin) && !coin.IsSpent());
 }
 
-bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
-    return mempool.exists(txid) || base->HaveCoins(txid);
+bool CCoinsViewMemPool::HaveCoin(const COutPoint &outpoint) const {
+    return mempool.exists(outpoint) || base->HaveCoin(outpoint);
 }
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
     // Estimate the overhead of mapTx to be 15 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    // Snapshot copies only count while the pool holds them; readers may keep older ones alive
+    size_t nSnapshotUsage = memusage::DynamicUsage(mapSnapshotEntries) + memusage::DynamicUsage(setSnapshotDirty) + cachedSnapshotUsage;
+    if (snapshot)
+        nSnapshotUsage += memusage::DynamicUsage(snapshot) + memusage::DynamicUsage(*snapshot);
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage + nSnapshotUsage;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants, MemPoolRemovalReason reason) {
@@ -1048,8 +1135,10 @@ void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
     setEntries s;
     if (add && mapLinks[entry].parents.insert(parent).second) {
         cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
+        SnapshotEntryChanged(entry);
     } else if (!add && mapLinks[entry].parents.erase(parent)) {
         cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+        SnapshotEntryChanged(entry);
     }
 }
 
@@ -1101,7 +1190,7 @@ void CTxMemPool::trackPackageRemoved(const CFeeRate& rate) {
     }
 }
 
-void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRemaining) {
+void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining) {
     LOCK(cs);
 
     unsigned nTxnRemoved = 0;
@@ -1134,9 +1223,8 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRe
                 BOOST_FOREACH(const CTxIn& txin, tx.vin) {
                     if (exists(txin.prevout.hash))
                         continue;
-                    auto iter = mapNextTx.lower_bound(COutPoint(txin.prevout.hash, 0));
-                    if (iter == mapNextTx.end() || iter->first->hash != txin.prevout.hash)
-                        pvNoSpendsRemaining->push_back(txin.prevout.hash);
+                    if (!mapNextTx.count(txin.prevout))
+                        pvNoSpendsRemaining->push_back(txin.prevout);
                 }
             }
         }
@@ -42,7 +42,7 @@ inline bool AllowFree(double dPriority)
     return dPriority > AllowFreeThreshold();
 }
 
-/** Fake height value used in CCoins to signify they are only in the memory pool (since 0.8) */
+/** Fake height value used in Coin to signify they are only in the memory pool (since 0.8) */
 static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
 
 struct LockPoints
@@ -335,6 +335,20 @@ struct TxMempoolInfo
     int64_t nFeeDelta;
 };
 
+/**
+ * Copy of a mempool entry as taken by CTxMemPool::GetSnapshot(), along with
+ * the in-mempool transactions it spends outputs of.
+ */
+struct TxMempoolSnapshotEntry
+{
+    CTxMemPoolEntry entry;
+    std::vector<uint256> vDepends;
+
+    explicit TxMempoolSnapshotEntry(const CTxMemPoolEntry& entryIn) : entry(entryIn) {}
+};
+
+typedef std::vector<std::shared_ptr<const TxMempoolSnapshotEntry> > TxMempoolSnapshot;
+
 /** Reason why a transaction was removed from the mempool,
  * this is passed to the notification signal.
  */
@@ -511,6 +525,18 @@ private:
 
     std::vector<indexed_transaction_set::const_iterator> GetSortedDepthAndScore() const;
 
+    //! Copy of all entries shared by readers until mapTx changes, see GetSnapshot()
+    mutable std::shared_ptr<const TxMempoolSnapshot> snapshot;
+    //! Per-entry copies the next snapshot is assembled from; only kept once GetSnapshot() has been called
+    mutable std::map<uint256, std::shared_ptr<const TxMempoolSnapshotEntry> > mapSnapshotEntries;
+    //! Entries added or changed since their copy in mapSnapshotEntries was made
+    mutable std::set<uint256> setSnapshotDirty;
+    mutable bool fSnapshotTracked;
+    mutable uint64_t cachedSnapshotUsage; //!< sum of dynamic memory usage of the copies in mapSnapshotEntries
+
+    //! Record that an entry was added or modified, so that GetSnapshot() copies it again
+    void SnapshotEntryChanged(txiter it);
+
 public:
     indirectmap<COutPoint, const CTransaction*> mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
@@ -545,7 +571,17 @@ public:
     void _clear(); //lock free
     bool CompareDepthAndScore(const uint256& hasha, const uint256& hashb);
     void queryHashes(std::vector<uint256>& vtxid);
-    void pruneSpent(const uint256& hash, CCoins &coins);
+    /**
+     * Get a read-only copy of all entries, so that callers can walk the
+     * mempool (e.g. to build RPC replies) without holding cs while doing so.
+     * The copy is shared until the mempool is next modified. After that only
+     * the entries that were added or changed are copied again; the rest are
+     * shared with the previous snapshot.
+     */
+    std::shared_ptr<const TxMempoolSnapshot> GetSnapshot() const;
+    /** Get the in-mempool transactions that tx spends outputs of, sorted and without duplicates. */
+    void GetDepends(const CTransaction& tx, std::vector<uint256>& vDepends) const;
+    bool isSpent(const COutPoint& outpoint);
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
     /**
@@ -606,10 +642,10 @@ public:
     CFeeRate GetMinFee(size_t sizelimit) const;
 
     /** Remove transactions from the mempool until its dynamic size is <= sizelimit.
-      *  pvNoSpendsRemaining, if set, will be populated with the list of transactions
+      *  pvNoSpendsRemaining, if set, will be populated with the list of outpoints
       *  which are not in mempool which no longer have any spends in this mempool.
       */
-    void TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRemaining=NULL);
+    void TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining=NULL);
 
     /** Expire all transaction (and their dependencies) in the mempool older than time. Return the number of removed transactions. */
     int Expire(int64_t time);
@@ -635,6 +671,13 @@ public:
         return (mapTx.count(hash) != 0);
     }
 
+    bool exists(const COutPoint& outpoint) const
+    {
+        LOCK(cs);
+        auto it = mapTx.find(outpoint.hash);
+        return (it != mapTx.end() && outpoint.n < it->GetTx().vout.size());
+    }
+
     CTransactionRef get(const uint256& hash) const;
     TxMempoolInfo info(const uint256& hash) const;
     std::vector<TxMempoolInfo> infoAll() const;
@@ -716,8 +759,8 @@ protected:
 
 public:
     CCoinsViewMemPool(CCoinsView* baseIn, const CTxMemPool& mempoolIn);
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
 };
 
 // We want to sort transactions by coin age priority
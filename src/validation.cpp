@@ -7,12 +7,15 @@
 
 #include "arith_uint256.h"
 #include "base58.h"
+#include "blockpipeline.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "coinsprefetch.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/scrypt.h"
 #include "hash.h"
 #include "init.h"
 #include "policy/fees.h"
@@ -24,6 +27,7 @@
 #include "script/script.h"
 #include "script/sigcache.h"
 #include "script/standard.h"
+#include "sharedbytes.h"
 #include "timedata.h"
 #include "tinyformat.h"
 #include "txdb.h"
@@ -39,6 +43,7 @@
 
 #include <atomic>
 #include <sstream>
+#include <thread>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/join.hpp>
@@ -47,6 +52,13 @@
 #include <boost/math/distributions/poisson.hpp>
 #include <boost/thread.hpp>
 
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #if defined(NDEBUG)
 # error "Solidus cannot be compiled without assertions."
 #endif
@@ -71,6 +83,7 @@ bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
+bool fCheckBlockPoW = DEFAULT_CHECKBLOCKPOW;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
@@ -208,6 +221,9 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsPrefetcher *pcoinsPrefetcher = NULL;
+CBlockPipeline *pblockPipeline = NULL;
+CCoinsViewAsyncWriter *pcoinsWriter = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
 enum FlushStateMode {
@@ -396,15 +412,15 @@ bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp, bool
         prevheights.resize(tx.vin.size());
         for (size_t txinIndex = 0; txinIndex < tx.vin.size(); txinIndex++) {
             const CTxIn& txin = tx.vin[txinIndex];
-            CCoins coins;
-            if (!viewMemPool.GetCoins(txin.prevout.hash, coins)) {
+            Coin coin;
+            if (!viewMemPool.GetCoin(txin.prevout, coin)) {
                 return error("%s: Missing input", __func__);
             }
-            if (coins.nHeight == MEMPOOL_HEIGHT) {
+            if (coin.nHeight == MEMPOOL_HEIGHT) {
                 // Assume all mempool transaction confirm in the next block
                 prevheights[txinIndex] = tip->nHeight + 1;
             } else {
-                prevheights[txinIndex] = coins.nHeight;
+                prevheights[txinIndex] = coin.nHeight;
             }
         }
         lockPair = CalculateSequenceLocks(tx, flags, &prevheights, index);
@@ -544,9 +560,9 @@ void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age) {
     if (expired != 0)
         LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
 
-    std::vector<uint256> vNoSpendsRemaining;
+    std::vector<COutPoint> vNoSpendsRemaining;
     pool.TrimToSize(limit, &vNoSpendsRemaining);
-    BOOST_FOREACH(const uint256& removed, vNoSpendsRemaining)
+    BOOST_FOREACH(const COutPoint& removed, vNoSpendsRemaining)
         pcoinsTip->Uncache(removed);
 }
 
@@ -573,7 +589,7 @@ static bool IsCurrentForFeeEstimation()
 
 bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx, bool fLimitFree,
                               bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
-                              bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<uint256>& vHashTxnToUncache)
+                              bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache)
 {
     const CTransaction& tx = *ptx;
     const uint256 hash = tx.GetHash();
@@ -666,20 +682,29 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         view.SetBackend(viewMemPool);
 
         // do we already have it?
-        bool fHadTxInCache = pcoinsTip->HaveCoinsInCache(hash);
-        if (view.HaveCoins(hash)) {
-            if (!fHadTxInCache)
-                vHashTxnToUncache.push_back(hash);
-            return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+        for (size_t out = 0; out < tx.vout.size(); out++) {
+            COutPoint outpoint(hash, out);
+            bool fHadCoinInCache = pcoinsTip->HaveCoinInCache(outpoint);
+            if (view.HaveCoin(outpoint)) {
+                if (!fHadCoinInCache)
+                    coins_to_uncache.push_back(outpoint);
+                return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+            }
         }
 
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // and only helps with filling in pfMissingInputs (to determine missing vs spent).
         BOOST_FOREACH(const CTxIn txin, tx.vin) {
-            if (!pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
-                vHashTxnToUncache.push_back(txin.prevout.hash);
-            if (!view.HaveCoins(txin.prevout.hash)) {
+            if (!pcoinsTip->HaveCoinInCache(txin.prevout))
+                coins_to_uncache.push_back(txin.prevout);
+            if (!view.HaveCoin(txin.prevout)) {
+                // Are inputs missing because we already have the tx?
+                for (size_t out = 0; out < tx.vout.size(); out++) {
+                    // Optimistically just do efficient check of cache for outputs
+                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out))) {
+                        return state.Invalid(false, REJECT_DUPLICATE, "txn-already-known");
+                    }
+                }
+                // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
                 if (pfMissingInputs)
                     *pfMissingInputs = true;
                 return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
@@ -731,8 +756,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // during reorgs to ensure COINBASE_MATURITY is still met.
         bool fSpendsCoinbase = false;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            const CCoins *coins = view.AccessCoins(txin.prevout.hash);
-            if (coins->IsCoinBase()) {
+            const Coin &coin = view.AccessCoin(txin.prevout);
+            if (coin.IsCoinBase()) {
                 fSpendsCoinbase = true;
                 break;
             }
@@ -1017,11 +1042,11 @@ bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
                         bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
 {
-    std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
+    std::vector<COutPoint> coins_to_uncache;
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee, coins_to_uncache);
     if (!res) {
-        BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
-            pcoinsTip->Uncache(hashTx);
+        BOOST_FOREACH(const COutPoint& outpoint, coins_to_uncache)
+            pcoinsTip->Uncache(outpoint);
     }
     // After we've (potentially) uncached entries, ensure our coins cache is still within its size limits
     CValidationState stateDummy;
@@ -1074,10 +1099,9 @@ bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
         int nHeight = -1;
         {
-            const CCoinsViewCache& view = *pcoinsTip;
-            const CCoins* coins = view.AccessCoins(hash);
-            if (coins)
-                nHeight = coins->nHeight;
+            const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+            if (!coin.IsSpent())
+                nHeight = coin.nHeight;
         }
         if (nHeight > 0)
             pindexSlow = chainActive[nHeight];
@@ -1166,6 +1190,165 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+#ifndef WIN32
+namespace {
+
+/** Maximum number of block files kept memory mapped for ReadRawBlockFromDisk */
+static const unsigned int MAX_MAPPED_BLOCK_FILES = 8;
+
+/** Read-only memory mapping of the start of a block file */
+struct CBlockFileMapping
+{
+    const unsigned char* pbegin;
+    size_t nSize;
+
+    CBlockFileMapping(void* pbeginIn, size_t nSizeIn) : pbegin((const unsigned char*)pbeginIn), nSize(nSizeIn) {}
+    ~CBlockFileMapping() { munmap((void*)pbegin, nSize); }
+};
+
+CCriticalSection cs_blockFileMappings;
+/** Mapped block files by file number, with the sequence number of their last use */
+std::map<int, std::pair<uint64_t, std::shared_ptr<const CBlockFileMapping> > > mapBlockFileMappings;
+uint64_t nBlockFileMappingSequence = 0;
+
+/**
+ * Get a mapping of block file nFile that covers at least its first nMinSize
+ * bytes. Files grow as blocks are appended, so a cached mapping that is too
+ * short is replaced by a new one. Mappings handed out earlier remain valid.
+ */
+std::shared_ptr<const CBlockFileMapping> MapBlockFile(int nFile, size_t nMinSize)
+{
+    LOCK(cs_blockFileMappings);
+    auto it = mapBlockFileMappings.find(nFile);
+    if (it != mapBlockFileMappings.end() && it->second.second->nSize >= nMinSize) {
+        it->second.first = ++nBlockFileMappingSequence;
+        return it->second.second;
+    }
+
+    int fd = open(GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk").string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return nullptr;
+    struct stat st;
+    void* p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && (uint64_t)st.st_size >= nMinSize)
+        p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return nullptr;
+    std::shared_ptr<const CBlockFileMapping> mapping = std::make_shared<const CBlockFileMapping>(p, st.st_size);
+
+    if (it == mapBlockFileMappings.end() && mapBlockFileMappings.size() >= MAX_MAPPED_BLOCK_FILES) {
+        // Evict the least recently used mapping
+        auto itOldest = mapBlockFileMappings.begin();
+        for (auto itMapping = mapBlockFileMappings.begin(); itMapping != mapBlockFileMappings.end(); ++itMapping) {
+            if (itMapping->second.first < itOldest->second.first)
+                itOldest = itMapping;
+        }
+        mapBlockFileMappings.erase(itOldest);
+    }
+    mapBlockFileMappings[nFile] = std::make_pair(++nBlockFileMappingSequence, mapping);
+    return mapping;
+}
+
+} // anon namespace
+#endif
+
+bool ReadRawBlockFromDisk(CSharedBytes& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    block = CSharedBytes();
+
+    // The block is preceded by the network magic and its size
+    static const unsigned int nIndexHeaderSize = CMessageHeader::MESSAGE_START_SIZE + sizeof(uint32_t);
+    if (pos.IsNull() || pos.nPos < nIndexHeaderSize)
+        return error("%s: Invalid block position %s", __func__, pos.ToString());
+    CDiskBlockPos posHeader(pos.nFile, pos.nPos - nIndexHeaderSize);
+
+#ifndef WIN32
+    std::shared_ptr<const CBlockFileMapping> mapping = MapBlockFile(pos.nFile, pos.nPos);
+    if (mapping) {
+        const unsigned char* pheader = mapping->pbegin + posHeader.nPos;
+        if (memcmp(pheader, messageStart, CMessageHeader::MESSAGE_START_SIZE) != 0)
+            return error("%s: Block magic mismatch at %s", __func__, pos.ToString());
+        uint32_t nSize = ReadLE32(pheader + CMessageHeader::MESSAGE_START_SIZE);
+        if (nSize > MAX_BLOCK_SERIALIZED_SIZE)
+            return error("%s: Block size %u too large at %s", __func__, nSize, pos.ToString());
+        if ((size_t)pos.nPos + nSize > mapping->nSize) {
+            mapping = MapBlockFile(pos.nFile, (size_t)pos.nPos + nSize);
+            if (!mapping)
+                return error("%s: Block at %s extends beyond the end of its file", __func__, pos.ToString());
+        }
+        block = CSharedBytes(mapping, mapping->pbegin + pos.nPos, nSize);
+        return true;
+    }
+#endif
+
+    // Mapping not available; read a copy instead
+    CAutoFile filein(OpenBlockFile(posHeader, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+
+    try {
+        CMessageHeader::MessageStartChars blk_start;
+        unsigned int nSize;
+        filein >> FLATDATA(blk_start) >> nSize;
+        if (memcmp(blk_start, messageStart, CMessageHeader::MESSAGE_START_SIZE) != 0)
+            return error("%s: Block magic mismatch at %s", __func__, pos.ToString());
+        if (nSize > MAX_BLOCK_SERIALIZED_SIZE)
+            return error("%s: Block size %u too large at %s", __func__, nSize, pos.ToString());
+        std::vector<unsigned char> vch(nSize);
+        filein.read((char*)vch.data(), nSize);
+        block = CSharedBytes(std::move(vch));
+    }
+    catch (const std::exception& e) {
+        return error("%s: Read from block file failed: %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    return true;
+}
+
+/** Hash of the header at the start of a serialized block, or null if there is no complete header */
+static uint256 GetRawBlockHeaderHash(const CSharedBytes& block)
+{
+    // nVersion, hashPrevBlock, hashMerkleRoot, nTime, nBits and nNonce
+    static const size_t nFixedSize = 4 + 32 + 32 + 4 + 4 + 4;
+    if (block.size() < nFixedSize)
+        return uint256();
+    size_t nHeaderSize = nFixedSize;
+    // Followed by nVerify after the fork, see CBlockHeader
+    if (ReadLE32(block.data() + 4 + 32 + 32) > 1649496600) {
+        try {
+            const char* pbegin = (const char*)block.data();
+            CDataStream ss(pbegin + nFixedSize, pbegin + std::min(block.size(), nFixedSize + 9), SER_NETWORK, PROTOCOL_VERSION);
+            size_t nPrefixSize = ss.size();
+            uint64_t nVerifySize = ReadCompactSize(ss);
+            if (nVerifySize > block.size())
+                return uint256();
+            nHeaderSize += nPrefixSize - ss.size() + nVerifySize;
+        } catch (const std::exception&) {
+            return uint256();
+        }
+        if (nHeaderSize > block.size())
+            return uint256();
+    }
+    return Hash(block.begin(), block.begin() + nHeaderSize);
+}
+
+bool ReadRawBlockFromDisk(CSharedBytes& block, const CDiskBlockPos& pos, const uint256& hash, const CMessageHeader::MessageStartChars& messageStart)
+{
+    if (!ReadRawBlockFromDisk(block, pos, messageStart))
+        return false;
+    if (GetRawBlockHeaderHash(block) != hash) {
+        block = CSharedBytes();
+        return error("%s: Block header hash mismatch at %s", __func__, pos.ToString());
+    }
+    return true;
+}
+
+bool ReadRawBlockFromDisk(CSharedBytes& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    return ReadRawBlockFromDisk(block, pindex->GetBlockPos(), pindex->GetBlockHash(), messageStart);
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -1339,24 +1522,14 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
-            unsigned nPos = txin.prevout.n;
-
-            if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
-                assert(false);
             // mark an outpoint spent, and construct undo information
-            txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
-            coins->Spend(nPos);
-            if (coins->vout.size() == 0) {
-                CTxInUndo& undo = txundo.vprevout.back();
-                undo.nHeight = coins->nHeight;
-                undo.fCoinBase = coins->fCoinBase;
-                undo.nVersion = coins->nVersion;
-            }
+            txundo.vprevout.emplace_back();
+            bool is_spent = inputs.SpendCoin(txin.prevout, &txundo.vprevout.back());
+            assert(is_spent);
         }
     }
     // add outputs
-    inputs.ModifyNewCoins(tx.GetHash(), tx.IsCoinBase())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
@@ -1374,6 +1547,48 @@ bool CScriptCheck::operator()() {
     return true;
 }
 
+bool CScriptCheck::RunDeferred(CDeferredSignatures& deferred) {
+    const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
+    const CScriptWitness *witness = &ptxTo->vin[nIn].scriptWitness;
+    return VerifyScript(scriptSig, scriptPubKey, witness, nFlags, DeferringTransactionSignatureChecker(ptxTo, nIn, amount, cacheStore, *txdata, deferred), &error);
+}
+
+bool RunChecks(std::vector<CScriptCheck>& vChecks)
+{
+    if (vChecks.size() < 2)
+        return vChecks.empty() || vChecks[0]();
+
+    CDeferredSignatures deferred;
+    // Where the deferred signatures of each check start
+    std::vector<size_t> vStart(vChecks.size() + 1);
+    for (size_t i = 0; i < vChecks.size(); i++) {
+        vStart[i] = deferred.size();
+        if (!vChecks[i].RunDeferred(deferred)) {
+            // The failure may come from a bad signature that was taken as
+            // valid and sent the script down another branch; only a run that
+            // verifies its signatures can tell.
+            deferred.resize(vStart[i]);
+            if (!vChecks[i]())
+                return false;
+        }
+    }
+    vStart[vChecks.size()] = deferred.size();
+
+    std::vector<bool> vValid;
+    if (deferred.Verify(vValid))
+        return true;
+    for (size_t i = 0; i < vChecks.size(); i++) {
+        for (size_t j = vStart[i]; j < vStart[i + 1]; j++) {
+            if (!vValid[j]) {
+                if (!vChecks[i]())
+                    return false;
+                break;
+            }
+        }
+    }
+    return true;
+}
+
 int GetSpendHeight(const CCoinsViewCache& inputs)
 {
     LOCK(cs_main);
@@ -1394,20 +1609,20 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
             const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase()) {
-                if (nSpendHeight - coins->nHeight < COINBASE_MATURITY)
+            if (coin.IsCoinBase()) {
+                if (nSpendHeight - coin.nHeight < COINBASE_MATURITY)
                     return state.Invalid(false,
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase",
-                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight));
+                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coin.nHeight));
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputvalues-outofrange");
 
         }
@@ -1449,11 +1664,11 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         if (fScriptChecks) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore, &txdata);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore, &txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1465,7 +1680,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check2(*coins, tx, i,
+                        CScriptCheck check2(coin.out, tx, i,
                                 flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, &txdata);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -1562,37 +1777,41 @@ bool AbortNode(CValidationState& state, const std::string& strMessage, const std
 
 } // anon namespace
 
+enum DisconnectResult
+{
+    DISCONNECT_OK,      // All good.
+    DISCONNECT_UNCLEAN, // Rolled back, but UTXO set was inconsistent with block.
+    DISCONNECT_FAILED   // Something else went wrong.
+};
+
 /**
- * Apply the undo operation of a CTxInUndo to the given chain state.
- * @param undo The undo object.
+ * Restore the UTXO in a Coin at a given COutPoint
+ * @param undo The Coin to be restored.
  * @param view The coins view to which to apply the changes.
  * @param out The out point that corresponds to the tx input.
- * @return True on success.
+ * @return A DisconnectResult as an int
  */
-bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 {
     bool fClean = true;
 
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
-            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
+    if (view.HaveCoin(out)) fClean = false; // overwriting transaction output
+
+    if (undo.nHeight == 0) {
+        // Missing undo metadata (height and coinbase). Older versions included this
+        // information only in undo records for the last spend of a transactions'
+        // outputs. This implies that it must be present for some other output of the same tx.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (!alternate.IsSpent()) {
+            undo.nHeight = alternate.nHeight;
+            undo.fCoinBase = alternate.fCoinBase;
+        } else {
+            return DISCONNECT_FAILED; // adding output for transaction without known metadata
+        }
     }
-    if (coins->IsAvailable(out.n))
-        fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
+    view.AddCoin(out, std::move(undo), !fClean);
 
-    return fClean;
+    return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
 bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
@@ -1619,35 +1838,33 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
         const CTransaction &tx = *(block.vtx[i]);
         uint256 hash = tx.GetHash();
 
+        bool is_coinbase = tx.IsCoinBase();
+
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
-
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule.
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
-
-        // remove outputs
-        outs->Clear();
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                COutPoint out(hash, o);
+                Coin coin;
+                bool is_spent = view.SpendCoin(out, &coin);
+                if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != (int)coin.nHeight || is_coinbase != (bool)coin.fCoinBase) {
+                    fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
+                }
+            }
         }
 
         // restore inputs
         if (i > 0) { // not coinbases
-            const CTxUndo &txundo = blockUndo.vtxundo[i-1];
+            CTxUndo &txundo = blockUndo.vtxundo[i-1];
             if (txundo.vprevout.size() != tx.vin.size())
                 return error("DisconnectBlock(): transaction and undo data inconsistent");
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
-                const CTxInUndo &undo = txundo.vprevout[j];
-                if (!ApplyTxInUndo(undo, view, out))
-                    fClean = false;
+                int res = ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out);
+                if (res == DISCONNECT_FAILED)
+                    return error("DisconnectBlock(): undo data adding output for transaction without known metadata");
+                if (res == DISCONNECT_UNCLEAN)
+                    fClean = fClean && error("DisconnectBlock(): undo data overwriting existing output");
             }
         }
     }
@@ -1695,6 +1912,21 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+void ThreadCoinsPrefetch() {
+    RenameThread("bitcoin-prefetch");
+    pcoinsPrefetcher->Thread();
+}
+
+void ThreadBlockCheck() {
+    RenameThread("bitcoin-blockchk");
+    pblockPipeline->CheckThread();
+}
+
+void ThreadBlockConnect() {
+    RenameThread("bitcoin-blockcon");
+    pblockPipeline->ConnectThread();
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -1829,10 +2061,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (fEnforceBIP30) {
         for (const auto& tx : block.vtx) {
-            const CCoins* coins = view.AccessCoins(tx->GetHash());
-            if (coins && !coins->IsPruned())
-                return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
-                                 REJECT_INVALID, "bad-txns-BIP30");
+            for (size_t o = 0; o < tx->vout.size(); o++) {
+                if (view.HaveCoin(COutPoint(tx->GetHash(), o))) {
+                    return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
+                                     REJECT_INVALID, "bad-txns-BIP30");
+                }
+            }
         }
     }
 
@@ -1899,7 +2133,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             // be in ConnectBlock because they require the UTXO set
             prevheights.resize(tx.vin.size());
             for (size_t j = 0; j < tx.vin.size(); j++) {
-                prevheights[j] = view.AccessCoins(tx.vin[j].prevout.hash)->nHeight;
+                prevheights[j] = view.AccessCoin(tx.vin[j].prevout).nHeight;
             }
 
             if (!SequenceLocks(tx, nLockTimeFlags, &prevheights, *pindex)) {
@@ -2013,6 +2247,9 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode, int n
     static int64_t nLastSetChain = 0;
     std::set<int> setFilesToPrune;
     bool fFlushForPrune = false;
+    // A background write of the chainstate failed since the last call
+    if (pcoinsWriter && pcoinsWriter->HasFailed())
+        return AbortNode(state, "Failed to write to coin database");
     try {
     if (fPruneMode && (fCheckForPruning || nManualPruneHeight > 0) && !fReindex) {
         if (nManualPruneHeight > 0) {
@@ -2041,7 +2278,8 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode, int n
         nLastSetChain = nNow;
     }
     int64_t nMempoolSizeMax = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
-    int64_t cacheSize = pcoinsTip->DynamicMemoryUsage() * DB_PEAK_USAGE_FACTOR;
+    // Changes still being written in the background use memory on top of the cache
+    int64_t cacheSize = (pcoinsTip->DynamicMemoryUsage() + (pcoinsWriter ? pcoinsWriter->DynamicMemoryUsage() : 0)) * DB_PEAK_USAGE_FACTOR;
     int64_t nTotalSpace = nCoinCacheUsage + std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
     // The cache is large and we're within 10% and 200 MiB or 50% and 50MiB of the limit, but we have time now (not in the middle of a block processing).
     bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize > std::min(std::max(nTotalSpace / 2, nTotalSpace - MIN_BLOCK_COINSDB_USAGE * 1024 * 1024),
@@ -2079,23 +2317,52 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode, int n
                 return AbortNode(state, "Failed to write to block index database");
             }
         }
-        // Finally remove any pruned files
-        if (fFlushForPrune)
+        // Finally remove any pruned files, once the chainstate written in
+        // the background no longer needs them to be replayed
+        if (fFlushForPrune) {
+            if (pcoinsWriter && !pcoinsWriter->Sync())
+                return AbortNode(state, "Failed to write to coin database");
             UnlinkPrunedFiles(setFilesToPrune);
+        }
         nLastWrite = nNow;
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
     if (fDoFullFlush) {
-        // Typical CCoins structures on disk are around 128 bytes in size.
+        // Typical Coin structures on disk are around 48 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
-        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
+        // Prefetched coins read around the write may be outdated.
+        // Flushes made because the cache grew large or it has been a while
+        // keep the unmodified entries of the most recent coins in the cache,
+        // and are written in the background while validation goes on.
+        // Explicit flushes empty the cache, and like those for pruning, wait
+        // for the write.
+        bool fKeepCache = mode == FLUSH_STATE_IF_NEEDED || mode == FLUSH_STATE_PERIODIC;
+        if (pcoinsPrefetcher)
+            pcoinsPrefetcher->Invalidate();
+        int64_t nTimeFlushStart = GetTimeMicros();
+        bool fFlushed = fKeepCache ? pcoinsTip->Sync() : pcoinsTip->Flush();
+        if (pcoinsPrefetcher)
+            pcoinsPrefetcher->Invalidate();
+        if (fFlushed && pcoinsWriter && (!fKeepCache || fFlushForPrune))
+            fFlushed = pcoinsWriter->Sync();
+        if (!fFlushed)
             return AbortNode(state, "Failed to write to coin database");
+        size_t nEvicted = 0;
+        if (fKeepCache) {
+            // The changes handed to the writer are still in memory until
+            // they are written, so leave room for them next to the cache
+            int64_t nKeep = nTotalSpace / DB_PEAK_USAGE_FACTOR * COINS_CACHE_KEEP_PERCENT / 100;
+            int64_t nPendingUsage = pcoinsWriter ? pcoinsWriter->DynamicMemoryUsage() : 0;
+            nEvicted = pcoinsTip->Trim(std::max<int64_t>(std::min(nKeep, nTotalSpace / DB_PEAK_USAGE_FACTOR - nPendingUsage), 0));
+        }
+        LogPrint("bench", "  - Flush chainstate: %.2fms, %u entries dropped, %u kept%s\n", (GetTimeMicros() - nTimeFlushStart) * 0.001,
+            (unsigned int)nEvicted, pcoinsTip->GetCacheSize(), pcoinsWriter && fKeepCache && !fFlushForPrune ? " (writing in background)" : "");
         nLastFlush = nNow;
     }
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
@@ -2239,6 +2506,7 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetchTotal = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
@@ -2280,6 +2548,12 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    if (pcoinsPrefetcher) {
+        pcoinsPrefetcher->Apply(blockConnecting, pindexNew->nHeight, *pcoinsTip);
+        int64_t nTimePrefetch = GetTimeMicros(); nTimePrefetchTotal += nTimePrefetch - nTime2;
+        LogPrint("bench", "  - Prefetch inputs: %.2fms [%.2fs]\n", (nTimePrefetch - nTime2) * 0.001, nTimePrefetchTotal * 0.000001);
+        nTime2 = nTimePrefetch;
+    }
     {
         CCoinsViewCache view(pcoinsTip);
         bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
@@ -2671,7 +2945,7 @@ bool ResetBlockFailureFlags(CBlockIndex *pindex) {
     return true;
 }
 
-CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
+CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const uint256& hashPoW)
 {
     // Check for duplicate
     uint256 hash = block.GetHash();
@@ -2684,6 +2958,8 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
     // Construct new block index object
     CBlockIndex* pindexNew = new CBlockIndex(block);
     assert(pindexNew);
+    if (!hashPoW.IsNull())
+        pindexNew->SetBlockPoWHash(hashPoW);
     
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
@@ -2851,15 +3127,23 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     return true;
 }
 
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW)
+static bool CheckBlockHeaderPoW(const CBlockHeader& block, const uint256& hashPoW, CValidationState& state, const Consensus::Params& consensusParams)
 {
     // Check proof of work matches claimed amount
-    if (fCheckPOW && !CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams))
+    if (!CheckProofOfWork(hashPoW, block.nBits, consensusParams))
         return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed");
 
     return true;
 }
 
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW)
+{
+    if (fCheckPOW && !CheckBlockHeaderPoW(block, block.GetPoWHash(), state, consensusParams))
+        return false;
+
+    return true;
+}
+
 bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     // These are checks that are independent of context.
@@ -2873,26 +3157,10 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
 
     //// Verify Block
     if (fCheckPOW && block.nTime > 1649496600 /*chainActive.Height() > Params().GetForkHeight()*/) {
-        CBitcoinAddress addr("SWScdsR85bFkKeyYEtamhMjKVg1aN6LLTy");
-        CTxDestination destination = addr.Get();
-        const CKeyID* keyID = boost::get<CKeyID>(&destination);
-        bool fInvalid = false;
-        std::vector<unsigned char> vchSig = DecodeBase64(block.nVerify.c_str(), &fInvalid);
-        CPubKey pubkey;
-        CHashWriter ss(SER_GETHASH, 0);
-        /*ss << block.nTime;
-        ss << block.nBits;
-        ss << block.nNonce;
-        ss << block.hashPrevBlock;*/
-
-        const std::string strMessageMagic = "Solidus Signed Message:\n";
-        const std::string strMessage = block.hashPrevBlock.ToString();
-
-        ss << strMessageMagic;
-        ss << strMessage;
-
-        pubkey.RecoverCompact(ss.GetHash(), vchSig);
-        if (pubkey.GetID() != *keyID) {
+        // The miner key ID is decoded once with the chain params; networks
+        // without a miner key cannot validate post-fork blocks.
+        if (consensusParams.minerKeyID.IsNull() ||
+            !CheckMinerSignature(block.hashPrevBlock, block.nVerify, CKeyID(consensusParams.minerKeyID))) {
             LogPrintf("ERROR : Miner Key Validation Failed.\n");
             return false;
         }
@@ -3141,13 +3409,14 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, const Co
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, const uint256* phashPoW = NULL)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
     uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = NULL;
+    uint256 hashPoW;
     if (hash != chainparams.GetConsensus().hashGenesisBlock) {
 
         if (miSelf != mapBlockIndex.end()) {
@@ -3160,7 +3429,10 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        // The scrypt hash is computed once (here, or batched by the caller) and
+        // cached in the new block index entry
+        hashPoW = (phashPoW && !phashPoW->IsNull()) ? *phashPoW : block.GetPoWHash();
+        if (!CheckBlockHeaderPoW(block, hashPoW, state, chainparams.GetConsensus()))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -3180,7 +3452,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return error("%s: Consensus::ContextualCheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
     }
     if (pindex == NULL)
-        pindex = AddToBlockIndex(block);
+        pindex = AddToBlockIndex(block, hashPoW);
 
     if (ppindex)
         *ppindex = pindex;
@@ -3190,14 +3462,46 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
     return true;
 }
 
+/**
+ * Hash the next scrypt_multi_ways() headers at or after nStart that are not in
+ * mapBlockIndex yet with one multi-lane scrypt call, storing the results in
+ * vHashPoW. Only a small batch is hashed ahead, so a headers message whose
+ * first entries are invalid still costs little work. Returns the index of the
+ * first header past the batch.
+ */
+static size_t BatchHeaderPoWHashes(const std::vector<CBlockHeader>& headers, size_t nStart, std::vector<uint256>& vHashPoW)
+{
+    AssertLockHeld(cs_main);
+    const size_t nWays = scrypt_multi_ways();
+    std::vector<CBlockHeader> vBatch;
+    std::vector<size_t> vPos;
+    size_t i = nStart;
+    for (; i < headers.size() && vBatch.size() < nWays; i++) {
+        if (mapBlockIndex.count(headers[i].GetHash()))
+            continue;
+        vBatch.push_back(headers[i]);
+        vPos.push_back(i);
+    }
+    if (vBatch.size() > 1) {
+        std::vector<uint256> vHash = GetPoWHashes(vBatch);
+        for (size_t j = 0; j < vPos.size(); j++)
+            vHashPoW[vPos[j]] = vHash[j];
+    }
+    return i;
+}
+
 // Exposed wrapper for AcceptBlockHeader
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex)
 {
     {
         LOCK(cs_main);
-        for (const CBlockHeader& header : headers) {
+        std::vector<uint256> vHashPoW(headers.size());
+        size_t nHashed = 0;
+        for (size_t i = 0; i < headers.size(); i++) {
+            if (i >= nHashed)
+                nHashed = BatchHeaderPoWHashes(headers, i, vHashPoW);
             CBlockIndex *pindex = NULL; // Use a temp pindex instead of ppindex to avoid a const_cast
-            if (!AcceptBlockHeader(header, state, chainparams, &pindex)) {
+            if (!AcceptBlockHeader(headers[i], state, chainparams, &pindex, &vHashPoW[i])) {
                 return false;
             }
             if (ppindex) {
@@ -3289,28 +3593,37 @@ static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidation
     return true;
 }
 
-bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<const CBlock> pblock, bool fForceProcessing, bool *fNewBlock)
+/** Check a new block and store it, without connecting it. Returns false if it is invalid or could not be stored. */
+static bool AcceptNewBlock(const CChainParams& chainparams, const std::shared_ptr<const CBlock>& pblock, bool fForceProcessing, bool *fNewBlock)
 {
-    {
-        CBlockIndex *pindex = NULL;
-        if (fNewBlock) *fNewBlock = false;
-        CValidationState state;
-        // Ensure that CheckBlock() passes before calling AcceptBlock, as
-        // belt-and-suspenders.
-        bool ret = CheckBlock(*pblock, state, chainparams.GetConsensus());
+    CBlockIndex *pindex = NULL;
+    if (fNewBlock) *fNewBlock = false;
+    CValidationState state;
+    // Ensure that CheckBlock() passes before calling AcceptBlock, as
+    // belt-and-suspenders.
+    bool ret = CheckBlock(*pblock, state, chainparams.GetConsensus());
 
-        LOCK(cs_main);
+    LOCK(cs_main);
 
-        if (ret) {
-            // Store to disk
-            ret = AcceptBlock(pblock, state, chainparams, &pindex, fForceProcessing, NULL, fNewBlock);
-        }
-        CheckBlockIndex(chainparams.GetConsensus());
-        if (!ret) {
-            GetMainSignals().BlockChecked(*pblock, state);
-            return error("%s: AcceptBlock FAILED", __func__);
-        }
+    if (ret) {
+        // Store to disk
+        ret = AcceptBlock(pblock, state, chainparams, &pindex, fForceProcessing, NULL, fNewBlock);
     }
+    CheckBlockIndex(chainparams.GetConsensus());
+    if (!ret) {
+        GetMainSignals().BlockChecked(*pblock, state);
+        return error("%s: AcceptBlock FAILED", __func__);
+    }
+    // Start reading the inputs of blocks that may be connected soon
+    if (pcoinsPrefetcher && pindex->nHeight > chainActive.Height())
+        pcoinsPrefetcher->Prefetch(*pblock, pindex->nHeight, *pcoinsTip);
+    return true;
+}
+
+bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<const CBlock> pblock, bool fForceProcessing, bool *fNewBlock)
+{
+    if (!AcceptNewBlock(chainparams, pblock, fForceProcessing, fNewBlock))
+        return false;
 
     NotifyHeaderTip();
 
@@ -3321,6 +3634,31 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
     return true;
 }
 
+static bool PipelineAcceptBlock(const std::shared_ptr<const CBlock>& pblock, bool fForceProcessing, bool *fNewBlock)
+{
+    if (!AcceptNewBlock(Params(), pblock, fForceProcessing, fNewBlock))
+        return false;
+    NotifyHeaderTip();
+    return true;
+}
+
+static void PipelineConnectBlocks(const std::shared_ptr<const CBlock>& pblock)
+{
+    CValidationState state; // Only used to report errors, not invalidity - ignore it
+    if (!ActivateBestChain(state, Params(), pblock))
+        error("%s: ActivateBestChain failed", __func__);
+}
+
+CBlockPipeline* CreateBlockPipeline()
+{
+    return new CBlockPipeline(&PipelineAcceptBlock, &PipelineConnectBlocks);
+}
+
+bool QueueNewBlock(const std::shared_ptr<const CBlock> pblock, bool fForceProcessing, const std::function<void(bool)>& done)
+{
+    return pblockPipeline && pblockPipeline->Submit(pblock, fForceProcessing, done);
+}
+
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     AssertLockHeld(cs_main);
@@ -3398,6 +3736,12 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+#ifndef WIN32
+        {
+            LOCK(cs_blockFileMappings);
+            mapBlockFileMappings.erase(*it);
+        }
+#endif
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -3548,6 +3892,53 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
+bool VerifyBlockIndexPoW(const std::vector<CBlockIndex*>& vIndex, const Consensus::Params& consensusParams)
+{
+    int64_t nStart = GetTimeMillis();
+
+    // Hash all headers on every core; each worker claims small batches of
+    // entries and keeps its own scrypt scratchpad.
+    std::vector<uint256> vHashPoW(vIndex.size());
+    std::atomic<size_t> nNext(0);
+    const size_t nBatchSize = 64;
+    auto worker = [&]() {
+        std::vector<char> scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+        while (!ShutdownRequested()) {
+            size_t nBegin = nNext.fetch_add(nBatchSize);
+            if (nBegin >= vIndex.size())
+                break;
+            size_t nEnd = std::min(nBegin + nBatchSize, vIndex.size());
+            for (size_t i = nBegin; i < nEnd; i++) {
+                CBlockHeader header = vIndex[i]->GetBlockHeader();
+                scrypt_1024_1_1_256_sp(BEGIN(header.nVersion), BEGIN(vHashPoW[i]), scratchpad.data());
+            }
+        }
+    };
+    int nThreads = std::max(GetNumCores(), 1);
+    std::vector<std::thread> threads;
+    for (int i = 1; i < nThreads; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread& t : threads)
+        t.join();
+    if (ShutdownRequested())
+        return true;
+
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        CBlockIndex* pindex = vIndex[i];
+        if ((pindex->nStatus & BLOCK_HAVE_POWHASH) && pindex->hashPoW != vHashPoW[i])
+            return error("%s: cached PoW hash mismatch: %s", __func__, pindex->ToString());
+        if (!CheckProofOfWork(vHashPoW[i], pindex->nBits, consensusParams))
+            return error("%s: CheckProofOfWork failed: %s", __func__, pindex->ToString());
+        if (!(pindex->nStatus & BLOCK_HAVE_POWHASH)) {
+            pindex->SetBlockPoWHash(vHashPoW[i]);
+            setDirtyBlockIndex.insert(pindex);
+        }
+    }
+    LogPrintf("%s: verified PoW of %u headers using %d threads in %dms\n", __func__, vIndex.size(), nThreads, GetTimeMillis() - nStart);
+    return true;
+}
+
 bool static LoadBlockIndexDB(const CChainParams& chainparams)
 {
 
@@ -3594,6 +3985,39 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
             pindexBestHeader = pindex;
     }
 
+    // Re-verify the PoW of every header except genesis, which is never checked
+    if (fCheckBlockPoW) {
+        std::vector<CBlockIndex*> vIndex;
+        vIndex.reserve(vSortedByHeight.size());
+        BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
+        {
+            if (item.second->pprev)
+                vIndex.push_back(item.second);
+        }
+        if (!VerifyBlockIndexPoW(vIndex, chainparams.GetConsensus()))
+            return false;
+    } else {
+        // LoadBlockIndexGuts only checked the cached PoW hashes against nBits, so
+        // re-hash the best header and a random sample of the others to catch a
+        // cached hash that does not belong to its header.
+        std::vector<CBlockIndex*> vCached;
+        BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
+        {
+            CBlockIndex* pindex = item.second;
+            if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_POWHASH) && pindex != pindexBestHeader)
+                vCached.push_back(pindex);
+        }
+        std::vector<CBlockIndex*> vSample;
+        if (pindexBestHeader && pindexBestHeader->pprev && (pindexBestHeader->nStatus & BLOCK_HAVE_POWHASH))
+            vSample.push_back(pindexBestHeader);
+        for (size_t i = 0; i < vCached.size() && i < BLOCK_INDEX_POW_SAMPLE_SIZE; i++) {
+            std::swap(vCached[i], vCached[i + GetRand(vCached.size() - i)]);
+            vSample.push_back(vCached[i]);
+        }
+        if (!VerifyBlockIndexPoW(vSample, chainparams.GetConsensus()))
+            return false;
+    }
+
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
     vinfoBlockFile.resize(nLastBlockFile + 1);
@@ -3913,7 +4337,7 @@ bool InitBlockIndex(const CChainParams& chainparams)
                 return error("LoadBlockIndex(): FindBlockPos failed");
             if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
                 return error("LoadBlockIndex(): writing genesis block to disk failed");
-            CBlockIndex* pindex = AddToBlockIndex(block);
+            CBlockIndex* pindex = AddToBlockIndex(block, block.GetPoWHash());
             if (!ReceivedBlockTransactions(block, state, pindex, blockPos))
                 return error("LoadBlockIndex(): genesis block not accepted");
             // Force a chainstate write so that when we VerifyDB in a moment, it doesn't check stale data
@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <exception>
+#include <functional>
 #include <map>
 #include <set>
 #include <stdint.h>
@@ -33,12 +34,17 @@
 #include <boost/filesystem/path.hpp>
 
 class CBlockIndex;
+class CBlockPipeline;
 class CBlockTreeDB;
 class CBloomFilter;
 class CChainParams;
+class CCoinsPrefetcher;
+class CCoinsViewAsyncWriter;
 class CInv;
 class CConnman;
+class CDeferredSignatures;
 class CScriptCheck;
+class CSharedBytes;
 class CTxMemPool;
 class CValidationInterface;
 class CValidationState;
@@ -80,8 +86,23 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
+/** Maximum number of block input prefetching threads allowed */
+static const int MAX_PREFETCH_THREADS = 16;
+/** -prefetchthreads default (number of block input prefetching threads, 0 = disabled) */
+static const int DEFAULT_PREFETCH_THREADS = 4;
+/** Maximum number of threads checking blocks received during initial sync */
+static const int MAX_BLOCKCHECK_THREADS = 16;
+/** -blockcheckthreads default (number of threads checking blocks received during initial sync, 0 = pipeline disabled) */
+static const int DEFAULT_BLOCKCHECK_THREADS = 2;
+/** Number of blocks that can be requested at any given time from a single peer, until its delivery rate is known. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds of the number of blocks in flight per peer once it is sized to the peer's delivery rate. */
+static const int MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 128;
+/** Time in microseconds worth of blocks that a peer is asked for at once, at its measured delivery rate. */
+static const int64_t BLOCK_DOWNLOAD_TARGET_TIME = 2 * 1000000;
+/** Shortest time in microseconds a block that holds up the download window must be in flight before it is asked from a faster peer. */
+static const int64_t BLOCK_REASSIGN_MIN_TIME = 250000;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -170,6 +191,8 @@ extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
+/** Whether to recompute and verify the PoW hash of every block header at startup */
+extern bool fCheckBlockPoW;
 extern bool fCheckpointsEnabled;
 extern size_t nCoinCacheUsage;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
@@ -201,6 +224,15 @@ static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
 
 static const signed int DEFAULT_CHECKBLOCKS = 6 * 4;
 static const unsigned int DEFAULT_CHECKLEVEL = 3;
+static const bool DEFAULT_CHECKBLOCKPOW = false;
+/**
+ * Number of randomly chosen block index entries whose cached PoW hash is
+ * re-hashed on startup. This is a spot check: a cached hash outside the sample
+ * that no longer matches its header (e.g. from disk corruption) goes unnoticed,
+ * as the cached hash is only used to check the header against nBits again.
+ * -checkblockpow re-hashes every entry instead.
+ */
+static const unsigned int BLOCK_INDEX_POW_SAMPLE_SIZE = 512;
 
 // Require that user allocate at least 550MB for block & undo files (blk???.dat and rev???.dat)
 // At 1MB per block, 288 blocks = 288MB.
@@ -233,6 +265,23 @@ static const uint64_t MIN_DISK_SPACE_FOR_BLOCK_FILES = 550 * 1024 * 1024;
  */
 bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<const CBlock> pblock, bool fForceProcessing, bool* fNewBlock);
 
+/**
+ * Hand a block received during initial sync to the block pipeline, which
+ * checks, stores and connects it on its own threads, and return right
+ * away. Returns false if the pipeline is disabled or full, in which case the
+ * block should be passed to ProcessNewBlock instead.
+ *
+ * done is called on a pipeline thread, without cs_main held, once the block
+ * was stored or found invalid. It is passed whether the block was new, like
+ * fNewBlock of ProcessNewBlock.
+ *
+ * Call without cs_main held.
+ */
+bool QueueNewBlock(const std::shared_ptr<const CBlock> pblock, bool fForceProcessing, const std::function<void(bool)>& done);
+
+/** Create a block pipeline that feeds blocks through validation, for pblockPipeline */
+CBlockPipeline* CreateBlockPipeline();
+
 /**
  * Process incoming block headers.
  *
@@ -261,8 +310,16 @@ bool InitBlockIndex(const CChainParams& chainparams);
 bool LoadBlockIndex(const CChainParams& chainparams);
 /** Unload database information */
 void UnloadBlockIndex();
+/** Recompute the scrypt PoW hash of the given (linked) block index entries on all cores, check it, and cache it where missing */
+bool VerifyBlockIndexPoW(const std::vector<CBlockIndex*>& vIndex, const Consensus::Params& consensusParams);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the block input prefetching thread */
+void ThreadCoinsPrefetch();
+/** Run an instance of the block pipeline's check thread */
+void ThreadBlockCheck();
+/** Run the block pipeline's connect thread */
+void ThreadBlockConnect();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core.
@@ -447,12 +504,19 @@ private:
 
 public:
     CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
-        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey), amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
+        scriptPubKey(outIn.scriptPubKey), amount(outIn.nValue),
         ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
 
     bool operator()();
 
+    /**
+     * Run the script, adding the signatures that are not in the cache to
+     * deferred instead of verifying them. They are assumed valid meanwhile,
+     * so the result only holds if they all turn out to be.
+     */
+    bool RunDeferred(CDeferredSignatures& deferred);
+
     void swap(CScriptCheck &check) {
         scriptPubKey.swap(check.scriptPubKey);
         std::swap(ptxTo, check.ptxTo);
@@ -467,11 +531,28 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Run a batch of script checks for CCheckQueue, verifying the signatures of
+ * all of them together. Gives the same result as running each check on its
+ * own: a check is run again with its signatures verified one at a time if
+ * it fails, or if any of its signatures turns out invalid.
+ */
+bool RunChecks(std::vector<CScriptCheck>& vChecks);
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/**
+ * Get the serialized block at pos, as stored on disk (with witness data),
+ * without deserializing it. Where possible the block file is memory mapped
+ * and the result refers into the mapping instead of holding a copy.
+ */
+bool ReadRawBlockFromDisk(CSharedBytes& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+/** Like the above, but also fail unless the header read hashes to hash, as ReadBlockFromDisk does */
+bool ReadRawBlockFromDisk(CSharedBytes& block, const CDiskBlockPos& pos, const uint256& hash, const CMessageHeader::MessageStartChars& messageStart);
+bool ReadRawBlockFromDisk(CSharedBytes& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -538,6 +619,15 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Global variable that points to the prefetcher warming pcoinsTip with block inputs, if enabled */
+extern CCoinsPrefetcher *pcoinsPrefetcher;
+
+/** Global variable that points to the view below pcoinsTip that writes flushed coins to disk in the background */
+extern CCoinsViewAsyncWriter *pcoinsWriter;
+
+/** Global variable that points to the pipeline taking blocks received during initial sync, if enabled */
+extern CBlockPipeline *pblockPipeline;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
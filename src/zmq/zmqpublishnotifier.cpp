@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "chainparams.h"
+#include "sharedbytes.h"
 #include "streams.h"
 #include "zmqpublishnotifier.h"
 #include "validation.h"
@@ -166,6 +167,21 @@ bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     LogPrint("zmq", "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
 
+    if (RPCSerializationFlags() == 0)
+    {
+        // Publish the block as stored on disk, without deserializing it
+        CSharedBytes rawBlock;
+        {
+            LOCK(cs_main);
+            if (!ReadRawBlockFromDisk(rawBlock, pindex, Params().MessageStart()))
+            {
+                zmqError("Can't read block from disk");
+                return false;
+            }
+        }
+        return SendMessage(MSG_RAWBLOCK, rawBlock.data(), rawBlock.size());
+    }
+
     const Consensus::Params& consensusParams = Params().GetConsensus();
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
     {